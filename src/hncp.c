@@ -13,6 +13,7 @@
 
 #include "hncp_i.h"
 #include <libubox/md5.h>
+#include "md5_multi.h"
 #include <net/ethernet.h>
 #include <arpa/inet.h>
 
@@ -30,6 +31,12 @@ compare_nodes(const void *a, const void *b, void *ptr __unused)
   return hncp_node_cmp(n1, n2);
 }
 
+static int
+compare_hashes(const void *a, const void *b, void *ptr __unused)
+{
+  return memcmp(a, b, HNCP_HASH_LEN);
+}
+
 void hncp_schedule(hncp o)
 {
   if (o->io_init_done)
@@ -43,8 +50,234 @@ void hncp_schedule(hncp o)
     o->should_schedule = true;
 }
 
+/* NEIGHBOR TLVs of a container, one at a time (same sanity checks as
+ * in tlv_for_each_attr). */
+static struct tlv_attr *_next_neighbor_tlv(struct tlv_attr *container,
+                                           struct tlv_attr *a)
+{
+  void *end;
+
+  if (!container)
+    return NULL;
+  end = tlv_data(container) + tlv_len(container);
+  for (a = a ? tlv_next(a) : tlv_data(container) ;
+       (void *)a + sizeof(*a) <= end
+         && tlv_raw_len(a) >= sizeof(*a)
+         && (void *)a + tlv_raw_len(a) <= end ;
+       a = tlv_next(a))
+    if (tlv_id(a) == HNCP_T_NODE_DATA_NEIGHBOR)
+      return a;
+  return NULL;
+}
+
+static bool _neighbor_tlvs_equal(struct tlv_attr *c1, struct tlv_attr *c2)
+{
+  struct tlv_attr *a1 = _next_neighbor_tlv(c1, NULL);
+  struct tlv_attr *a2 = _next_neighbor_tlv(c2, NULL);
+
+  while (a1 && a2)
+    {
+      if (!tlv_attr_equal(a1, a2))
+        return false;
+      a1 = _next_neighbor_tlv(c1, a1);
+      a2 = _next_neighbor_tlv(c2, a2);
+    }
+  return !a1 && !a2;
+}
+
+/* Is every NEIGHBOR TLV in c1 also in c2? */
+static bool _neighbor_tlvs_subset(struct tlv_attr *c1, struct tlv_attr *c2)
+{
+  struct tlv_attr *a1, *a2;
+
+  for (a1 = _next_neighbor_tlv(c1, NULL) ;
+       a1 ;
+       a1 = _next_neighbor_tlv(c1, a1))
+    {
+      for (a2 = _next_neighbor_tlv(c2, NULL) ;
+           a2 && !tlv_attr_equal(a1, a2) ;
+           a2 = _next_neighbor_tlv(c2, a2));
+      if (!a2)
+        return false;
+    }
+  return true;
+}
+
+static void _add_prune_seed(hncp o, hncp_node n)
+{
+  if (n->prune_seed)
+    return;
+  if (o->num_prune_seeds == o->prune_seeds_size)
+    {
+      int size = o->prune_seeds_size ? o->prune_seeds_size * 2 : 16;
+      hncp_node *seeds = realloc(o->prune_seeds, size * sizeof(*seeds));
+
+      if (!seeds)
+        {
+          o->graph_dirty_full = true;
+          return;
+        }
+      o->prune_seeds = seeds;
+      o->prune_seeds_size = size;
+    }
+  o->prune_seeds[o->num_prune_seeds++] = n;
+  n->prune_seed = true;
+}
+
+static void _remove_prune_seed(hncp o, hncp_node n)
+{
+  int i;
+
+  if (!n->prune_seed)
+    return;
+  for (i = 0 ; i < o->num_prune_seeds ; i++)
+    if (o->prune_seeds[i] == n)
+      {
+        o->prune_seeds[i] = o->prune_seeds[--o->num_prune_seeds];
+        break;
+      }
+  n->prune_seed = false;
+}
+
+/* Neighbor TLVs of a node changed from old to new; figure how much of
+ * the graph has to be looked at again. */
+static void _neighbors_changed(hncp_node n,
+                               struct tlv_attr *old, struct tlv_attr *new)
+{
+  hncp o = n->hncp;
+
+  /* Lost edges of a reachable node may make any part of the graph
+   * unreachable. Unreachable nodes' edges do not matter. */
+  if (n->last_reachable_prune == o->last_prune
+      && !_neighbor_tlvs_subset(old, new))
+    {
+      o->graph_dirty = true;
+      o->graph_dirty_full = true;
+      return;
+    }
+  /* New edges can only make more nodes reachable. */
+  if (!o->graph_dirty_full && !_neighbor_tlvs_subset(new, old))
+    {
+      o->graph_dirty = true;
+      _add_prune_seed(o, n);
+    }
+}
+
+static void _invalidate_peer_adjacencies(hncp o, struct tlv_attr *container)
+{
+  struct tlv_attr *a;
+  hncp_t_node_data_neighbor ne;
+  hncp_node n;
+
+  for (a = _next_neighbor_tlv(container, NULL) ;
+       a ;
+       a = _next_neighbor_tlv(container, a))
+    if ((ne = hncp_tlv_neighbor(a))
+        && (n = hncp_find_node_by_hash(o, &ne->neighbor_node_identifier_hash,
+                                       false)))
+      n->adjacencies_dirty = true;
+}
+
+static int _tlv_range_cmp(const void *a, const void *b)
+{
+  const hncp_tlv_range_s *r1 = a, *r2 = b;
+
+  if (r1->type != r2->type)
+    return r1->type < r2->type ? -1 : 1;
+  return r1->offset < r2->offset ? -1 : r1->offset > r2->offset;
+}
+
+/* (Re)build the type -> TLV range table of n. */
+static void _node_index_tlvs(hncp_node n)
+{
+  hncp o = n->hncp;
+  struct tlv_attr *c = n->tlv_container_valid, *a;
+  hncp_tlv_range r;
+  int type = -1, count = 0, i, j;
+  bool sorted = true;
+
+  if (c)
+    tlv_for_each_attr(a, c)
+      if ((int)tlv_id(a) != type)
+        {
+          if ((int)tlv_id(a) < type)
+            sorted = false;
+          type = tlv_id(a);
+          count++;
+        }
+  if (count != n->num_tlv_ranges)
+    {
+      hncp_arena_free(o, n->tlv_ranges,
+                      n->num_tlv_ranges * sizeof(*n->tlv_ranges));
+      n->tlv_ranges = NULL;
+      n->num_tlv_ranges = 0;
+      if (count
+          && !(n->tlv_ranges = hncp_arena_alloc(o, count * sizeof(*r))))
+        {
+          L_ERR("_node_index_tlvs: out of memory");
+          return;
+        }
+    }
+  n->num_tlv_ranges = count;
+  if (!count)
+    return;
+  r = n->tlv_ranges - 1;
+  type = -1;
+  tlv_for_each_attr(a, c)
+    {
+      if ((int)tlv_id(a) != type)
+        {
+          r++;
+          r->type = type = tlv_id(a);
+          r->count = 0;
+          r->offset = (void *)a - tlv_data(c);
+        }
+      r->count++;
+      r->end = (void *)tlv_next(a) - tlv_data(c);
+    }
+  if (sorted)
+    return;
+  /* Someone did not sort their TLVs; only the first run of each type
+   * is found then. */
+  L_DEBUG("_node_index_tlvs: %s has unsorted TLVs", HNCP_NODE_REPR(n));
+  qsort(n->tlv_ranges, count, sizeof(*r), _tlv_range_cmp);
+  for (i = 1, j = 0 ; i < count ; i++)
+    if (n->tlv_ranges[i].type != n->tlv_ranges[j].type)
+      n->tlv_ranges[++j] = n->tlv_ranges[i];
+  if (++j == count)
+    return;
+  if (!(r = hncp_arena_alloc(o, j * sizeof(*r))))
+    {
+      L_ERR("_node_index_tlvs: out of memory");
+      j = 0;
+    }
+  else
+    memcpy(r, n->tlv_ranges, j * sizeof(*r));
+  hncp_arena_free(o, n->tlv_ranges, count * sizeof(*r));
+  n->tlv_ranges = r;
+  n->num_tlv_ranges = j;
+}
+
 void hncp_node_set(hncp_node n, uint32_t update_number,
                    hnetd_time_t t, struct tlv_attr *a)
+{
+  hncp_node_set_hashed(n, update_number, t, a, NULL);
+}
+
+/* Whether a is the same as the current data of n. With a known hash,
+ * a (same update number) hash match is enough. */
+static bool _node_data_same(hncp_node n, uint32_t update_number,
+                            struct tlv_attr *a, hncp_hash h)
+{
+  if (!n->tlv_container)
+    return false;
+  if (h && !n->node_data_hash_dirty && n->update_number == update_number)
+    return !memcmp(h, &n->node_data_hash, HNCP_HASH_LEN);
+  return tlv_attr_equal(n->tlv_container, a);
+}
+
+void hncp_node_set_hashed(hncp_node n, uint32_t update_number,
+                          hnetd_time_t t, struct tlv_attr *a, hncp_hash h)
 {
   struct tlv_attr *a_valid = a;
   bool node_hash_changed = true;
@@ -58,7 +291,7 @@ void hncp_node_set(hncp_node n, uint32_t update_number,
    * handle version check  */
   if (a)
     {
-      if (n->tlv_container && tlv_attr_equal(n->tlv_container, a))
+      if (_node_data_same(n, update_number, a, h))
         {
           if (n->tlv_container != a)
             {
@@ -76,6 +309,13 @@ void hncp_node_set(hncp_node n, uint32_t update_number,
           struct tlv_attr *va;
           hncp_node on = n->hncp->own_node;
 
+          /* New data lives in the arena from here on. */
+          if (!(a = hncp_arena_adopt_tlv(n->hncp, a)))
+            {
+              L_ERR("hncp_node_set: out of memory");
+              return;
+            }
+          a_valid = a;
           tlv_for_each_attr(va, a)
             {
               if (tlv_id(va) == HNCP_T_VERSION &&
@@ -101,7 +341,6 @@ void hncp_node_set(hncp_node n, uint32_t update_number,
               n->version = version;
             }
         }
-      n->hncp->graph_dirty = true;
       should_schedule = true;
     }
 
@@ -122,11 +361,27 @@ void hncp_node_set(hncp_node n, uint32_t update_number,
       if (n->last_reachable_prune == n->hncp->last_prune)
         hncp_notify_subscribers_tlvs_changed(n, n->tlv_container_valid,
                                              a_valid);
-      if (n->tlv_container)
-        free(n->tlv_container);
+      if (!_neighbor_tlvs_equal(n->tlv_container_valid, a_valid))
+        {
+          n->adjacencies_dirty = true;
+          _invalidate_peer_adjacencies(n->hncp, n->tlv_container_valid);
+          _invalidate_peer_adjacencies(n->hncp, a_valid);
+          _neighbors_changed(n, n->tlv_container_valid, a_valid);
+        }
+      /* Keep the old data around for delta replies, but only if we
+       * know what its hash (that requesters refer to it by) was. */
+      if (n->hncp->delta_sync && n->tlv_container
+          && !n->node_data_hash_dirty)
+        {
+          hncp_arena_free_tlv(n->hncp, n->prev_tlv_container);
+          n->prev_tlv_container = n->tlv_container;
+          n->prev_node_data_hash = n->node_data_hash;
+        }
+      else
+        hncp_arena_free_tlv(n->hncp, n->tlv_container);
       n->tlv_container = a;
       n->tlv_container_valid = a_valid;
-      n->tlv_index_dirty = true;
+      _node_index_tlvs(n);
     }
 
   /* If something that affects network hash has changed,
@@ -134,15 +389,112 @@ void hncp_node_set(hncp_node n, uint32_t update_number,
   if (node_hash_changed)
     {
       n->node_data_hash_dirty = true;
-      n->hncp->network_hash_dirty = true;
+      n->node_data_reply_valid = false;
+      hncp_invalidate_network_hash(n->hncp, n);
       should_schedule = true;
     }
 
+  /* No need to hash the data again. */
+  if (h && a)
+    {
+      n->node_data_hash = *h;
+      n->node_data_hash_dirty = false;
+    }
+
   if (should_schedule)
     hncp_schedule(n->hncp);
 }
 
 
+static inline uint32_t _node_index_hash(hncp_hash h)
+{
+  uint32_t v[HNCP_HASH_LEN / sizeof(uint32_t)];
+
+  /* Node identifier hashes are already random; just fold them. */
+  memcpy(v, h, sizeof(v));
+  return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+static int _node_index_find(hncp o, hncp_hash h)
+{
+  uint32_t mask = o->node_index_size - 1;
+  uint32_t i = _node_index_hash(h) & mask;
+  hncp_node n;
+
+  while ((n = o->node_index[i]))
+    {
+      if (!memcmp(&n->node_identifier_hash, h, HNCP_HASH_LEN))
+        return i;
+      i = (i + 1) & mask;
+    }
+  return -i - 1;
+}
+
+static bool _node_index_resize(hncp o, int size)
+{
+  hncp_node *old = o->node_index;
+  int i, old_size = o->node_index_size;
+
+  o->node_index = calloc(size, sizeof(*o->node_index));
+  if (!o->node_index)
+    {
+      o->node_index = old;
+      return false;
+    }
+  o->node_index_size = size;
+  for (i = 0 ; i < old_size ; i++)
+    if (old[i])
+      o->node_index[-_node_index_find(o, &old[i]->node_identifier_hash) - 1]
+        = old[i];
+  free(old);
+  return true;
+}
+
+static bool _node_index_add(hncp o, hncp_node n)
+{
+  int i;
+
+  /* Keep load factor at most 1/2. */
+  if ((o->num_node_index + 1) * 2 > o->node_index_size
+      && !_node_index_resize(o, o->node_index_size ? o->node_index_size * 2 : 64))
+    return false;
+  i = _node_index_find(o, &n->node_identifier_hash);
+  if (i >= 0)
+    {
+      o->node_index[i] = n;
+      return true;
+    }
+  o->node_index[-i - 1] = n;
+  o->num_node_index++;
+  return true;
+}
+
+static void _node_index_remove(hncp o, hncp_node n)
+{
+  uint32_t mask = o->node_index_size - 1;
+  uint32_t i, j, k;
+
+  if (!o->node_index_size)
+    return;
+  i = _node_index_find(o, &n->node_identifier_hash);
+  if ((int)i < 0 || o->node_index[i] != n)
+    return;
+  o->num_node_index--;
+
+  /* Backward shift deletion; no tombstones needed. */
+  for (j = (i + 1) & mask ; o->node_index[j] ; j = (j + 1) & mask)
+    {
+      k = _node_index_hash(&o->node_index[j]->node_identifier_hash) & mask;
+      /* Move entry at j to i if its home slot k is not in (i, j]. */
+      if (i <= j ? (k <= i || k > j) : (k <= i && k > j))
+        {
+          o->node_index[i] = o->node_index[j];
+          i = j;
+        }
+    }
+  o->node_index[i] = NULL;
+}
+
 static void update_node(__unused struct vlist_tree *t,
                         struct vlist_node *node_new,
                         struct vlist_node *node_old)
@@ -155,20 +507,34 @@ static void update_node(__unused struct vlist_tree *t,
     return;
   if (n_old)
     {
+      _node_index_remove(o, n_old);
+      hncp_invalidate_network_hash(o, n_old);
+      if (n_old->last_reachable_prune == o->last_prune)
+        {
+          o->graph_dirty = true;
+          o->graph_dirty_full = true;
+        }
       hncp_node_set(n_old, 0, 0, NULL);
-      if (n_old->tlv_index)
-        free(n_old->tlv_index);
-      free(n_old);
+      /* Batched changes must not outlive the node. */
+      hncp_notify_subscribers_tlv_changes(o, n_old);
+      _remove_prune_seed(o, n_old);
+      hncp_arena_free_tlv(o, n_old->prev_tlv_container);
+      free(n_old->adjacencies);
+      hncp_pool_free(&o->node_pool, n_old);
     }
   if (n_new)
     {
       n_new->node_data_hash_dirty = true;
-      n_new->tlv_index_dirty = true;
       /* By default unreachable */
       n_new->last_reachable_prune = o->last_prune - 1;
+      /* Get rid of it once the grace period is over, unless it
+       * becomes reachable. */
+      o->next_prune = TMIN(o->next_prune,
+                           o->last_prune + HNCP_PRUNE_GRACE_PERIOD);
+      hncp_invalidate_network_hash(o, n_new);
+      if (!_node_index_add(o, n_new))
+        L_ERR("unable to add node to node index");
     }
-  o->network_hash_dirty = true;
-  o->graph_dirty = true;
   hncp_schedule(o);
 }
 
@@ -181,6 +547,93 @@ compare_tlvs(const void *a, const void *b, void *ptr __unused)
   return tlv_attr_cmp(&t1->tlv, &t2->tlv);
 }
 
+static bool _self_tlvs_reserve(hncp o, size_t len)
+{
+  size_t need = tlv_raw_len(o->self_tlvs) + len;
+  size_t size = o->self_tlvs_size;
+  struct tlv_attr *a;
+
+  if (need <= size)
+    return true;
+  while (size < need)
+    size *= 2;
+  if (!(a = realloc(o->self_tlvs, size)))
+    return false;
+  o->self_tlvs = a;
+  o->self_tlvs_size = size;
+  return true;
+}
+
+/* Add (or remove) a local TLV at its place in self_tlvs. */
+static void _self_tlvs_patch(hncp o, struct tlv_attr *a, bool add)
+{
+  int len = tlv_pad_len(a);
+  char *p, *end;
+  int r = 1;
+
+  if (o->self_tlvs_stale)
+    return;
+  if (add && !_self_tlvs_reserve(o, len))
+    {
+      o->self_tlvs_stale = true;
+      return;
+    }
+  p = tlv_data(o->self_tlvs);
+  end = (char *)o->self_tlvs + tlv_raw_len(o->self_tlvs);
+  for ( ; p < end ; p += tlv_pad_len((struct tlv_attr *)p))
+    if ((r = tlv_attr_cmp((struct tlv_attr *)p, a)) >= 0)
+      break;
+  if (add ? !r : r)
+    {
+      /* Should not happen; start over at the next flush. */
+      L_ERR("_self_tlvs_patch: local TLVs out of sync");
+      o->self_tlvs_stale = true;
+      return;
+    }
+  if (add)
+    {
+      memmove(p + len, p, end - p);
+      memcpy(p, a, len);
+      tlv_fill_pad((struct tlv_attr *)p);
+      tlv_set_raw_len(o->self_tlvs, tlv_raw_len(o->self_tlvs) + len);
+    }
+  else
+    {
+      memmove(p, p + len, end - p - len);
+      tlv_set_raw_len(o->self_tlvs, tlv_raw_len(o->self_tlvs) - len);
+    }
+}
+
+static bool _self_tlvs_rebuild(hncp o)
+{
+  size_t len = 0;
+  hncp_tlv t;
+
+  if (!o->self_tlvs)
+    {
+      if (!(o->self_tlvs = malloc(HNCP_SELF_TLVS_INITIAL_SIZE)))
+        return false;
+      o->self_tlvs_size = HNCP_SELF_TLVS_INITIAL_SIZE;
+    }
+  tlv_init(o->self_tlvs, 0, TLV_SIZE);
+  vlist_for_each_element(&o->tlvs, t, in_tlvs)
+    len += tlv_pad_len(&t->tlv);
+  if (!_self_tlvs_reserve(o, len))
+    return false;
+  /* The tree is in order already. */
+  vlist_for_each_element(&o->tlvs, t, in_tlvs)
+    {
+      char *p = (char *)o->self_tlvs + tlv_raw_len(o->self_tlvs);
+
+      len = tlv_pad_len(&t->tlv);
+      memcpy(p, &t->tlv, len);
+      tlv_fill_pad((struct tlv_attr *)p);
+      tlv_set_raw_len(o->self_tlvs, tlv_raw_len(o->self_tlvs) + len);
+    }
+  o->self_tlvs_stale = false;
+  return true;
+}
+
 static void update_tlv(struct vlist_tree *t,
                        struct vlist_node *node_new,
                        struct vlist_node *node_old)
@@ -189,10 +642,14 @@ static void update_tlv(struct vlist_tree *t,
   hncp_tlv t_old = container_of(node_old, hncp_tlv_s, in_tlvs);
   __unused hncp_tlv t_new = container_of(node_new, hncp_tlv_s, in_tlvs);
 
+  /* A replacement has the same contents. */
+  if (!t_old != !t_new)
+    _self_tlvs_patch(o, t_old ? &t_old->tlv : &t_new->tlv, !t_old);
   if (t_old)
     {
       hncp_notify_subscribers_local_tlv_changed(o, &t_old->tlv, false);
-      free(t_old);
+      hncp_arena_free(o, t_old, sizeof(*t_old) - sizeof(t_old->tlv)
+                      + tlv_pad_len(&t_old->tlv));
     }
   if (t_new)
     hncp_notify_subscribers_local_tlv_changed(o, &t_new->tlv, true);
@@ -213,6 +670,7 @@ bool hncp_link_join(hncp_link l)
 {
   hncp o = l->hncp;
 
+  hncp_link_set_ifindex(l, hncp_io_get_ifindex(o, l->ifname));
   if (!hncp_io_set_ifname_enabled(o, l->ifname, true))
     {
       l->join_pending = true;
@@ -235,12 +693,15 @@ static void update_link(struct vlist_tree *t,
     {
       if (!t_new && o->io_init_done)
         hncp_io_set_ifname_enabled(o, t_old->ifname, false);
+      hncp_link_set_ifindex(t_old, 0);
       vlist_flush_all(&t_old->neighbors);
+      hncp_timer_cancel(o, &t_old->timer);
       free(t_old);
     }
   else
     {
       hncp_link_join(t_new);
+      hncp_link_schedule(t_new);
     }
   o->links_dirty = true;
   hncp_schedule(o);
@@ -268,15 +729,20 @@ static void update_neighbor(struct vlist_tree *t,
   hncp_neighbor t_old = container_of(node_old, hncp_neighbor_s, in_neighbors);
   hncp_neighbor t_new = container_of(node_new, hncp_neighbor_s, in_neighbors);
 
-  /* New doesn't mean anything, before it has last_response set. */
+  /* New doesn't mean anything, before it has last_response set;
+   * it is pinged right away, though. */
   if (t_new)
-    return;
+    {
+      hncp_neighbor_schedule(t_new);
+      return;
+    }
   if (t_old->last_response)
     {
       o->links_dirty = true;
       hncp_schedule(o);
     }
-  free(t_old);
+  hncp_timer_cancel(o, &t_old->timer);
+  hncp_pool_free(&o->neighbor_pool, t_old);
 }
 
 void hncp_calculate_hash(const void *buf, int len, hncp_hash dest)
@@ -291,19 +757,28 @@ void hncp_calculate_hash(const void *buf, int len, hncp_hash dest)
 
 hncp_node hncp_find_node_by_hash(hncp o, hncp_hash h, bool create)
 {
-  hncp_node ch = container_of(h, hncp_node_s, node_identifier_hash);
-  hncp_node n = vlist_find(&o->nodes, ch, ch, in_nodes);
+  hncp_node n;
+  int i;
+
+  if (o->node_index_size
+      && (i = _node_index_find(o, h)) >= 0)
+    return o->node_index[i];
+  /* If the index could not be kept complete (out of memory), fall
+   * back to the tree. */
+  if (o->num_node_index != (int)o->nodes.avl.count)
+    {
+      hncp_node ch = container_of(h, hncp_node_s, node_identifier_hash);
 
-  if (n)
-    return n;
+      if ((n = vlist_find(&o->nodes, ch, ch, in_nodes)))
+        return n;
+    }
   if (!create)
     return NULL;
-  n = calloc(1, sizeof(*n));
+  n = hncp_pool_alloc(&o->node_pool);
   if (!n)
     return false;
   n->node_identifier_hash = *h;
   n->hncp = o;
-  n->tlv_index_dirty = true;
   vlist_add(&o->nodes, &n->in_nodes, n);
   return n;
 }
@@ -319,6 +794,10 @@ bool hncp_init(hncp o, const void *node_identifier, int len)
   vlist_init(&o->tlvs, compare_tlvs, update_tlv);
   vlist_init(&o->links, compare_links, update_link);
   INIT_LIST_HEAD(&o->link_confs);
+  avl_init(&o->pending_requests, compare_hashes, false, NULL);
+  avl_init(&o->tlv_changes, hncp_tlv_change_cmp, false, NULL);
+  hncp_alloc_init(o);
+  o->self_tlvs_stale = true;
   hncp_calculate_hash(node_identifier, len, &h);
   if (inet_pton(AF_INET6, HNCP_MCAST_GROUP, &o->multicast_address) < 1) {
     L_ERR("unable to inet_pton multicast group address");
@@ -400,6 +879,7 @@ void hncp_uninit(hncp o)
   /* Link destruction will refer to node -> have to be taken out
    * before nodes. */
   vlist_flush_all(&o->links);
+  hncp_flush_pending_requests(o);
 
   /* All except own node should be taken out first. */
   vlist_update(&o->nodes);
@@ -409,9 +889,16 @@ void hncp_uninit(hncp o)
   /* Finally, we can kill own node too. */
   vlist_flush_all(&o->nodes);
 
-  /* Get rid of TLV index. */
-  if (o->num_tlv_indexes)
-    free(o->tlv_type_to_index);
+  free(o->network_hash_checkpoints);
+  free(o->node_index);
+  free(o->prune_seeds);
+  free(o->prune_stack);
+  free(o->timers);
+  tlv_buf_free(&o->network_state);
+  free(o->network_state_nodes);
+  free(o->links_by_ifindex);
+  free(o->self_tlvs);
+  hncp_alloc_uninit(o);
 }
 
 void hncp_destroy(hncp o)
@@ -422,6 +909,52 @@ void hncp_destroy(hncp o)
   free(o);
 }
 
+void hncp_set_bulk_sync(hncp o, bool enabled)
+{
+  L_INFO("bulk sync %s", enabled ? "enabled" : "disabled");
+  o->bulk_sync = enabled;
+}
+
+bool hncp_set_stream_sync(hncp o, bool enabled)
+{
+  if (!hncp_io_stream_set_enabled(o, enabled))
+    {
+      L_ERR("unable to %s stream sync", enabled ? "enable" : "disable");
+      return false;
+    }
+  L_INFO("stream sync %s", enabled ? "enabled" : "disabled");
+  o->stream_sync = enabled;
+  return true;
+}
+
+void hncp_set_bucket_sync(hncp o, bool enabled)
+{
+  L_INFO("bucket sync %s", enabled ? "enabled" : "disabled");
+  o->bucket_sync = enabled;
+}
+
+void hncp_set_multicast_keepalive(hncp o, bool enabled)
+{
+  L_INFO("multicast keepalive %s", enabled ? "enabled" : "disabled");
+  o->multicast_keepalive = enabled;
+}
+
+void hncp_set_delta_sync(hncp o, bool enabled)
+{
+  hncp_node n;
+
+  L_INFO("delta sync %s", enabled ? "enabled" : "disabled");
+  o->delta_sync = enabled;
+  if (enabled)
+    return;
+  hncp_for_each_node_including_unreachable(o, n)
+    if (n->prev_tlv_container)
+      {
+        hncp_arena_free_tlv(o, n->prev_tlv_container);
+        n->prev_tlv_container = NULL;
+      }
+}
+
 hncp_node hncp_get_first_node(hncp o)
 {
   hncp_node n;
@@ -439,7 +972,7 @@ static hncp_tlv _add_tlv(hncp o, struct tlv_attr *tlv)
   hncp_tlv t;
   int s = tlv_pad_len(tlv);
 
-  t = calloc(1, sizeof(*t) + s - sizeof(*tlv));
+  t = hncp_arena_alloc(o, sizeof(*t) + s - sizeof(*tlv));
   if (!t) return NULL;
   memcpy(&t->tlv, tlv, s);
   vlist_add(&o->tlvs, &t->in_tlvs, t);
@@ -480,7 +1013,8 @@ struct tlv_attr *hncp_update_tlv_raw(hncp o,
                                      uint16_t type, void *data, uint16_t len,
                                      bool add)
 {
-  struct tlv_attr *a = alloca(TLV_SIZE + len);
+  /* Room for the padding too. */
+  struct tlv_attr *a = alloca(TLV_SIZE + ((len + 3) & ~3));
 
   if (!a)
     return NULL;
@@ -572,6 +1106,73 @@ hncp_link hncp_find_link_by_id(hncp o, uint32_t link_id)
   return NULL;
 }
 
+/* Interface indexes are typically small; larger ones are just not
+ * kept in links_by_ifindex. */
+#define HNCP_LINKS_BY_IFINDEX_MAX 1024
+
+hncp_link hncp_find_link_by_ifindex(hncp o, int ifindex)
+{
+  hncp_link l;
+
+  if (ifindex <= 0)
+    return NULL;
+  if (ifindex < o->links_by_ifindex_size)
+    return o->links_by_ifindex[ifindex];
+  if (ifindex < HNCP_LINKS_BY_IFINDEX_MAX)
+    return NULL;
+  vlist_for_each_element(&o->links, l, in_links)
+    if (l->ifindex == ifindex)
+      return l;
+  return NULL;
+}
+
+void hncp_link_set_ifindex(hncp_link l, int ifindex)
+{
+  hncp o = l->hncp;
+  hncp_link l2;
+
+  if (ifindex < 0)
+    ifindex = 0;
+  if (l->ifindex == ifindex)
+    return;
+  L_DEBUG("hncp_link_set_ifindex " HNCP_LINK_F " %d -> %d",
+          HNCP_LINK_D(l), l->ifindex, ifindex);
+  if (l->ifindex && l->ifindex < o->links_by_ifindex_size
+      && o->links_by_ifindex[l->ifindex] == l)
+    o->links_by_ifindex[l->ifindex] = NULL;
+  l->ifindex = ifindex;
+  if (!ifindex)
+    return;
+  /* Whoever had the ifindex before us, it is not theirs anymore. */
+  if ((l2 = hncp_find_link_by_ifindex(o, ifindex)) && l2 != l)
+    {
+      l2->ifindex = 0;
+      if (ifindex < o->links_by_ifindex_size)
+        o->links_by_ifindex[ifindex] = NULL;
+    }
+  if (ifindex >= HNCP_LINKS_BY_IFINDEX_MAX)
+    return;
+  if (ifindex >= o->links_by_ifindex_size)
+    {
+      int size = o->links_by_ifindex_size ? o->links_by_ifindex_size : 16;
+      hncp_link *a;
+
+      while (size <= ifindex)
+        size *= 2;
+      if (!(a = realloc(o->links_by_ifindex, size * sizeof(*a))))
+        {
+          /* We can still live without it; it's just slower. */
+          l->ifindex = 0;
+          return;
+        }
+      memset(a + o->links_by_ifindex_size, 0,
+             (size - o->links_by_ifindex_size) * sizeof(*a));
+      o->links_by_ifindex = a;
+      o->links_by_ifindex_size = size;
+    }
+  o->links_by_ifindex[ifindex] = l;
+}
+
 bool hncp_if_set_enabled(hncp o, const char *ifname, bool enabled)
 {
   hncp_link l = hncp_find_link_by_name(o, ifname, false);
@@ -587,7 +1188,11 @@ bool hncp_if_set_enabled(hncp o, const char *ifname, bool enabled)
       return true;
     }
   if (l)
-    return false;
+    {
+      /* Interface may have been re-created behind our back. */
+      hncp_link_set_ifindex(l, hncp_io_get_ifindex(o, ifname));
+      return false;
+    }
   l = hncp_find_link_by_name(o, ifname, true);
   if (l)
     hncp_notify_subscribers_link_changed(l);
@@ -617,41 +1222,20 @@ hncp_node hncp_node_get_next(hncp_node n)
     }
 }
 
-static struct tlv_attr *_produce_new_tlvs(hncp_node n)
+/* Whether local TLVs differ from what we have published. */
+static bool _self_tlvs_changed(hncp_node n)
 {
-  struct tlv_buf tb;
   hncp o = n->hncp;
-  hncp_tlv t;
 
   if (!o->tlvs_dirty)
-    return NULL;
-
-  /* Dump the contents of hncp->tlvs to single tlv_buf. */
-  /* Based on whether or not that would cause change in things, 'do stuff'. */
-  memset(&tb, 0, sizeof(tb));
-  tlv_buf_init(&tb, 0); /* not passed anywhere */
-  vlist_for_each_element(&o->tlvs, t, in_tlvs)
+    return false;
+  if (o->self_tlvs_stale && !_self_tlvs_rebuild(o))
     {
-      struct tlv_attr *a = tlv_put_raw(&tb, &t->tlv, tlv_pad_len(&t->tlv));
-      if (!a)
-        {
-          L_ERR("hncp_self_flush: tlv_put_raw failed?!?");
-          tlv_buf_free(&tb);
-          return NULL;
-        }
-      tlv_fill_pad(a);
+      L_ERR("hncp_self_flush: out of memory");
+      return false;
     }
-  tlv_fill_pad(tb.head);
-
-  /* Ok, all puts _did_ succeed. */
   o->tlvs_dirty = false;
-
-  if (n->tlv_container && tlv_attr_equal(tb.head, n->tlv_container))
-    {
-      tlv_buf_free(&tb);
-      return NULL;
-    }
-  return tb.head;
+  return !n->tlv_container || !tlv_attr_equal(o->self_tlvs, n->tlv_container);
 }
 
 void hncp_self_flush(hncp_node n)
@@ -659,14 +1243,15 @@ void hncp_self_flush(hncp_node n)
   hncp o = n->hncp;
   hncp_link l;
   hncp_neighbor ne;
-  struct tlv_attr *a, *a2;
+  struct tlv_attr *a;
+  bool changed;
 
   if (o->links_dirty)
     {
       L_DEBUG("hncp_self_flush: handling links_dirty");
       o->links_dirty = false;
-      /* Rather crude: We simply get rid of existing link TLVs, and
-       * publish new ones. Assumption: Whatever is added using
+      /* Neighbor TLVs that are still valid are just marked current,
+       * and the rest get flushed. Assumption: Whatever is added using
        * hncp_add_tlv will have version=-1, and dynamically generated
        * content (like links) won't => we can just add the new entries
        * and ignore manually added and/or outdated things. */
@@ -694,14 +1279,21 @@ void hncp_self_flush(hncp_node n)
               d->neighbor_link_id = cpu_to_be32(ne->iid);
               d->link_id = cpu_to_be32(l->iid);
 
-              _add_tlv(o, nt);
+              /* Only the comparison operator sees the key. */
+              hncp_tlv t = container_of(nt, hncp_tlv_s, tlv);
+              hncp_tlv old = vlist_find(&o->tlvs, t, t, in_tlvs);
+
+              if (!old)
+                _add_tlv(o, nt);
+              else if (old->in_tlvs.version != -1)
+                old->in_tlvs.version = o->tlvs.version;
             }
         }
 
       vlist_flush(&o->tlvs);
     }
 
-  if (!(a = _produce_new_tlvs(n)) && !o->republish_tlvs)
+  if (!(changed = _self_tlvs_changed(n)) && !o->republish_tlvs)
     {
       L_DEBUG("hncp_self_flush: state did not change -> nothing to flush");
       return;
@@ -711,15 +1303,19 @@ void hncp_self_flush(hncp_node n)
   hncp_notify_subscribers_about_to_republish_tlvs(n);
 
   o->republish_tlvs = false;
-  a2 = _produce_new_tlvs(n);
-  if (a2)
+  /* Subscribers may have changed them (back, even). */
+  if (o->tlvs_dirty)
+    changed = _self_tlvs_changed(n);
+  a = n->tlv_container;
+  if (changed && !(a = tlv_memdup(o->self_tlvs)))
     {
-      if (a)
-        free(a);
-      a = a2;
+      L_ERR("hncp_self_flush: out of memory");
+      o->tlvs_dirty = true;
+      return;
     }
-  hncp_node_set(n, ++n->update_number, hncp_time(o),
-                a ? a : n->tlv_container);
+  /* Not ++n->update_number; hncp_node_set has to see it change, or
+   * the hash of the same data would not be recalculated. */
+  hncp_node_set(n, n->update_number + 1, hncp_time(o), a);
 }
 
 struct tlv_attr *hncp_node_get_tlvs(hncp_node n)
@@ -728,26 +1324,49 @@ struct tlv_attr *hncp_node_get_tlvs(hncp_node n)
 }
 
 
-void hncp_calculate_node_data_hash(hncp_node n)
+typedef unsigned char
+hncp_node_data_hash_header[TLV_SIZE + sizeof(hncp_t_node_data_header_s)];
+
+/* The NODE_DATA TLV header (which is hashed, followed by the data). */
+static void _node_data_hash_header(hncp_node_data_hash_header buf,
+                                   hncp_hash node_identifier_hash,
+                                   uint32_t update_number, int l)
 {
-  md5_ctx_t ctx;
-  int l;
-  unsigned char buf[TLV_SIZE + sizeof(hncp_t_node_data_header_s)];
   struct tlv_attr *h = (struct tlv_attr *)buf;
   hncp_t_node_data_header ndh = tlv_data(h);
 
-  if (!n->node_data_hash_dirty)
-    return;
+  tlv_init(h, HNCP_T_NODE_DATA, sizeof(hncp_node_data_hash_header) + l);
+  ndh->node_identifier_hash = *node_identifier_hash;
+  ndh->update_number = cpu_to_be32(update_number);
+}
 
-  l = n->tlv_container ? tlv_len(n->tlv_container) : 0;
-  tlv_init(h, HNCP_T_NODE_DATA, sizeof(buf) + l);
-  ndh->node_identifier_hash = n->node_identifier_hash;
-  ndh->update_number = cpu_to_be32(n->update_number);
+/* Hash of the NODE_DATA TLV with the given contents. */
+void hncp_calculate_node_data_hash_of(hncp_hash node_identifier_hash,
+                                      uint32_t update_number,
+                                      struct tlv_attr *container,
+                                      hncp_hash dest)
+{
+  md5_ctx_t ctx;
+  int l;
+  hncp_node_data_hash_header buf;
+
+  l = container ? tlv_len(container) : 0;
+  _node_data_hash_header(buf, node_identifier_hash, update_number, l);
   md5_begin(&ctx);
   md5_hash(buf, sizeof(buf), &ctx);
   if (l)
-    md5_hash(tlv_data(n->tlv_container), l, &ctx);
-  md5_end(&n->node_data_hash, &ctx);
+    md5_hash(tlv_data(container), l, &ctx);
+  md5_end(dest, &ctx);
+}
+
+void hncp_calculate_node_data_hash(hncp_node n)
+{
+  if (!n->node_data_hash_dirty)
+    return;
+
+  hncp_calculate_node_data_hash_of(&n->node_identifier_hash,
+                                   n->update_number, n->tlv_container,
+                                   &n->node_data_hash);
   n->node_data_hash_dirty = false;
   L_DEBUG("hncp_calculate_node_data_hash @%p %llx=%llx%s",
           n->hncp, hncp_hash64(&n->node_identifier_hash),
@@ -755,16 +1374,148 @@ void hncp_calculate_node_data_hash(hncp_node n)
           n == n->hncp->own_node ? " [self]" : "");
 }
 
+/* Calculate the node data hashes of the dirty nodes from n on; when
+ * there are several, HNCP_HASH_BATCH at a time with md5_multi. */
+static void _calculate_node_data_hashes(hncp_node n)
+{
+  md5_multi_job_s jobs[HNCP_HASH_BATCH];
+  hncp_node_data_hash_header headers[HNCP_HASH_BATCH];
+  hncp_node nodes[HNCP_HASH_BATCH];
+  int i, c = 0, l;
+
+  for ( ; ; n = hncp_node_get_next(n))
+    {
+      if (n && n->node_data_hash_dirty)
+        {
+          l = n->tlv_container ? tlv_len(n->tlv_container) : 0;
+          _node_data_hash_header(headers[c], &n->node_identifier_hash,
+                                 n->update_number, l);
+          jobs[c].prefix = headers[c];
+          jobs[c].prefix_len = sizeof(headers[c]);
+          jobs[c].data = l ? tlv_data(n->tlv_container) : NULL;
+          jobs[c].data_len = l;
+          jobs[c].digest = &n->node_data_hash;
+          nodes[c++] = n;
+        }
+      if (c == HNCP_HASH_BATCH || (!n && c > 1))
+        {
+          md5_multi(jobs, c);
+          for (i = 0 ; i < c ; i++)
+            nodes[i]->node_data_hash_dirty = false;
+          c = 0;
+        }
+      if (!n)
+        break;
+    }
+  /* Just one; the usual way is as fast. */
+  if (c)
+    hncp_calculate_node_data_hash(nodes[0]);
+}
+
+void hncp_invalidate_network_hash(hncp o, hncp_node n)
+{
+  o->network_state_valid = false;
+  if (!o->network_hash_dirty)
+    {
+      o->network_hash_dirty = true;
+      o->network_hash_partial = n != NULL;
+    }
+  else if (!o->network_hash_partial)
+    return;
+  else if (!n)
+    {
+      o->network_hash_partial = false;
+      return;
+    }
+  else if (memcmp(&n->node_identifier_hash, &o->network_hash_dirty_from,
+                  HNCP_HASH_LEN) >= 0)
+    return;
+  if (n)
+    o->network_hash_dirty_from = n->node_identifier_hash;
+}
+
+static bool _add_network_hash_checkpoint(hncp o, hncp_node n, md5_ctx_t *ctx)
+{
+  hncp_network_hash_checkpoint cp;
+
+  if (o->num_network_hash_checkpoints == o->network_hash_checkpoints_size)
+    {
+      int size = o->network_hash_checkpoints_size * 2;
+      if (!size)
+        size = 16;
+      cp = realloc(o->network_hash_checkpoints, size * sizeof(*cp));
+      if (!cp)
+        return false;
+      o->network_hash_checkpoints = cp;
+      o->network_hash_checkpoints_size = size;
+    }
+  cp = &o->network_hash_checkpoints[o->num_network_hash_checkpoints++];
+  cp->node_identifier_hash = n->node_identifier_hash;
+  cp->ctx = *ctx;
+  return true;
+}
+
+/* Find the last checkpoint that was taken at or before the first
+ * change. The MD5 state stored in it is still valid. */
+static int _find_network_hash_checkpoint(hncp o)
+{
+  int lo = 0, hi = o->num_network_hash_checkpoints - 1, i = -1;
+
+  while (lo <= hi)
+    {
+      int mid = (lo + hi) / 2;
+      hncp_network_hash_checkpoint cp = &o->network_hash_checkpoints[mid];
+
+      if (memcmp(&cp->node_identifier_hash, &o->network_hash_dirty_from,
+                 HNCP_HASH_LEN) <= 0)
+        {
+          i = mid;
+          lo = mid + 1;
+        }
+      else
+        hi = mid - 1;
+    }
+  return i;
+}
+
 void hncp_calculate_network_hash(hncp o)
 {
-  hncp_node n;
+  hncp_node n = NULL;
   md5_ctx_t ctx;
+  int i = -1, pos;
+  bool add_checkpoints = true;
 
   if (!o->network_hash_dirty)
     return;
-  md5_begin(&ctx);
-  hncp_for_each_node(o, n)
+  if (o->network_hash_partial)
+    i = _find_network_hash_checkpoint(o);
+  if (i >= 0)
+    {
+      hncp_network_hash_checkpoint cp = &o->network_hash_checkpoints[i];
+      hncp_node ch = container_of(&cp->node_identifier_hash,
+                                  hncp_node_s, node_identifier_hash);
+
+      ctx = cp->ctx;
+      n = avl_find_ge_element(&o->nodes.avl, ch, n, in_nodes.avl);
+      if (n && n->last_reachable_prune != o->last_prune)
+        n = hncp_node_get_next(n);
+    }
+  else
+    {
+      i = 0;
+      md5_begin(&ctx);
+      n = hncp_get_first_node(o);
+    }
+  L_DEBUG("hncp_calculate_network_hash @%p from checkpoint %d/%d",
+          o, i, o->num_network_hash_checkpoints);
+  o->num_network_hash_checkpoints = i;
+  _calculate_node_data_hashes(n);
+  for (pos = i * HNCP_NETWORK_HASH_CHECKPOINT_INTERVAL ;
+       n ;
+       n = hncp_node_get_next(n), pos++)
     {
+      if (add_checkpoints && !(pos % HNCP_NETWORK_HASH_CHECKPOINT_INTERVAL))
+        add_checkpoints = _add_network_hash_checkpoint(o, n, &ctx);
       hncp_calculate_node_data_hash(n);
       md5_hash(&n->node_data_hash, HNCP_HASH_LEN, &ctx);
     }
@@ -772,6 +1523,31 @@ void hncp_calculate_network_hash(hncp o)
   L_DEBUG("hncp_calculate_network_hash @%p =%llx",
           o, hncp_hash64(&o->network_hash));
   o->network_hash_dirty = false;
+  o->network_hash_partial = false;
+}
+
+void hncp_calculate_bucket_hashes(hncp o)
+{
+  hncp_node n;
+  md5_ctx_t ctx;
+  int b;
+
+  hncp_calculate_network_hash(o);
+  if (o->bucket_hashes_valid
+      && !memcmp(&o->bucket_hashes_for, &o->network_hash, HNCP_HASH_LEN))
+    return;
+  /* Nodes are in hash order, so each bucket is a contiguous run. */
+  n = hncp_get_first_node(o);
+  for (b = 0 ; b < HNCP_BUCKETS ; b++)
+    {
+      md5_begin(&ctx);
+      for ( ; n && hncp_hash_bucket(&n->node_identifier_hash) == b ;
+            n = hncp_node_get_next(n))
+        md5_hash(&n->node_data_hash, HNCP_HASH_LEN, &ctx);
+      md5_end(&o->bucket_hashes[b], &ctx);
+    }
+  o->bucket_hashes_for = o->network_hash;
+  o->bucket_hashes_valid = true;
 }
 
 bool
@@ -797,50 +1573,6 @@ hncp_get_ipv6_address(hncp o, char *prefer_ifname, struct in6_addr *addr)
   return false;
 }
 
-bool hncp_add_tlv_index(hncp o, uint16_t type)
-{
-  if (type < o->tlv_type_to_index_length)
-    {
-      if (o->tlv_type_to_index[type])
-        {
-          L_DEBUG("hncp_add_tlv_index called for existing index (type %d)",
-                  (int)type);
-          return true;
-        }
-    }
-  else
-    {
-      int old_len = o->tlv_type_to_index_length;
-      int old_size = old_len * sizeof(o->tlv_type_to_index[0]);
-      int new_len = type + 1;
-      int new_size = new_len * sizeof(o->tlv_type_to_index[0]);
-      int *ni = realloc(o->tlv_type_to_index, new_size);
-      if (!ni)
-        return false;
-      memset((void *)ni + old_size, 0, new_size - old_size);
-      o->tlv_type_to_index = ni;
-      o->tlv_type_to_index_length = new_len;
-      L_DEBUG("hncp_add_tlv_index grew tlv_type_to_index to %d", new_len);
-    }
-
-  L_DEBUG("hncp_add_tlv_index: type #%d = index #%d", type, o->num_tlv_indexes);
-  o->tlv_type_to_index[type] = ++o->num_tlv_indexes;
-
-  /* Free existing indexes */
-  hncp_node n;
-  hncp_for_each_node_including_unreachable(o, n)
-    {
-      if (n->tlv_index)
-        {
-          free(n->tlv_index);
-          n->tlv_index = NULL;
-          n->tlv_index_dirty = true;
-        }
-      assert(n->tlv_index_dirty);
-    }
-  return true;
-}
-
 
 void
 hncp_link_set_ipv6_address(hncp_link l, const struct in6_addr *addr)
@@ -900,45 +1632,36 @@ hncp_if_set_ipv6_address(hncp o, const char *ifname, const struct in6_addr *a)
     hncp_link_set_ipv6_address(l, a);
 }
 
-void hncp_node_recalculate_index(hncp_node n)
+void hncp_node_recalculate_adjacencies(hncp_node n)
 {
-  int size = n->hncp->num_tlv_indexes * 2 * sizeof(n->tlv_index[0]);
-
-  assert(n->tlv_index_dirty);
-  if (!n->tlv_index)
-    {
-      n->tlv_index = calloc(1, size);
-      if (!n->tlv_index)
-        return;
-    }
-  else
-    {
-      memset(n->tlv_index, 0, size);
-    }
-
-  hncp o = n->hncp;
   struct tlv_attr *a;
-  int type = -1;
-  int idx = 0;
+  hncp_t_node_data_neighbor ne;
+  hncp_node n2;
+  int c = 0;
 
-  /* Note: This algorithm isn't particularly clever - while linear in
-   * speed (O(# of indexes + # of entries in tlv_container), it has bit
-   * too significant constant factor for comfort. */
+  n->num_adjacencies = 0;
   hncp_node_for_each_tlv(n, a)
+    if (tlv_id(a) == HNCP_T_NODE_DATA_NEIGHBOR)
+      c++;
+  if (c > n->adjacencies_size)
     {
-      if ((int)tlv_id(a) != type)
-        {
-          type = tlv_id(a);
-          /* No more indexes here -> stop iteration */
-          if (type >= o->tlv_type_to_index_length)
-            break;
-          if (!(idx = o->tlv_type_to_index[type]))
-            continue;
-          n->tlv_index[2 * idx - 2] = a;
-          assert(idx <= n->hncp->num_tlv_indexes);
-        }
-      if (idx)
-        n->tlv_index[2 * idx - 1] = tlv_next(a);
+      hncp_adjacency adj = realloc(n->adjacencies, c * sizeof(*adj));
+
+      if (!adj)
+        return;
+      n->adjacencies = adj;
+      n->adjacencies_size = c;
     }
-  n->tlv_index_dirty = false;
+  hncp_node_for_each_tlv(n, a)
+    if ((ne = hncp_tlv_neighbor(a))
+        && (n2 = hncp_node_find_neigh_bidir(n, ne)))
+      {
+        hncp_adjacency adj = &n->adjacencies[n->num_adjacencies++];
+
+        adj->node = n2;
+        adj->link_id = ne->link_id;
+        adj->neighbor_link_id = ne->neighbor_link_id;
+      }
+  n->adjacencies_dirty = false;
 }
+
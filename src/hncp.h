@@ -38,6 +38,13 @@ typedef struct hncp_node_struct hncp_node_s, *hncp_node;
 
 typedef struct hncp_subscriber_struct hncp_subscriber_s, *hncp_subscriber;
 
+/* One TLV added to or removed from a node's data. */
+typedef struct hncp_tlv_change_struct {
+  hncp_node node;
+  struct tlv_attr *tlv;
+  bool add;
+} hncp_tlv_change_s, *hncp_tlv_change;
+
 /*
  * Flow of HNCP state change notifications (outbound case):
  *
@@ -45,8 +52,13 @@ typedef struct hncp_subscriber_struct hncp_subscriber_s, *hncp_subscriber;
  * .. at some point, when TLV changes are to be published to the network ..
  * - republish_callback is called
  * - tlv_change_callback is called
+ * .. at the end of the hncp_run that follows ..
+ * - tlv_changes_callback is called
  */
 
+/* Types from 63 up share the last bit. */
+#define HNCP_TLV_TYPE_MASK(type) (1ULL << ((type) < 63 ? (type) : 63))
+
 struct hncp_subscriber_struct {
   /**
    * Place within list of subscribers (owned by hncp while subscription
@@ -89,6 +101,27 @@ struct hncp_subscriber_struct {
   void (*tlv_change_callback)(hncp_subscriber s,
                               hncp_node n, struct tlv_attr *tlv, bool add);
 
+  /**
+   * Batched TLV change notification.
+   *
+   * Like tlv_change_callback, but the changes (within any node) are
+   * collected and delivered at most once per hncp_run, removals
+   * first. A TLV that was both added and removed in between is left
+   * out. Node change notifications are not delayed.
+   *
+   * @param changes The changes; valid only during the call.
+   * @param num_changes Number of changes (always > 0).
+   */
+  void (*tlv_changes_callback)(hncp_subscriber s,
+                               hncp_tlv_change changes, int num_changes);
+
+  /**
+   * TLV types tlv_change_callback and tlv_changes_callback are
+   * interested in, as a bitwise or of HNCP_TLV_TYPE_MASK(type)s. Zero
+   * means all of them.
+   */
+  uint64_t tlv_types;
+
   /**
    * Node change notification.
    *
@@ -169,6 +202,53 @@ hncp hncp_create(void);
  */
 void hncp_destroy(hncp o);
 
+/**
+ * Enable or disable bulk synchronization.
+ *
+ * With it, node data requests to (and replies to) peers that support
+ * it too are packed several to a datagram. It is off by default.
+ */
+void hncp_set_bulk_sync(hncp o, bool enabled);
+
+/**
+ * Enable or disable delta synchronization.
+ *
+ * With it, the previous node data of every node is kept, and peers
+ * that say they have it get just the changed TLVs. It is off by
+ * default.
+ */
+void hncp_set_delta_sync(hncp o, bool enabled);
+
+/**
+ * Enable or disable the stream transport.
+ *
+ * With it, we accept TCP connections on the HNCP port, and replies
+ * that do not fit in a datagram are streamed to peers that accept
+ * them too. It is off by default. Returns false if it could not be
+ * enabled.
+ */
+bool hncp_set_stream_sync(hncp o, bool enabled);
+
+/**
+ * Enable or disable bucket synchronization.
+ *
+ * With it, network states too large for multicast carry a hash per
+ * bucket of the node identifier hash space, and on mismatch only the
+ * node states of the differing buckets are asked for. It is off by
+ * default.
+ */
+void hncp_set_bucket_sync(hncp o, bool enabled);
+
+/**
+ * Enable or disable multicast keepalives.
+ *
+ * With it, neighbors we have not heard from in a while are checked on
+ * with one multicast per link, listing every neighbor recently heard
+ * there; peers reply in kind. Only neighbors that do not show up are
+ * pinged with unicast. It is off by default.
+ */
+void hncp_set_multicast_keepalive(hncp o, bool enabled);
+
 /**
  * Get first HNCP node.
  */
@@ -0,0 +1,308 @@
+/*
+ * $Id: hncp_alloc.c $
+ *
+ * Copyright (c) 2014 cisco Systems, Inc.
+ *
+ */
+
+/*
+ * This module implements the allocators of the long-lived and
+ * frequently churned HNCP objects: per-type slab pools (nodes,
+ * neighbors) and an arena of power-of-two size classes (TLVs, node
+ * data). It also keeps a few tlv_bufs for building outgoing messages
+ * in.
+ *
+ * Slabs are HNCP_SLAB_SIZE bytes, aligned to their size, so the slab
+ * of an object is found by masking its address. Objects are handed
+ * out from the partially used slabs first, and a slab that becomes
+ * empty is given back to the system (except for one spare per pool),
+ * so that a burst of nodes or node data does not leave holes all over
+ * the heap once it is gone.
+ */
+
+#include "hncp_i.h"
+
+struct hncp_slab_struct {
+  struct list_head lh;
+  hncp_pool pool;
+  void *free_list;
+  int in_use;
+};
+
+#define SLAB_HEADER_SIZE ((sizeof(hncp_slab_s) + 15) & ~15)
+
+#define SLAB_OF(ptr)                                            \
+  ((hncp_slab)((uintptr_t)(ptr) & ~((uintptr_t)HNCP_SLAB_SIZE - 1)))
+
+void hncp_pool_init(hncp_pool p, const char *name, size_t size)
+{
+  memset(p, 0, sizeof(*p));
+  p->name = name;
+  /* Room (and alignment) for the free list link. */
+  p->size = (size + 7) & ~7;
+  if (p->size < sizeof(void *))
+    p->size = sizeof(void *);
+  p->per_slab = (HNCP_SLAB_SIZE - SLAB_HEADER_SIZE) / p->size;
+  INIT_LIST_HEAD(&p->partial);
+  INIT_LIST_HEAD(&p->full);
+}
+
+static void _slab_free(hncp_pool p, hncp_slab sl)
+{
+  list_del(&sl->lh);
+  free(sl);
+  p->slabs--;
+  p->slab_frees++;
+}
+
+void hncp_pool_uninit(hncp_pool p)
+{
+  hncp_slab sl, sl2;
+
+  if (p->in_use)
+    L_ERR("%s pool: %u objects still in use", p->name, p->in_use);
+  list_for_each_entry_safe(sl, sl2, &p->partial, lh)
+    _slab_free(p, sl);
+  list_for_each_entry_safe(sl, sl2, &p->full, lh)
+    _slab_free(p, sl);
+  if (p->spare)
+    {
+      free(p->spare);
+      p->spare = NULL;
+      p->slabs--;
+      p->slab_frees++;
+    }
+}
+
+static hncp_slab _slab_new(hncp_pool p)
+{
+  hncp_slab sl;
+  char *c;
+  int i;
+
+  if ((sl = p->spare))
+    {
+      p->spare = NULL;
+      list_add(&sl->lh, &p->partial);
+      return sl;
+    }
+  if (posix_memalign((void **)&sl, HNCP_SLAB_SIZE, HNCP_SLAB_SIZE))
+    return NULL;
+  sl->pool = p;
+  sl->in_use = 0;
+  sl->free_list = NULL;
+  c = (char *)sl + SLAB_HEADER_SIZE + (p->per_slab - 1) * p->size;
+  for (i = 0 ; i < p->per_slab ; i++, c -= p->size)
+    {
+      *(void **)c = sl->free_list;
+      sl->free_list = c;
+    }
+  list_add(&sl->lh, &p->partial);
+  p->slabs++;
+  p->slab_allocs++;
+  return sl;
+}
+
+void *hncp_pool_alloc(hncp_pool p)
+{
+  hncp_slab sl;
+  void *ptr;
+
+  if (list_empty(&p->partial))
+    {
+      if (!(sl = _slab_new(p)))
+        {
+          L_ERR("%s pool: out of memory", p->name);
+          return NULL;
+        }
+    }
+  else
+    sl = list_first_entry(&p->partial, hncp_slab_s, lh);
+  ptr = sl->free_list;
+  sl->free_list = *(void **)ptr;
+  if (++sl->in_use == p->per_slab)
+    list_move(&sl->lh, &p->full);
+  if (++p->in_use > p->peak_in_use)
+    p->peak_in_use = p->in_use;
+  p->allocs++;
+  memset(ptr, 0, p->size);
+  return ptr;
+}
+
+void hncp_pool_free(hncp_pool p, void *ptr)
+{
+  hncp_slab sl;
+
+  if (!ptr)
+    return;
+  sl = SLAB_OF(ptr);
+  if (sl->pool != p)
+    {
+      L_ERR("%s pool: %p is not ours", p->name, ptr);
+      return;
+    }
+  if (sl->in_use-- == p->per_slab)
+    list_move(&sl->lh, &p->partial);
+  *(void **)ptr = sl->free_list;
+  sl->free_list = ptr;
+  p->in_use--;
+  p->frees++;
+  if (sl->in_use)
+    return;
+  /* Keep one empty slab around, so that an object going back and
+   * forth does not cost a slab each time. */
+  list_del(&sl->lh);
+  if (!p->spare)
+    {
+      p->spare = sl;
+      return;
+    }
+  free(sl);
+  p->slabs--;
+  p->slab_frees++;
+}
+
+/********************************************************* Size class arena */
+
+static const char *_arena_class_names[HNCP_ARENA_CLASSES] = {
+  "arena-32", "arena-64", "arena-128", "arena-256",
+  "arena-512", "arena-1024", "arena-2048", "arena-4096"
+};
+
+static int _arena_class(size_t len)
+{
+  int i;
+
+  for (i = 0 ; i < HNCP_ARENA_CLASSES ; i++)
+    if (len <= (size_t)HNCP_ARENA_MIN_SIZE << i)
+      return i;
+  return -1;
+}
+
+void *hncp_arena_alloc(hncp o, size_t len)
+{
+  int i = _arena_class(len);
+  void *ptr;
+
+  if (i >= 0)
+    return hncp_pool_alloc(&o->arena[i]);
+  /* Large ones come and go rarely; leave them to malloc. */
+  if (!(ptr = calloc(1, len)))
+    return NULL;
+  o->arena_large_in_use++;
+  o->arena_large_allocs++;
+  return ptr;
+}
+
+void hncp_arena_free(hncp o, void *ptr, size_t len)
+{
+  int i = _arena_class(len);
+
+  if (!ptr)
+    return;
+  if (i >= 0)
+    {
+      hncp_pool_free(&o->arena[i], ptr);
+      return;
+    }
+  free(ptr);
+  o->arena_large_in_use--;
+}
+
+struct tlv_attr *hncp_arena_adopt_tlv(hncp o, struct tlv_attr *a)
+{
+  size_t len = tlv_pad_len(a);
+  struct tlv_attr *na;
+
+  if (_arena_class(len) < 0)
+    {
+      /* Already where a large one would be. */
+      o->arena_large_in_use++;
+      o->arena_large_allocs++;
+      return a;
+    }
+  na = hncp_arena_alloc(o, len);
+  if (na)
+    memcpy(na, a, len);
+  free(a);
+  return na;
+}
+
+void hncp_arena_free_tlv(hncp o, struct tlv_attr *a)
+{
+  if (a)
+    hncp_arena_free(o, a, tlv_pad_len(a));
+}
+
+/************************************************************* Send buffers */
+
+struct tlv_buf *hncp_get_send_buf(hncp o, int size)
+{
+  struct tlv_buf *tb = NULL;
+  int i;
+
+  for (i = 0 ; i < HNCP_SEND_BUFS ; i++)
+    if (!(o->send_bufs_used & (1 << i)))
+      {
+        o->send_bufs_used |= 1 << i;
+        tb = &o->send_bufs[i];
+        if (tb->buf)
+          o->send_bufs_reused++;
+        break;
+      }
+  /* All in use (should not happen, as sends do not nest). */
+  if (!tb)
+    {
+      if (!(tb = calloc(1, sizeof(*tb))))
+        return NULL;
+      o->send_bufs_temporary++;
+    }
+  if (tlv_buf_init_size(tb, 0, size)) /* not passed anywhere */
+    {
+      hncp_put_send_buf(o, tb);
+      return NULL;
+    }
+  return tb;
+}
+
+void hncp_put_send_buf(hncp o, struct tlv_buf *tb)
+{
+  int i;
+
+  for (i = 0 ; i < HNCP_SEND_BUFS ; i++)
+    if (tb == &o->send_bufs[i])
+      {
+        /* Do not hang on to the odd huge one. */
+        if (tb->buflen > HNCP_SEND_BUF_KEEP_SIZE)
+          tlv_buf_free(tb);
+        o->send_bufs_used &= ~(1 << i);
+        return;
+      }
+  tlv_buf_free(tb);
+  free(tb);
+}
+
+/******************************************************************** Setup */
+
+void hncp_alloc_init(hncp o)
+{
+  int i;
+
+  hncp_pool_init(&o->node_pool, "node", sizeof(hncp_node_s));
+  hncp_pool_init(&o->neighbor_pool, "neighbor", sizeof(hncp_neighbor_s));
+  for (i = 0 ; i < HNCP_ARENA_CLASSES ; i++)
+    hncp_pool_init(&o->arena[i], _arena_class_names[i],
+                   HNCP_ARENA_MIN_SIZE << i);
+}
+
+void hncp_alloc_uninit(hncp o)
+{
+  int i;
+
+  hncp_pool_uninit(&o->node_pool);
+  hncp_pool_uninit(&o->neighbor_pool);
+  for (i = 0 ; i < HNCP_ARENA_CLASSES ; i++)
+    hncp_pool_uninit(&o->arena[i]);
+  for (i = 0 ; i < HNCP_SEND_BUFS ; i++)
+    tlv_buf_free(&o->send_bufs[i]);
+}
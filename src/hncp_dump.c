@@ -279,6 +279,33 @@ static int hd_links(hncp o, struct blob_buf *b)
 	return 0;
 }
 
+static int hd_pool(hncp_pool p, struct blob_buf *b)
+{
+	hd_a(!blobmsg_add_u32(b, "size", p->size), return -1);
+	hd_a(!blobmsg_add_u32(b, "slabs", p->slabs), return -1);
+	hd_a(!blobmsg_add_u32(b, "in-use", p->in_use), return -1);
+	hd_a(!blobmsg_add_u32(b, "peak-in-use", p->peak_in_use), return -1);
+	hd_a(!blobmsg_add_u32(b, "allocs", p->allocs), return -1);
+	hd_a(!blobmsg_add_u32(b, "frees", p->frees), return -1);
+	hd_a(!blobmsg_add_u32(b, "slab-allocs", p->slab_allocs), return -1);
+	hd_a(!blobmsg_add_u32(b, "slab-frees", p->slab_frees), return -1);
+	return 0;
+}
+
+static int hd_allocator(hncp o, struct blob_buf *b)
+{
+	int i;
+	hd_do_in_table(b, o->node_pool.name, hd_pool(&o->node_pool, b), return -1);
+	hd_do_in_table(b, o->neighbor_pool.name, hd_pool(&o->neighbor_pool, b), return -1);
+	for (i = 0; i < HNCP_ARENA_CLASSES; i++)
+		hd_do_in_table(b, o->arena[i].name, hd_pool(&o->arena[i], b), return -1);
+	hd_a(!blobmsg_add_u32(b, "large-in-use", o->arena_large_in_use), return -1);
+	hd_a(!blobmsg_add_u32(b, "large-allocs", o->arena_large_allocs), return -1);
+	hd_a(!blobmsg_add_u32(b, "send-buffers-reused", o->send_bufs_reused), return -1);
+	hd_a(!blobmsg_add_u32(b, "send-buffers-temporary", o->send_bufs_temporary), return -1);
+	return 0;
+}
+
 static int hd_info(hncp o, struct blob_buf *b)
 {
 	hd_a(!blobmsg_add_u64(b, "time", hd_now), return -1);
@@ -293,6 +320,7 @@ int hncp_dump(struct blob_buf *b, hncp o)
 	hd_a(!hd_info(o, b), return -1);
 	hd_do_in_table(b, "links", hd_links(o,b), return -1);
 	hd_do_in_table(b, "nodes", hd_nodes(o,b), return -1);
+	hd_do_in_table(b, "allocator", hd_allocator(o,b), return -1);
 	return 0;
 }
 
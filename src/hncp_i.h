@@ -19,8 +19,10 @@
 #include "dns_util.h"
 
 #include <assert.h>
+#include <sys/uio.h>
 
 #include <libubox/uloop.h>
+#include <libubox/md5.h>
 
 /* Rough approximation - should think of real figure. */
 #define HNCP_MAXIMUM_PAYLOAD_SIZE 65536
@@ -31,18 +33,129 @@
  * here) should work.  */
 #define HNCP_MAXIMUM_MULTICAST_SIZE (1280-40-8)
 
+/* Largest UDP payload (IPv6 payload length - UDP header); larger
+ * messages have to be sent over a stream, if at all. */
+#define HNCP_MAXIMUM_DATAGRAM_SIZE (65535-8)
+
+/* Stream messages are framed with 32-bit length; refuse anything
+ * larger than this. */
+#define HNCP_MAXIMUM_STREAM_MESSAGE_SIZE (16 * 1024 * 1024)
+
+/* Multicast keepalives are not sent more often than this on a link
+ * (even in reply to those of others). */
+#define HNCP_KEEPALIVE_MIN_INTERVAL HNETD_TIME_PER_SECOND
+
+/* Stream connections unused (or unable to write) for this long are
+ * closed. */
+#define HNCP_STREAM_IDLE_TIMEOUT (30 * HNETD_TIME_PER_SECOND)
+
+/* At most this many stream connections at a time. */
+#define HNCP_STREAM_MAX_STREAMS 32
+
+/* A stream whose peer leaves more than this unread is closed (a single
+ * message may still be larger, if nothing else is queued). */
+#define HNCP_STREAM_MAX_BACKLOG (4 * 1024 * 1024)
+
 /* Collision time window. */
 #define HNCP_UPDATE_COLLISION_N (60 * HNETD_TIME_PER_SECOND)
 
 /* How many collisions are needed in time window for renumbering. */
 #define HNCP_UPDATE_COLLISIONS_IN_N 3
 
+/* Initial size of the buffer of our own node data; it is doubled
+ * whenever it runs out. */
+#define HNCP_SELF_TLVS_INITIAL_SIZE 1024
+
+/* How many (reachable) nodes there are between network hash
+ * checkpoints. 4 node data hashes fit in one MD5 block. */
+#define HNCP_NETWORK_HASH_CHECKPOINT_INTERVAL 16
+
+/* How many node data hashes are calculated together (see md5_multi). */
+#define HNCP_HASH_BATCH 64
+
 
 #include <libubox/vlist.h>
 #include <libubox/list.h>
 
 typedef uint32_t iid_t;
 
+/* How long to wait for node data we requested, before asking another
+ * neighbor that advertised it (or giving up, and asking whoever
+ * advertises it next). */
+#define HNCP_REQUEST_TIMEOUT (HNETD_TIME_PER_SECOND / 4)
+
+/* How many times a request is moved to another neighbor. */
+#define HNCP_REQUEST_RETRIES 2
+
+/* If a timer could not be put in the heap, try again this soon. */
+#define HNCP_TIMER_RETRY_INTERVAL (HNETD_TIME_PER_SECOND / 10)
+
+/* Entry in the explicit stack of the prune graph traversal. */
+typedef struct hncp_prune_frame_struct {
+  hncp_node node;
+  /* Index of the next adjacency of node to look at. */
+  int i;
+} hncp_prune_frame_s, *hncp_prune_frame;
+
+typedef struct hncp_network_hash_checkpoint_struct {
+  /* The first node hashed _after_ the checkpoint was taken. */
+  hncp_hash_s node_identifier_hash;
+
+  /* MD5 state covering every reachable node before it. */
+  md5_ctx_t ctx;
+} hncp_network_hash_checkpoint_s, *hncp_network_hash_checkpoint;
+
+/* Deadline of a link or a neighbor. Kept in the timer heap of hncp,
+ * so that hncp_run only has to look at the ones that are due. */
+typedef struct hncp_timer_struct hncp_timer_s, *hncp_timer;
+
+struct hncp_timer_struct {
+  hnetd_time_t time;
+
+  /* Position in the heap + 1; 0 if not in it. */
+  int index;
+
+  /* Called (by hncp_run, out of the heap) once time is reached. */
+  void (*cb)(hncp_timer t, hnetd_time_t now);
+};
+
+/* Size (and alignment) of the slabs of the object pools. */
+#define HNCP_SLAB_SIZE 16384
+
+/* Arena size classes: HNCP_ARENA_MIN_SIZE << 0..HNCP_ARENA_CLASSES-1
+ * bytes; anything larger is malloc'd. */
+#define HNCP_ARENA_MIN_SIZE 32
+#define HNCP_ARENA_CLASSES 8
+
+/* Number of send buffers kept around, and the largest one kept (the
+ * memory of larger ones is released after use). */
+#define HNCP_SEND_BUFS 2
+#define HNCP_SEND_BUF_KEEP_SIZE 8192
+
+typedef struct hncp_slab_struct hncp_slab_s, *hncp_slab;
+
+/* Pool of fixed size objects, carved out of slabs (see hncp_alloc.c). */
+typedef struct hncp_pool_struct {
+  const char *name;
+  size_t size;
+  int per_slab;
+
+  /* Slabs with free objects, and those without. */
+  struct list_head partial;
+  struct list_head full;
+
+  /* Empty slab kept for reuse, if any. */
+  hncp_slab spare;
+
+  /* Statistics. */
+  unsigned int slabs;
+  unsigned int in_use;
+  unsigned int peak_in_use;
+  unsigned int allocs;
+  unsigned int frees;
+  unsigned int slab_allocs;
+  unsigned int slab_frees;
+} hncp_pool_s, *hncp_pool;
 
 struct hncp_struct {
   /* Disable pruning (should be used probably only in unit tests) */
@@ -54,12 +167,24 @@ struct hncp_struct {
   /* nodes (as contained within the protocol, that is, raw TLV data blobs). */
   struct vlist_tree nodes;
 
+  /* Open addressing (linear probing) hash table of the nodes, keyed
+   * by node identifier hash. It is kept in sync by update_node; the
+   * ordered vlist above is still used for iteration. */
+  hncp_node *node_index;
+  int node_index_size; /* power of 2 */
+  int num_node_index;
+
   /* local data (TLVs API's clients want published). */
   struct vlist_tree tlvs;
 
   /* local links (those API's clients want active). */
   struct vlist_tree links;
 
+  /* ifindex -> link, for links with small enough ifindex (see
+   * hncp_find_link_by_ifindex). */
+  struct hncp_link_struct **links_by_ifindex;
+  int links_by_ifindex_size;
+
   /* Link configuration options */
   struct list_head link_confs;
 
@@ -74,16 +199,140 @@ struct hncp_struct {
    * of what's in local tlvs currently. */
   bool republish_tlvs;
 
+  /* Local tlvs in order, as a TLV container (like the one published
+   * for our node) that is patched in place as they come and go.
+   * Rebuilt from tlvs only if it is stale (out of memory, or never
+   * built). */
+  struct tlv_attr *self_tlvs;
+  size_t self_tlvs_size;
+  bool self_tlvs_stale;
+
   /* flag which indicates that we (or someone connected) may have
    * changed connectivity. */
   bool graph_dirty;
   hnetd_time_t last_prune;
   hnetd_time_t next_prune;
 
+  /* Set if edges may have been lost within the reachable part of the
+   * graph; that requires a full flood fill from own node. Otherwise
+   * only new edges of the nodes in prune_seeds need to be followed. */
+  bool graph_dirty_full;
+  hncp_node *prune_seeds;
+  int num_prune_seeds;
+  int prune_seeds_size;
+
+  /* Stack for the depth-first traversals done by prune. Every node
+   * is on it at most once, so it never needs more entries than there
+   * are nodes. */
+  hncp_prune_frame prune_stack;
+  int prune_stack_size;
+
   /* flag which indicates that we should re-calculate network hash
    * based on nodes' state. */
   bool network_hash_dirty;
 
+  /* If set, only nodes at or after network_hash_dirty_from (in the
+   * order of nodes) have changed since network hash was last
+   * calculated. Otherwise, the whole hash has to be recalculated. */
+  bool network_hash_partial;
+  hncp_hash_s network_hash_dirty_from;
+
+  /* MD5 midstates of the network hash calculation, taken every
+   * HNCP_NETWORK_HASH_CHECKPOINT_INTERVAL reachable nodes. */
+  hncp_network_hash_checkpoint network_hash_checkpoints;
+  int num_network_hash_checkpoints;
+  int network_hash_checkpoints_size;
+
+  /* NETWORK_HASH TLV followed by NODE_STATE TLVs, as sent by
+   * hncp_link_send_network_state on every link. Rebuilt only when
+   * the network hash (or graph_dirty) changes; per-node fields that
+   * may change without it are patched in from network_state_nodes
+   * on send. */
+  struct tlv_buf network_state;
+  hncp_node *network_state_nodes;
+  int num_network_state_nodes;
+  int network_state_nodes_size;
+  bool network_state_valid;
+  bool network_state_graph_dirty;
+  unsigned int network_state_hits;
+  unsigned int network_state_misses;
+
+  /* Hash of the node data hashes of the reachable nodes in each
+   * bucket, valid while the network hash is bucket_hashes_for. */
+  hncp_hash_s bucket_hashes[HNCP_BUCKETS];
+  hncp_hash_s bucket_hashes_for;
+  bool bucket_hashes_valid;
+
+  /* Network state statistics. */
+  unsigned int network_state_requests;
+  unsigned int network_state_bucket_requests;
+  unsigned int network_state_replies;
+  unsigned int network_state_reply_bytes;
+
+  /* Nodes and neighbors come from their own pools, and TLVs and node
+   * data from the size classes of the arena. */
+  hncp_pool_s node_pool;
+  hncp_pool_s neighbor_pool;
+  hncp_pool_s arena[HNCP_ARENA_CLASSES];
+  unsigned int arena_large_in_use;
+  unsigned int arena_large_allocs;
+
+  /* tlv_bufs reused for outgoing messages (hncp_get_send_buf). */
+  struct tlv_buf send_bufs[HNCP_SEND_BUFS];
+  unsigned int send_bufs_used;
+  unsigned int send_bufs_reused;
+  unsigned int send_bufs_temporary;
+
+  /* Liveness check statistics. */
+  unsigned int pings_sent;
+  unsigned int keepalives_sent;
+
+  /* Node data requests in flight (hncp_pending_request), keyed by
+   * node identifier hash. */
+  struct avl_tree pending_requests;
+
+  /* Binary min-heap (by time) of link and neighbor timers. */
+  hncp_timer *timers;
+  int num_timers;
+  int timers_size;
+  unsigned int timers_run;
+  /* Some link or neighbor timer is not in the heap (out of memory). */
+  bool timers_retry;
+
+  /* Request / node data statistics. */
+  unsigned int node_data_requests;
+  unsigned int node_data_requests_suppressed;
+  unsigned int node_data_requests_retried;
+  unsigned int node_data_received;
+  unsigned int node_data_received_bytes;
+  unsigned int node_data_duplicates;
+  unsigned int node_data_duplicate_bytes;
+  unsigned int node_data_deltas;
+  unsigned int node_data_delta_failures;
+  unsigned int node_data_hash_mismatches;
+
+  /* Opt-in: pack node data requests (and replies to peers that pack
+   * theirs) into as few datagrams as fit HNCP_BULK_SYNC_SIZE. */
+  bool bulk_sync;
+
+  /* Opt-in: remember the previous node data of every node, and reply
+   * to requests that name it with just the difference. */
+  bool delta_sync;
+
+  /* Opt-in: accept stream connections, and send replies too large
+   * for a datagram over them to peers that do too. */
+  bool stream_sync;
+
+  /* Opt-in: when NODE_STATEs do not fit in a multicast, send bucket
+   * hashes along with the network hash, and ask peers for just the
+   * buckets that differ. */
+  bool bucket_sync;
+
+  /* Opt-in: check on neighbors we are worried about with one
+   * multicast keepalive per link (answered in kind), and ping only
+   * those that did not show up in one. */
+  bool multicast_keepalive;
+
   /* before io-init is done, we keep just prod should_schedule. */
   bool io_init_done;
   bool should_schedule;
@@ -105,6 +354,13 @@ struct hncp_struct {
   /* And it's corresponding uloop_fd */
   struct uloop_fd ufd;
 
+  /* Batched receive/send state (private to hncp_io). */
+  struct hncp_io_batch_struct *io_batch;
+
+  /* Stream (TCP) transport state (private to hncp_io); NULL if the
+   * stream transport is not enabled. */
+  struct hncp_io_streams_struct *io_streams;
+
   /* Timeout for doing 'something' in hncp_io. */
   struct uloop_timeout timeout;
 
@@ -117,23 +373,15 @@ struct hncp_struct {
   /* List of subscribers to change notifications. */
   struct list_head subscribers;
 
+  /* TLV changes not yet given to tlv_changes_callback subscribers. */
+  struct avl_tree tlv_changes;
+
   /* Collision tracking - when to rename. */
   int last_collision;
   hnetd_time_t collisions[HNCP_UPDATE_COLLISIONS_IN_N];
 
   /* search domain provided to clients. */
   char domain[DNS_MAX_ESCAPED_LEN];
-
-  /* An array that contains type -> index+1 (if available) or type ->
-   * 0 (if no index yet allocated). */
-  int *tlv_type_to_index;
-
-  /* Highest allocated TLV index. */
-  int tlv_type_to_index_length;
-
-  /* Number of TLV indexes we have. That is, the # of non-empty slots
-   * in the tlv_type_to_index. */
-  int num_tlv_indexes;
 };
 
 typedef struct hncp_link_struct hncp_link_s, *hncp_link;
@@ -153,6 +401,10 @@ struct hncp_link_struct {
   /* Name of the (local) link. */
   char ifname[IFNAMSIZ];
 
+  /* Its system interface index (0 if not known); refreshed when the
+   * link is (re)joined or (re)enabled. See hncp_link_set_ifindex. */
+  int ifindex;
+
   /* Interface identifier - these should be unique over lifetime of
    * hncp process. */
   iid_t iid;
@@ -160,6 +412,9 @@ struct hncp_link_struct {
   /* Join failed -> probably tried during DAD. Should try later again. */
   bool join_pending;
 
+  /* Next rejoin attempt, or Trickle event. */
+  hncp_timer_s timer;
+
   /* Trickle state */
   int trickle_i; /* trickle interval size */
   hnetd_time_t trickle_send_time; /* when do we send if c < k*/
@@ -167,6 +422,9 @@ struct hncp_link_struct {
   int trickle_c; /* counter */
   hnetd_time_t last_trickle_sent;
 
+  /* When did we last send a multicast keepalive. */
+  hnetd_time_t last_keepalive;
+
   /* Statistics about Trickle (mostly for debugging) */
   int num_trickle_sent;
   int num_trickle_skipped;
@@ -182,6 +440,9 @@ typedef struct hncp_neighbor_struct hncp_neighbor_s, *hncp_neighbor;
 struct hncp_neighbor_struct {
   struct vlist_node in_neighbors;
 
+  /* Backpointer to the link the neighbor is on */
+  hncp_link link;
+
   hncp_hash_s node_identifier_hash;
   iid_t iid;
 
@@ -203,6 +464,13 @@ struct hncp_neighbor_struct {
 
   /* When did we send the ping most recently. */
   hnetd_time_t last_ping;
+
+  /* Stream sync version the neighbor advertised, 0 if none. */
+  uint32_t stream_sync_version;
+
+  /* When to ping (or give up on) the neighbor. It may be earlier
+   * than that; see hncp_neighbor_schedule. */
+  hncp_timer_s timer;
 };
 
 
@@ -217,6 +485,121 @@ struct hncp_bfs_head {
   unsigned hopcount;
 };
 
+/* Bidirectional neighbor relationship between two nodes, as derived
+ * from both ends' NODE_DATA_NEIGHBOR TLVs. Link ids are in network
+ * byte order, just like in the TLVs. */
+typedef struct hncp_adjacency_struct {
+  hncp_node node;
+  uint32_t link_id;
+  uint32_t neighbor_link_id;
+} hncp_adjacency_s, *hncp_adjacency;
+
+/* The consecutive TLVs of one type in node data. Offsets are from
+ * the start of the container payload (which is less than 64k). */
+typedef struct hncp_tlv_range_struct {
+  uint16_t type;
+  uint16_t count;
+  uint16_t offset;
+  uint16_t end;
+} hncp_tlv_range_s, *hncp_tlv_range;
+
+/* Serialized NODE_STATE TLV and NODE_DATA TLV header of a node, as
+ * sent in reply to REQ_NODE_DATA. The node's TLV container follows
+ * it as-is on the wire. */
+typedef struct __packed {
+  struct tlv_attr node_state_header;
+  hncp_t_node_state_s node_state;
+  struct tlv_attr node_data_header;
+  hncp_t_node_data_header_s node_data;
+} hncp_node_data_reply_s, *hncp_node_data_reply;
+
+/* Bulk synchronization packs node data requests and replies up to
+ * this size; we do not know the real link MTU, so assume the IPv6
+ * minimum one. A single larger node data reply is sent on its own. */
+#define HNCP_BULK_SYNC_SIZE HNCP_MAXIMUM_MULTICAST_SIZE
+
+/* How many REQ_NODE_DATA TLVs fit in a bulk request (along with the
+ * LINK_ID and BULK_SYNC TLVs). */
+#define HNCP_BULK_SYNC_MAX_REQUESTS                                     \
+  ((HNCP_BULK_SYNC_SIZE                                                 \
+    - 2 * sizeof(struct tlv_attr)                                       \
+    - sizeof(hncp_t_link_id_s) - sizeof(hncp_t_bulk_sync_s))            \
+   / (sizeof(struct tlv_attr) + HNCP_HASH_LEN))
+
+/* How many (empty) node data replies fit in a bulk reply. */
+#define HNCP_BULK_SYNC_MAX_REPLIES                                      \
+  (HNCP_BULK_SYNC_SIZE / sizeof(hncp_node_data_reply_s))
+
+/* Node data request we are waiting for a reply to. Neighbors are
+ * identified by link id + address, as they may go away meanwhile. */
+typedef struct hncp_pending_request_struct {
+  struct avl_node avl;
+  hncp_hash_s node_identifier_hash;
+  uint32_t update_number;
+  hnetd_time_t timeout;
+  int retries;
+
+  /* Who we asked. */
+  iid_t iid;
+  struct in6_addr address;
+
+  /* Someone else who advertised the same (or newer) update. */
+  bool has_alternate;
+  iid_t alternate_iid;
+  struct in6_addr alternate_address;
+} hncp_pending_request_s, *hncp_pending_request;
+
+/* Upper bound on NODE_STATE TLVs that fit in one message. */
+#define HNCP_MESSAGE_MAX_NODE_STATES                                    \
+  (HNCP_MAXIMUM_PAYLOAD_SIZE                                            \
+   / (sizeof(struct tlv_attr) + sizeof(hncp_t_node_state_s)))
+
+/* Received message, as decoded (and validated) by a single pass over
+ * its TLVs. All pointers point within the received buffer. */
+typedef struct hncp_message_struct {
+  hncp_t_link_id link_id;
+  unsigned char *network_hash;
+
+  /* First REQ_NET_HASH or REQ_NODE_DATA TLV, if any. */
+  struct tlv_attr *request;
+
+  /* All REQ_NODE_DATA TLVs; more than one only in bulk requests. */
+  hncp_hash node_data_requests[HNCP_BULK_SYNC_MAX_REQUESTS];
+  int num_node_data_requests;
+
+  /* Bulk sync version of the sender, 0 if not supported. */
+  uint32_t bulk_sync_version;
+
+  /* Stream sync version of the sender, 0 if not supported. */
+  uint32_t stream_sync_version;
+
+  /* Bucket hashes (if of our version), and buckets requested along
+   * with REQ_NET_HASH (0 = all). */
+  hncp_t_bucket_hashes bucket_hashes;
+  uint64_t req_buckets;
+
+  /* KEEPALIVE TLV (if of our version), and the neighbors in it. */
+  hncp_t_keepalive_header keepalive;
+  hncp_t_keepalive_neighbor keepalive_neighbors;
+  int num_keepalive_neighbors;
+
+  /* NODE_DATA_BASE TLVs (node data the requester already has). */
+  hncp_t_node_data_base node_data_bases[HNCP_BULK_SYNC_MAX_REQUESTS];
+  int num_node_data_bases;
+
+  /* NODE_STATE TLVs; the array (of max_node_states) is provided by
+   * the caller, as stream messages may have more than fit in
+   * HNCP_MAXIMUM_PAYLOAD_SIZE. */
+  hncp_t_node_state *node_states;
+  int num_node_states;
+  int max_node_states;
+
+  /* NODE_DATA (or NODE_DATA_DELTA) TLVs; more than one only in bulk
+   * replies. */
+  struct tlv_attr *node_data[HNCP_BULK_SYNC_MAX_REPLIES];
+  int num_node_data;
+} hncp_message_s, *hncp_message;
+
 struct hncp_node_struct {
   /* hncp->nodes entry */
   struct vlist_node in_nodes;
@@ -251,18 +634,36 @@ struct hncp_node_struct {
    * it should be used by us. Either tlv_container, or NULL. */
   struct tlv_attr *tlv_container_valid;
 
-  /* An index of HNCP TLV indexes (that have been registered and
-   * precomputed for this node). Typically NULL, until first access
-   * during which we have to traverse all TLVs in any case and this
-   * gets populated. It contains 'first', 'next' pairs for each
-   * registered index. */
-  struct tlv_attr **tlv_index;
-
-  /* Flag which indicates whether contents of tlv_idnex are up to date
-   * with tlv_container. As a result of this, there's no need for
-   * re-alloc when tlv_container changes and we don't immediately want
-   * to recalculate tlv_index. */
-  bool tlv_index_dirty;
+  /* Where the TLVs of each type are in tlv_container_valid, ordered
+   * by type (for binary search). Rebuilt whenever the data is
+   * replaced; lives in the arena. */
+  hncp_tlv_range tlv_ranges;
+  int num_tlv_ranges;
+
+  /* Cached bidirectional neighbors of the node (in the order of the
+   * NEIGHBOR TLVs). Marked dirty whenever NEIGHBOR TLVs of the node
+   * or one of the nodes it refers to change, and recalculated on
+   * next access. */
+  hncp_adjacency adjacencies;
+  int num_adjacencies;
+  int adjacencies_size;
+  bool adjacencies_dirty;
+  /* Whether the node is in hncp->prune_seeds. */
+  bool prune_seed;
+
+  /* Cached reply to REQ_NODE_DATA (sans LINK_ID and container);
+   * only ms_since_origination is patched per send. Invalidated
+   * whenever the node data hash or update number changes. */
+  hncp_node_data_reply_s node_data_reply;
+  bool node_data_reply_valid;
+
+  /* With delta_sync, the node data this replaced (if its hash was
+   * known), for replying with NODE_DATA_DELTA. */
+  struct tlv_attr *prev_tlv_container;
+  hncp_hash_s prev_node_data_hash;
+
+  /* Applying a delta to this node failed; ask for full data next. */
+  bool node_data_delta_failed;
 };
 
 typedef struct hncp_tlv_struct hncp_tlv_s, *hncp_tlv;
@@ -285,17 +686,30 @@ bool hncp_set_own_hash(hncp o, hncp_hash h);
 
 hncp_link hncp_find_link_by_name(hncp o, const char *ifname, bool create);
 hncp_link hncp_find_link_by_id(hncp o, uint32_t link_id);
+hncp_link hncp_find_link_by_ifindex(hncp o, int ifindex);
+void hncp_link_set_ifindex(hncp_link l, int ifindex);
 hncp_node hncp_find_node_by_hash(hncp o, const hncp_hash h, bool create);
 
 /* Private utility - shouldn't be used by clients. */
 void hncp_link_reset_trickle(hncp_link l);
+
+/* Timer heap (hncp_timeout.c). The link timer follows its state
+ * exactly; neighbor timers are only moved earlier when needed (and
+ * pushed later once they fire), so hncp_neighbor_schedule should be
+ * called when the ping deadline may have moved earlier. */
+void hncp_link_schedule(hncp_link l);
+void hncp_neighbor_schedule(hncp_neighbor n);
+void hncp_timer_cancel(hncp o, hncp_timer t);
 int hncp_node_cmp(hncp_node n1, hncp_node n2);
 void hncp_node_set(hncp_node n,
                    uint32_t update_number, hnetd_time_t t,
                    struct tlv_attr *a);
-void hncp_node_recalculate_index(hncp_node n);
-
-bool hncp_add_tlv_index(hncp o, uint16_t type);
+/* As hncp_node_set, but with the (already verified) node data hash
+ * of update_number + a, which spares comparing and rehashing a. */
+void hncp_node_set_hashed(hncp_node n,
+                          uint32_t update_number, hnetd_time_t t,
+                          struct tlv_attr *a, hncp_hash h);
+void hncp_node_recalculate_adjacencies(hncp_node n);
 
 bool hncp_get_ipv6_address(hncp o, char *prefer_ifname, struct in6_addr *addr);
 
@@ -307,29 +721,85 @@ void hncp_self_flush(hncp_node n);
 /* Various hash calculation utilities. */
 void hncp_calculate_hash(const void *buf, int len, hncp_hash dest);
 void hncp_calculate_network_hash(hncp o);
+void hncp_calculate_bucket_hashes(hncp o);
+void hncp_calculate_node_data_hash(hncp_node n);
+void hncp_calculate_node_data_hash_of(hncp_hash node_identifier_hash,
+                                      uint32_t update_number,
+                                      struct tlv_attr *container,
+                                      hncp_hash dest);
+void hncp_invalidate_network_hash(hncp o, hncp_node n);
 static inline unsigned long long hncp_hash64(hncp_hash h)
 {
   return *((unsigned long long *)h);
 }
 
+/* Bucket of the hash (for bucket sync). */
+static inline int hncp_hash_bucket(hncp_hash h)
+{
+  return h->buf[0] >> (8 - HNCP_BUCKET_BITS);
+}
+
 /* Utility functions to send frames. */
 void hncp_link_send_network_state(hncp_link l,
                                   struct in6_addr *dst,
                                   size_t maximum_size);
 void hncp_link_send_req_network_state(hncp_link l, struct in6_addr *dst);
+void hncp_link_send_keepalive(hncp_link l);
+void hncp_link_send_req_node_data(hncp_link l, struct in6_addr *dst,
+                                  hncp_hash *h, int n);
+void hncp_link_send_node_data(hncp_link l, struct in6_addr *dst, hncp_node n);
+
+/* Handle a message received over a stream. */
+void hncp_handle_stream_message(hncp_link l, struct in6_addr *src,
+                                void *data, size_t len);
 void hncp_link_set_ipv6_address(hncp_link l, const struct in6_addr *addr);
 
+/* Time out (and retry) node data requests; returns when to call it
+ * next, or 0 if nothing is pending. */
+hnetd_time_t hncp_run_pending_requests(hncp o);
+void hncp_flush_pending_requests(hncp o);
+
+/* Decode a received message; false if it should be ignored. */
+bool hncp_message_decode(hncp_message m, void *data, ssize_t len);
+
 /* Subscription stuff (hncp_notify.c) */
+
+/* Call cb for each TLV only in a_new (add) or only in a_old (!add);
+ * both are sorted TLV containers, and either may be NULL. */
+typedef void (*hncp_tlv_diff_cb)(struct tlv_attr *a, bool add, void *context);
+void hncp_tlv_diff(struct tlv_attr *a_old, struct tlv_attr *a_new,
+                   bool add, hncp_tlv_diff_cb cb, void *context);
 void hncp_notify_subscribers_tlvs_changed(hncp_node n,
                                           struct tlv_attr *a_old,
                                           struct tlv_attr *a_new);
 void hncp_notify_subscribers_node_changed(hncp_node n, bool add);
+void hncp_notify_subscribers_tlv_changes(hncp o, hncp_node n);
+int hncp_tlv_change_cmp(const void *k1, const void *k2, void *ptr);
 void hncp_notify_subscribers_about_to_republish_tlvs(hncp_node n);
 void hncp_notify_subscribers_local_tlv_changed(hncp o,
                                                struct tlv_attr *a,
                                                bool add);
 void hncp_notify_subscribers_link_changed(hncp_link l);
 
+/* Object pools and arena (hncp_alloc.c). Pool objects come zeroed;
+ * arena ones are freed with the size they were allocated with. */
+void hncp_alloc_init(hncp o);
+void hncp_alloc_uninit(hncp o);
+void hncp_pool_init(hncp_pool p, const char *name, size_t size);
+void hncp_pool_uninit(hncp_pool p);
+void *hncp_pool_alloc(hncp_pool p);
+void hncp_pool_free(hncp_pool p, void *ptr);
+void *hncp_arena_alloc(hncp o, size_t len);
+void hncp_arena_free(hncp o, void *ptr, size_t len);
+/* Move a malloc'd TLV (such as tlv_buf head) to the arena; the
+ * original is freed, and NULL returned if out of memory. */
+struct tlv_attr *hncp_arena_adopt_tlv(hncp o, struct tlv_attr *a);
+void hncp_arena_free_tlv(hncp o, struct tlv_attr *a);
+/* Initialized tlv_buf (with room for size bytes) for building a
+ * message in; give it back with hncp_put_send_buf once sent. */
+struct tlv_buf *hncp_get_send_buf(hncp o, int size);
+void hncp_put_send_buf(hncp o, struct tlv_buf *tb);
+
 /* Low-level interface module stuff. */
 
 bool hncp_io_init(hncp o);
@@ -339,13 +809,28 @@ int hncp_io_get_hwaddrs(unsigned char *buf, int buf_left);
 void hncp_io_schedule(hncp o, int msecs);
 hnetd_time_t hncp_io_time(hncp o);
 
+int hncp_io_get_ifindex(hncp o, const char *ifname);
+
+/* Received datagrams from interfaces without a link are skipped. */
 ssize_t hncp_io_recvfrom(hncp o, void *buf, size_t len,
-                         char *ifname,
+                         hncp_link *l,
                          struct in6_addr *src,
                          struct in6_addr *dst);
-ssize_t hncp_io_sendto(hncp o, void *buf, size_t len,
-                       const char *ifname,
+ssize_t hncp_io_sendto(hncp_link l, void *buf, size_t len,
                        const struct in6_addr *dst);
+ssize_t hncp_io_sendmsg(hncp_link l, const struct iovec *iov, int iovcnt,
+                        const struct in6_addr *dst);
+/* Sends between these two are queued, and sent with as few syscalls
+ * as possible at the (outermost) end. */
+void hncp_io_batch_begin(hncp o);
+void hncp_io_batch_end(hncp o);
+
+/* Stream transport; messages are delivered with
+ * hncp_handle_stream_message. Sending returns -1 if it is not
+ * enabled (or the connection cannot be made). */
+bool hncp_io_stream_set_enabled(hncp o, bool enabled);
+ssize_t hncp_io_stream_sendmsg(hncp_link l, const struct iovec *iov,
+                               int iovcnt, const struct in6_addr *dst);
 
 /* Multicast rejoin utility. (in hncp.c) */
 bool hncp_link_join(hncp_link l);
@@ -383,23 +868,35 @@ static inline hnetd_time_t hncp_time(hncp o)
 #define HNCP_LINK_D(l) l->ifname,l->iid
 
 
-static inline struct tlv_attr *
-hncp_node_get_tlv_with_type(hncp_node n, uint16_t type, bool first)
+static inline hncp_tlv_range
+hncp_node_find_tlv_range(hncp_node n, uint16_t type)
 {
-  if (type >= n->hncp->tlv_type_to_index_length
-      || !n->hncp->tlv_type_to_index[type])
-    if (!hncp_add_tlv_index(n->hncp, type))
-      return NULL;
-  if (n->tlv_index_dirty)
+  int lo = 0, hi = n->num_tlv_ranges - 1;
+
+  while (lo <= hi)
     {
-      hncp_node_recalculate_index(n);
-      if (!n->tlv_index)
-        return NULL;
+      int mid = (lo + hi) / 2;
+      hncp_tlv_range r = &n->tlv_ranges[mid];
+
+      if (r->type == type)
+        return r;
+      if (r->type < type)
+        lo = mid + 1;
+      else
+        hi = mid - 1;
     }
-  int index = n->hncp->tlv_type_to_index[type] - 1;
-  assert(index >= 0 && index < n->hncp->num_tlv_indexes);
-  int i = index * 2 + (first ? 0 : 1);
-  return n->tlv_index[i];
+  return NULL;
+}
+
+/* First TLV of the type (or, if !first, the one after the last). */
+static inline struct tlv_attr *
+hncp_node_get_tlv_with_type(hncp_node n, uint16_t type, bool first)
+{
+  hncp_tlv_range r = hncp_node_find_tlv_range(n, type);
+
+  if (!r)
+    return NULL;
+  return tlv_data(n->tlv_container_valid) + (first ? r->offset : r->end);
 }
 
 #define hncp_for_each_node_including_unreachable(o, n)                  \
@@ -488,4 +985,17 @@ hncp_node_find_neigh_bidir(hncp_node n, hncp_t_node_data_neighbor ne)
   return NULL;
 }
 
+static inline hncp_adjacency
+hncp_node_get_adjacencies(hncp_node n)
+{
+  if (n->adjacencies_dirty)
+    hncp_node_recalculate_adjacencies(n);
+  return n->adjacencies;
+}
+
+#define hncp_node_for_each_adjacency(n, adj)                            \
+  for (adj = hncp_node_get_adjacencies(n) ;                             \
+       adj < (n)->adjacencies + (n)->num_adjacencies ;                  \
+       adj++)
+
 #endif /* HNCP_I_H */
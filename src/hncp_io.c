@@ -35,8 +35,136 @@
 #ifdef __linux__
 #define AF_LINK AF_PACKET
 #include <linux/if_packet.h>
+#else
+/* Without recvmmsg/sendmmsg, fall back to one syscall per message. */
+struct mmsghdr {
+  struct msghdr msg_hdr;
+  unsigned int msg_len;
+};
+
+static int recvmmsg(int fd, struct mmsghdr *msgs, unsigned int vlen,
+                    int flags, struct timespec *timeout __unused)
+{
+  unsigned int i;
+  ssize_t r;
+
+  for (i = 0 ; i < vlen ; i++)
+    {
+      if ((r = recvmsg(fd, &msgs[i].msg_hdr, flags)) < 0)
+        return i ? (int)i : -1;
+      msgs[i].msg_len = r;
+    }
+  return i;
+}
+
+static int sendmmsg(int fd, struct mmsghdr *msgs, unsigned int vlen,
+                    int flags)
+{
+  unsigned int i;
+  ssize_t r;
+
+  for (i = 0 ; i < vlen ; i++)
+    {
+      if ((r = sendmsg(fd, &msgs[i].msg_hdr, flags)) < 0)
+        return i ? (int)i : -1;
+      msgs[i].msg_len = r;
+    }
+  return i;
+}
 #endif /* __linux__ */
 
+/* At most this many datagrams are received or sent per syscall. */
+#define HNCP_IO_BATCH 8
+
+#define HNCP_IO_CMSG_SIZE 256
+
+/* Most datagrams fit in an Ethernet MTU; only the first datagram of a
+ * batch has room for a maximum size one. */
+#define HNCP_IO_SLOT_SIZE 2048
+
+/* Once a datagram did not fit its slot, this many following receives
+ * are done one datagram at a time. */
+#define HNCP_IO_SINGLE_RECVS 64
+
+/* Queued sends are copied here; larger ones are sent directly. */
+#define HNCP_IO_SEND_BUF_SIZE (HNCP_IO_BATCH * HNCP_IO_SLOT_SIZE)
+
+/* Stream buffers start at this size, and grow as data is queued or
+ * actually received. */
+#define HNCP_IO_STREAM_CHUNK 16384
+
+struct hncp_io_batch_struct {
+  /* Received datagrams; [next_recv, num_recv[ have not been returned
+   * by hncp_io_recvfrom yet. recv_buf is allocated on first use. */
+  struct mmsghdr recv_msgs[HNCP_IO_BATCH];
+  struct iovec recv_iov[HNCP_IO_BATCH];
+  struct sockaddr_in6 recv_src[HNCP_IO_BATCH];
+  unsigned char recv_cmsg[HNCP_IO_BATCH][HNCP_IO_CMSG_SIZE];
+  unsigned char *recv_buf;
+  int recv_batch; /* datagrams asked for per syscall */
+  int recv_single; /* receives left to do one datagram at a time */
+  int num_recv;
+  int next_recv;
+
+  /* Sends queued between hncp_io_batch_begin and _end; the payloads
+   * are copied to send_buf, as the callers' buffers do not live that
+   * long. */
+  int send_depth;
+  struct mmsghdr send_msgs[HNCP_IO_BATCH];
+  struct iovec send_iov[HNCP_IO_BATCH];
+  struct sockaddr_in6 send_dst[HNCP_IO_BATCH];
+  unsigned char send_buf[HNCP_IO_SEND_BUF_SIZE];
+  size_t send_buf_used;
+  int num_send;
+
+  /* Statistics */
+  unsigned int recv_syscalls;
+  unsigned int recv_packets;
+  unsigned int recv_truncated;
+  unsigned int send_syscalls;
+  unsigned int send_packets;
+};
+
+/* Stream (TCP) connection to a peer. Each message is preceded by its
+ * length (32 bits, network byte order). */
+typedef struct hncp_io_stream_struct {
+  struct list_head lh;
+  struct uloop_fd ufd;
+  hncp hncp;
+  struct sockaddr_in6 peer;
+  int ifindex;
+  bool connecting;
+  /* Closed from _stream_cb or the idle timer, as the stream may be in
+   * use further up the stack (e.g. replying from _stream_read). */
+  bool closing;
+  hnetd_time_t last_active;
+
+  /* Framed messages; [send_done, send_len[ has not been written yet. */
+  unsigned char *send_buf;
+  size_t send_len;
+  size_t send_done;
+  size_t send_size;
+
+  /* Received bytes not handled yet (at most one partial message). */
+  unsigned char *recv_buf;
+  size_t recv_len;
+  size_t recv_size;
+} hncp_io_stream_s, *hncp_io_stream;
+
+struct hncp_io_streams_struct {
+  hncp hncp;
+  struct uloop_fd listen_ufd;
+  struct list_head streams;
+  int num_streams;
+  struct uloop_timeout idle_timeout;
+
+  /* Statistics */
+  unsigned int connections;
+  unsigned int refused;
+  unsigned int messages_sent;
+  unsigned int messages_received;
+};
+
 
 int
 hncp_io_get_hwaddrs(unsigned char *buf, int buf_left)
@@ -134,6 +262,12 @@ bool hncp_io_init(hncp o)
       L_ERR("unable to setsockopt IPV6_MULTICAST_LOOP:%s", strerror(errno));
       return false;
     }
+  if (!(o->io_batch = calloc(1, sizeof(*o->io_batch))))
+    {
+      L_ERR("unable to allocate I/O batch state");
+      return false;
+    }
+  o->io_batch->recv_batch = HNCP_IO_BATCH;
   o->udp_socket = s;
   o->timeout.cb = _timeout;
 
@@ -146,11 +280,18 @@ bool hncp_io_init(hncp o)
 
 void hncp_io_uninit(hncp o)
 {
+  hncp_io_stream_set_enabled(o, false);
   close(o->udp_socket);
   /* clear the timer from uloop. */
   uloop_timeout_cancel(&o->timeout);
   /* and the fd also. */
   (void)uloop_fd_delete(&o->ufd);
+  if (o->io_batch)
+    {
+      free(o->io_batch->recv_buf);
+      free(o->io_batch);
+      o->io_batch = NULL;
+    }
 }
 
 bool hncp_io_set_ifname_enabled(hncp o,
@@ -188,89 +329,710 @@ void hncp_io_schedule(hncp o, int msecs)
   uloop_timeout_set(&o->timeout, msecs);
 }
 
+static bool _recv_more(hncp o)
+{
+  struct hncp_io_batch_struct *b = o->io_batch;
+  int i, r, n = b->recv_batch;
+
+  if (!b->recv_buf
+      && !(b->recv_buf = malloc(HNCP_MAXIMUM_PAYLOAD_SIZE
+                                + (HNCP_IO_BATCH - 1) * HNCP_IO_SLOT_SIZE)))
+    {
+      L_ERR("unable to receive - malloc failed");
+      return false;
+    }
+  if (b->recv_single)
+    {
+      b->recv_single--;
+      n = 1;
+    }
+  for (i = 0 ; i < n ; i++)
+    {
+      struct msghdr *msg = &b->recv_msgs[i].msg_hdr;
+
+      if (i)
+        {
+          b->recv_iov[i].iov_base = b->recv_buf + HNCP_MAXIMUM_PAYLOAD_SIZE
+            + (i - 1) * HNCP_IO_SLOT_SIZE;
+          b->recv_iov[i].iov_len = HNCP_IO_SLOT_SIZE;
+        }
+      else
+        {
+          b->recv_iov[i].iov_base = b->recv_buf;
+          b->recv_iov[i].iov_len = HNCP_MAXIMUM_PAYLOAD_SIZE;
+        }
+      memset(msg, 0, sizeof(*msg));
+      msg->msg_name = &b->recv_src[i];
+      msg->msg_namelen = sizeof(b->recv_src[i]);
+      msg->msg_iov = &b->recv_iov[i];
+      msg->msg_iovlen = 1;
+      msg->msg_control = b->recv_cmsg[i];
+      msg->msg_controllen = HNCP_IO_CMSG_SIZE;
+    }
+  b->next_recv = 0;
+  b->num_recv = 0;
+  b->recv_syscalls++;
+  r = recvmmsg(o->udp_socket, b->recv_msgs, n, MSG_DONTWAIT, NULL);
+  if (r < 0)
+    {
+      if (errno != EWOULDBLOCK)
+        L_DEBUG("unable to receive - recvmmsg:%s", strerror(errno));
+      return false;
+    }
+  b->num_recv = r;
+  b->recv_packets += r;
+  return r > 0;
+}
+
+int hncp_io_get_ifindex(hncp o __unused, const char *ifname)
+{
+  return if_nametoindex(ifname);
+}
+
+static hncp_link _find_link(hncp o, int ifindex)
+{
+  char ifname[IFNAMSIZ];
+  hncp_link l = hncp_find_link_by_ifindex(o, ifindex);
+
+  if (l || !ifindex)
+    return l;
+  /* Interface may have been re-created without us hearing about it
+   * yet; this is the only place where we look at interface names. */
+  if (!if_indextoname(ifindex, ifname))
+    return NULL;
+  if ((l = hncp_find_link_by_name(o, ifname, false)))
+    hncp_link_set_ifindex(l, ifindex);
+  return l;
+}
+
 ssize_t hncp_io_recvfrom(hncp o, void *buf, size_t len,
-                         char *ifname,
+                         hncp_link *l,
                          struct in6_addr *src,
                          struct in6_addr *dst)
 {
-  struct sockaddr_in6 srcsa;
-  struct iovec iov = {buf, len};
-  unsigned char cmsg_buf[256];
-  struct msghdr msg = {&srcsa, sizeof(srcsa), &iov, 1,
-                       cmsg_buf, sizeof(cmsg_buf), 0};
-  ssize_t l;
+  struct hncp_io_batch_struct *b = o->io_batch;
+  struct msghdr *msg;
+  ssize_t r;
   struct cmsghdr *h;
   struct in6_pktinfo *ipi6;
+  int ifindex;
 
-  l = recvmsg(o->udp_socket, &msg, MSG_DONTWAIT);
-  if (l > 0)
+  *l = NULL;
+  while (b && (b->next_recv < b->num_recv || _recv_more(o)))
     {
-      *ifname = 0;
-      *src = srcsa.sin6_addr;
-      for (h = CMSG_FIRSTHDR(&msg); h ;
-           h = CMSG_NXTHDR(&msg, h))
+      msg = &b->recv_msgs[b->next_recv].msg_hdr;
+      r = b->recv_msgs[b->next_recv].msg_len;
+      b->next_recv++;
+      /* Returning 0 would end the caller's loop, with the rest of the
+       * batch still queued. */
+      if (!r)
+        continue;
+      /* Lost; the ones that follow are likely to be large too. */
+      if (msg->msg_flags & MSG_TRUNC)
+        {
+          L_DEBUG("hncp_io_recvfrom: dropping truncated datagram");
+          b->recv_truncated++;
+          b->recv_single = HNCP_IO_SINGLE_RECVS;
+          continue;
+        }
+      ifindex = 0;
+      for (h = CMSG_FIRSTHDR(msg); h ;
+           h = CMSG_NXTHDR(msg, h))
         if (h->cmsg_level == IPPROTO_IPV6
             && h->cmsg_type == IPV6_PKTINFO)
           {
             ipi6 = (struct in6_pktinfo *)CMSG_DATA(h);
-            if (!if_indextoname(ipi6->ipi6_ifindex, ifname))
-              {
-                *ifname = 0;
-                L_ERR("unable to receive - if_indextoname:%s",
-                      strerror(errno));
-              }
+            ifindex = ipi6->ipi6_ifindex;
             *dst = ipi6->ipi6_addr;
           }
-      if (!*ifname)
+      if (!(*l = _find_link(o, ifindex)))
         {
-          L_ERR("unable to receive - no ifname");
-          return -1;
+          L_DEBUG("hncp_io_recvfrom: ignoring %d bytes from ifindex %d",
+                  (int)r, ifindex);
+          continue;
         }
+      if ((size_t)r > len)
+        r = len;
+      memcpy(buf, msg->msg_iov->iov_base, r);
+      *src = ((struct sockaddr_in6 *)msg->msg_name)->sin6_addr;
+      return r;
     }
-  else
+  return -1;
+}
+
+static void _send_error(const struct sockaddr_in6 *dst, const char *fun)
+{
+#if L_LEVEL >= 3
+  char buf[128], ifname[IFNAMSIZ];
+  const char *c = inet_ntop(AF_INET6, &dst->sin6_addr, buf, sizeof(buf));
+  const char *i = if_indextoname(dst->sin6_scope_id, ifname);
+
+  L_ERR("unable to send to %s%%%s - %s:%s",
+        c ? c : "?", i ? i : "?", fun, strerror(errno));
+#endif /* L_LEVEL >= 3 */
+}
+
+static void _send_flush(hncp o)
+{
+  struct hncp_io_batch_struct *b = o->io_batch;
+  int i = 0, r;
+
+  while (i < b->num_send)
     {
-      *ifname = 0;
-      if (l < 0 && errno != EWOULDBLOCK)
+      b->send_syscalls++;
+      r = sendmmsg(o->udp_socket, &b->send_msgs[i], b->num_send - i, 0);
+      if (r <= 0)
         {
-          L_DEBUG("unable to receive - recvmsg:%s", strerror(errno));
+          /* Skip the one that failed; rest may still work. */
+          _send_error(&b->send_dst[i], "sendmmsg");
+          i++;
+          continue;
         }
+      b->send_packets += r;
+      i += r;
     }
-  return l;
+  b->num_send = 0;
+  b->send_buf_used = 0;
 }
 
-ssize_t hncp_io_sendto(hncp o, void *buf, size_t len,
-                       const char *ifname,
-                       const struct in6_addr *to)
+void hncp_io_batch_begin(hncp o)
+{
+  if (o->io_batch)
+    o->io_batch->send_depth++;
+}
+
+void hncp_io_batch_end(hncp o)
+{
+  struct hncp_io_batch_struct *b = o->io_batch;
+
+  if (!b || --b->send_depth)
+    return;
+  _send_flush(o);
+}
+
+/* Returns -1 if the message does not fit the queue at all; the queue
+ * is then flushed, so that it can be sent directly (and in order). */
+static ssize_t _send_queue(hncp o, const struct iovec *iov, int iovcnt,
+                           const struct sockaddr_in6 *dst)
+{
+  struct hncp_io_batch_struct *b = o->io_batch;
+  struct msghdr *msg;
+  size_t len = 0;
+  int i;
+
+  for (i = 0 ; i < iovcnt ; i++)
+    len += iov[i].iov_len;
+  if (len > sizeof(b->send_buf))
+    {
+      _send_flush(o);
+      return -1;
+    }
+  if (b->num_send == HNCP_IO_BATCH
+      || b->send_buf_used + len > sizeof(b->send_buf))
+    _send_flush(o);
+  b->send_iov[b->num_send].iov_base = b->send_buf + b->send_buf_used;
+  b->send_iov[b->num_send].iov_len = len;
+  for (i = 0 ; i < iovcnt ; i++)
+    {
+      memcpy(b->send_buf + b->send_buf_used, iov[i].iov_base, iov[i].iov_len);
+      b->send_buf_used += iov[i].iov_len;
+    }
+  b->send_dst[b->num_send] = *dst;
+  msg = &b->send_msgs[b->num_send].msg_hdr;
+  memset(msg, 0, sizeof(*msg));
+  msg->msg_name = &b->send_dst[b->num_send];
+  msg->msg_namelen = sizeof(b->send_dst[b->num_send]);
+  msg->msg_iov = &b->send_iov[b->num_send];
+  msg->msg_iovlen = 1;
+  b->num_send++;
+  return len;
+}
+
+ssize_t hncp_io_sendmsg(hncp_link l, const struct iovec *iov, int iovcnt,
+                        const struct in6_addr *to)
 {
   int flags = 0;
+  hncp o = l->hncp;
+  struct hncp_io_batch_struct *b = o->io_batch;
   struct sockaddr_in6 dst;
+  struct msghdr msg = {&dst, sizeof(dst), (struct iovec *)iov, iovcnt,
+                       NULL, 0, 0};
   ssize_t r;
 
+  if (!l->ifindex)
+    hncp_link_set_ifindex(l, if_nametoindex(l->ifname));
   memset(&dst, 0, sizeof(dst));
-  if (!(dst.sin6_scope_id = if_nametoindex(ifname)))
+  if (!(dst.sin6_scope_id = l->ifindex))
     {
       L_ERR("unable to send on %s - if_nametoindex: %s",
-            ifname, strerror(errno));
+            l->ifname, strerror(errno));
       return -1;
     }
   dst.sin6_family = AF_INET6;
   dst.sin6_port = htons(HNCP_PORT);
   dst.sin6_addr = *to;
-  r = sendto(o->udp_socket, buf, len, flags,
-             (struct sockaddr *)&dst, sizeof(dst));
-#if L_LEVEL >= 3
-  if (r < 0)
+  if (b && b->send_depth && (r = _send_queue(o, iov, iovcnt, &dst)) >= 0)
+    return r;
+  r = sendmsg(o->udp_socket, &msg, flags);
+  if (b)
     {
-      char buf[128];
-      const char *c = inet_ntop(AF_INET6, to, buf, sizeof(buf));
-      L_ERR("unable to send to %s%%%s - sendto:%s",
-            c ? c : "?", ifname, strerror(errno));
+      b->send_syscalls++;
+      b->send_packets += r >= 0;
     }
-#endif /* L_LEVEL >= 3 */
+  if (r < 0)
+    _send_error(&dst, "sendmsg");
   return r;
 }
 
+ssize_t hncp_io_sendto(hncp_link l, void *buf, size_t len,
+                       const struct in6_addr *to)
+{
+  struct iovec iov = {buf, len};
+
+  return hncp_io_sendmsg(l, &iov, 1, to);
+}
+
 hnetd_time_t hncp_io_time(hncp o __unused)
 {
   return hnetd_time();
 }
+
+/*************************************************************** Streams */
+
+static void _stream_free(hncp_io_stream s)
+{
+  L_DEBUG("closing stream to %s", ADDR_REPR(&s->peer.sin6_addr));
+  uloop_fd_delete(&s->ufd);
+  close(s->ufd.fd);
+  list_del(&s->lh);
+  s->hncp->io_streams->num_streams--;
+  free(s->send_buf);
+  free(s->recv_buf);
+  free(s);
+}
+
+static bool _stream_reserve(unsigned char **buf, size_t *size, size_t len)
+{
+  size_t n = *size ? *size : HNCP_IO_STREAM_CHUNK;
+  unsigned char *b;
+
+  if (len <= *size)
+    return true;
+  while (n < len)
+    n *= 2;
+  if (!(b = realloc(*buf, n)))
+    return false;
+  *buf = b;
+  *size = n;
+  return true;
+}
+
+/* Write what we can; false if the connection is broken. */
+static bool _stream_write(hncp_io_stream s)
+{
+  ssize_t r;
+
+  while (s->send_done < s->send_len)
+    {
+      r = send(s->ufd.fd, s->send_buf + s->send_done,
+               s->send_len - s->send_done, MSG_NOSIGNAL);
+      if (r < 0)
+        {
+          if (errno == EWOULDBLOCK || errno == EINTR)
+            break;
+          L_DEBUG("unable to write stream - send:%s", strerror(errno));
+          return false;
+        }
+      s->send_done += r;
+      s->last_active = hncp_io_time(s->hncp);
+    }
+  if (s->send_done == s->send_len)
+    {
+      s->send_done = s->send_len = 0;
+      if (s->send_size > HNCP_IO_STREAM_CHUNK)
+        {
+          free(s->send_buf);
+          s->send_buf = NULL;
+          s->send_size = 0;
+        }
+      uloop_fd_add(&s->ufd, ULOOP_READ);
+    }
+  else
+    uloop_fd_add(&s->ufd, ULOOP_READ | ULOOP_WRITE);
+  return true;
+}
+
+static hncp_link _stream_link(hncp_io_stream s)
+{
+  return _find_link(s->hncp, s->ifindex);
+}
+
+/* Read what we can, and handle the complete messages; false if the
+ * connection is closed or broken. */
+static bool _stream_read(hncp_io_stream s)
+{
+  hncp o = s->hncp;
+  struct hncp_io_streams_struct *st = o->io_streams;
+  size_t want, done;
+  uint32_t len;
+  hncp_link l;
+  ssize_t r;
+
+  while (1)
+    {
+      /* The length in the header is not trusted for allocation; the
+       * buffer grows only once what has arrived fills it. */
+      want = s->recv_len + 1;
+      if (s->recv_len >= sizeof(len))
+        {
+          memcpy(&len, s->recv_buf, sizeof(len));
+          len = be32_to_cpu(len);
+          if (len > HNCP_MAXIMUM_STREAM_MESSAGE_SIZE)
+            {
+              L_INFO("too large stream message (%u bytes) from %s",
+                     (unsigned int)len, ADDR_REPR(&s->peer.sin6_addr));
+              return false;
+            }
+        }
+      if (!_stream_reserve(&s->recv_buf, &s->recv_size, want))
+        {
+          L_ERR("unable to receive stream - malloc failed");
+          return false;
+        }
+      r = recv(s->ufd.fd, s->recv_buf + s->recv_len,
+               s->recv_size - s->recv_len, 0);
+      if (r == 0)
+        return false;
+      if (r < 0)
+        {
+          if (errno == EWOULDBLOCK || errno == EINTR)
+            return true;
+          L_DEBUG("unable to read stream - recv:%s", strerror(errno));
+          return false;
+        }
+      s->recv_len += r;
+      s->last_active = hncp_io_time(o);
+      done = 0;
+      while (s->recv_len - done >= sizeof(len))
+        {
+          memcpy(&len, s->recv_buf + done, sizeof(len));
+          len = be32_to_cpu(len);
+          if (len > HNCP_MAXIMUM_STREAM_MESSAGE_SIZE
+              || s->recv_len - done - sizeof(len) < len)
+            break;
+          st->messages_received++;
+          if ((l = _stream_link(s)))
+            hncp_handle_stream_message(l, &s->peer.sin6_addr,
+                                       s->recv_buf + done + sizeof(len), len);
+          else
+            L_DEBUG("ignoring %u byte stream message from ifindex %d",
+                    (unsigned int)len, s->ifindex);
+          if (s->closing)
+            return false;
+          done += sizeof(len) + len;
+        }
+      if (done)
+        {
+          memmove(s->recv_buf, s->recv_buf + done, s->recv_len - done);
+          s->recv_len -= done;
+          if (!s->recv_len && s->recv_size > HNCP_IO_STREAM_CHUNK)
+            {
+              free(s->recv_buf);
+              s->recv_buf = NULL;
+              s->recv_size = 0;
+            }
+        }
+    }
+}
+
+static void _stream_cb(struct uloop_fd *u, unsigned int events)
+{
+  hncp_io_stream s = container_of(u, hncp_io_stream_s, ufd);
+  socklen_t slen = sizeof(int);
+  int err = 0;
+
+  if (s->closing)
+    {
+      _stream_free(s);
+      return;
+    }
+  if (s->connecting)
+    {
+      if (!(events & ULOOP_WRITE))
+        return;
+      if (getsockopt(u->fd, SOL_SOCKET, SO_ERROR, &err, &slen) < 0 || err)
+        {
+          L_DEBUG("unable to connect stream to %s - %s",
+                  ADDR_REPR(&s->peer.sin6_addr), strerror(err));
+          _stream_free(s);
+          return;
+        }
+      slen = sizeof(s->peer);
+      if (getpeername(u->fd, (struct sockaddr *)&s->peer, &slen) < 0)
+        return; /* not yet */
+      s->connecting = false;
+    }
+  if ((events & ULOOP_WRITE) && !_stream_write(s))
+    {
+      _stream_free(s);
+      return;
+    }
+  if ((events & ULOOP_READ) && !_stream_read(s))
+    _stream_free(s);
+}
+
+static hncp_io_stream _stream_create(hncp o, int fd,
+                                     const struct sockaddr_in6 *peer,
+                                     int ifindex)
+{
+  struct hncp_io_streams_struct *st = o->io_streams;
+  hncp_io_stream s;
+
+  if (st->num_streams >= HNCP_STREAM_MAX_STREAMS
+      || !(s = calloc(1, sizeof(*s))))
+    {
+      st->refused++;
+      close(fd);
+      return NULL;
+    }
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  s->hncp = o;
+  s->peer = *peer;
+  s->ifindex = ifindex;
+  s->last_active = hncp_io_time(o);
+  s->ufd.fd = fd;
+  s->ufd.cb = _stream_cb;
+  list_add(&s->lh, &st->streams);
+  st->num_streams++;
+  uloop_fd_add(&s->ufd, ULOOP_READ);
+  if (!st->idle_timeout.pending)
+    uloop_timeout_set(&st->idle_timeout,
+                      HNCP_STREAM_IDLE_TIMEOUT * 1000 / HNETD_TIME_PER_SECOND);
+  st->connections++;
+  return s;
+}
+
+/* Interface of the local end of an accepted connection; link-local
+ * peers tell it directly, otherwise look for the local address. */
+static int _stream_ifindex(int fd, const struct sockaddr_in6 *peer)
+{
+  struct sockaddr_in6 local;
+  socklen_t slen = sizeof(local);
+  struct ifaddrs *ia, *p;
+  int ifindex = 0;
+
+  if (peer->sin6_scope_id)
+    return peer->sin6_scope_id;
+  if (getsockname(fd, (struct sockaddr *)&local, &slen) < 0
+      || getifaddrs(&ia))
+    return 0;
+  for (p = ia ; p && !ifindex ; p = p->ifa_next)
+    if (p->ifa_addr && p->ifa_addr->sa_family == AF_INET6
+        && !memcmp(&((struct sockaddr_in6 *)p->ifa_addr)->sin6_addr,
+                   &local.sin6_addr, sizeof(local.sin6_addr)))
+      ifindex = if_nametoindex(p->ifa_name);
+  freeifaddrs(ia);
+  return ifindex;
+}
+
+static void _stream_accept_cb(struct uloop_fd *u, unsigned int events __unused)
+{
+  struct hncp_io_streams_struct *st =
+    container_of(u, struct hncp_io_streams_struct, listen_ufd);
+  struct sockaddr_in6 peer;
+  socklen_t slen;
+  int fd, ifindex;
+
+  while (1)
+    {
+      slen = sizeof(peer);
+      if ((fd = accept(u->fd, (struct sockaddr *)&peer, &slen)) < 0)
+        {
+          if (errno != EWOULDBLOCK && errno != EINTR)
+            L_DEBUG("unable to accept stream - accept:%s", strerror(errno));
+          return;
+        }
+      /* Only neighbors on our links (or ourselves, in tests). */
+      ifindex = _stream_ifindex(fd, &peer);
+      if ((!IN6_IS_ADDR_LINKLOCAL(&peer.sin6_addr)
+           && !IN6_IS_ADDR_LOOPBACK(&peer.sin6_addr))
+          || !_find_link(st->hncp, ifindex))
+        {
+          L_DEBUG("refusing stream from %s (ifindex %d)",
+                  ADDR_REPR(&peer.sin6_addr), ifindex);
+          st->refused++;
+          close(fd);
+          continue;
+        }
+      L_DEBUG("accepted stream from %s", ADDR_REPR(&peer.sin6_addr));
+      _stream_create(st->hncp, fd, &peer, ifindex);
+    }
+}
+
+static void _stream_idle_cb(struct uloop_timeout *t)
+{
+  struct hncp_io_streams_struct *st =
+    container_of(t, struct hncp_io_streams_struct, idle_timeout);
+  hnetd_time_t now = hncp_io_time(st->hncp);
+  hncp_io_stream s, s2;
+
+  /* Both idle streams, and ones whose peer has not read anything for
+   * as long. */
+  list_for_each_entry_safe(s, s2, &st->streams, lh)
+    if (s->closing || s->last_active + HNCP_STREAM_IDLE_TIMEOUT <= now)
+      _stream_free(s);
+  if (!list_empty(&st->streams))
+    uloop_timeout_set(t, HNCP_STREAM_IDLE_TIMEOUT * 1000
+                      / HNETD_TIME_PER_SECOND);
+}
+
+bool hncp_io_stream_set_enabled(hncp o, bool enabled)
+{
+  struct hncp_io_streams_struct *st = o->io_streams;
+  struct sockaddr_in6 addr;
+  hncp_io_stream s, s2;
+  const int one = 1;
+  int fd;
+
+  if (!enabled)
+    {
+      if (!st)
+        return true;
+      list_for_each_entry_safe(s, s2, &st->streams, lh)
+        _stream_free(s);
+      uloop_timeout_cancel(&st->idle_timeout);
+      uloop_fd_delete(&st->listen_ufd);
+      close(st->listen_ufd.fd);
+      free(st);
+      o->io_streams = NULL;
+      return true;
+    }
+  if (st)
+    return true;
+  if ((fd = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP)) < 0)
+    {
+      L_ERR("unable to create IPv6 TCP socket");
+      return false;
+    }
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  memset(&addr, 0, sizeof(addr));
+  addr.sin6_family = AF_INET6;
+  addr.sin6_port = htons(HNCP_PORT);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+      || listen(fd, 8) < 0)
+    {
+      L_ERR("unable to listen on TCP port %d:%s", HNCP_PORT, strerror(errno));
+      close(fd);
+      return false;
+    }
+  if (!(st = calloc(1, sizeof(*st))))
+    {
+      close(fd);
+      return false;
+    }
+  st->hncp = o;
+  INIT_LIST_HEAD(&st->streams);
+  st->idle_timeout.cb = _stream_idle_cb;
+  st->listen_ufd.fd = fd;
+  st->listen_ufd.cb = _stream_accept_cb;
+  uloop_fd_add(&st->listen_ufd, ULOOP_READ);
+  o->io_streams = st;
+  return true;
+}
+
+static hncp_io_stream _stream_find(hncp o, const struct sockaddr_in6 *peer)
+{
+  hncp_io_stream s;
+
+  list_for_each_entry(s, &o->io_streams->streams, lh)
+    if (!memcmp(&s->peer.sin6_addr, &peer->sin6_addr, sizeof(peer->sin6_addr))
+        && s->peer.sin6_scope_id == peer->sin6_scope_id)
+      return s;
+  return NULL;
+}
+
+ssize_t hncp_io_stream_sendmsg(hncp_link l, const struct iovec *iov,
+                               int iovcnt, const struct in6_addr *to)
+{
+  hncp o = l->hncp;
+  struct sockaddr_in6 dst;
+  hncp_io_stream s;
+  size_t len = 0;
+  uint32_t hdr;
+  int i, fd;
+
+  if (!o->io_streams)
+    return -1;
+  for (i = 0 ; i < iovcnt ; i++)
+    len += iov[i].iov_len;
+  if (len > HNCP_MAXIMUM_STREAM_MESSAGE_SIZE)
+    {
+      errno = EMSGSIZE;
+      return -1;
+    }
+  if (!l->ifindex)
+    hncp_link_set_ifindex(l, if_nametoindex(l->ifname));
+  memset(&dst, 0, sizeof(dst));
+  dst.sin6_family = AF_INET6;
+  dst.sin6_port = htons(HNCP_PORT);
+  dst.sin6_addr = *to;
+  if (IN6_IS_ADDR_LINKLOCAL(to))
+    dst.sin6_scope_id = l->ifindex;
+  if ((s = _stream_find(o, &dst)) && s->closing)
+    return -1;
+  if (!s)
+    {
+      if ((fd = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP)) < 0)
+        return -1;
+      fcntl(fd, F_SETFL, O_NONBLOCK);
+      if (connect(fd, (struct sockaddr *)&dst, sizeof(dst)) < 0
+          && errno != EINPROGRESS)
+        {
+          _send_error(&dst, "connect");
+          close(fd);
+          return -1;
+        }
+      if (!(s = _stream_create(o, fd, &dst, l->ifindex)))
+        return -1;
+      s->connecting = true;
+    }
+  if (s->send_done)
+    {
+      memmove(s->send_buf, s->send_buf + s->send_done,
+              s->send_len - s->send_done);
+      s->send_len -= s->send_done;
+      s->send_done = 0;
+    }
+  if (!s->send_len)
+    s->last_active = hncp_io_time(o);
+  else if (s->send_len + sizeof(hdr) + len > HNCP_STREAM_MAX_BACKLOG)
+    {
+      L_INFO("closing stream to %s - %d bytes not read",
+             ADDR_REPR(to), (int)s->send_len);
+      s->closing = true;
+      uloop_fd_delete(&s->ufd);
+      uloop_timeout_set(&o->io_streams->idle_timeout, 0);
+      return -1;
+    }
+  if (!_stream_reserve(&s->send_buf, &s->send_size,
+                       s->send_len + sizeof(hdr) + len))
+    return -1;
+  hdr = cpu_to_be32(len);
+  memcpy(s->send_buf + s->send_len, &hdr, sizeof(hdr));
+  s->send_len += sizeof(hdr);
+  for (i = 0 ; i < iovcnt ; i++)
+    {
+      memcpy(s->send_buf + s->send_len, iov[i].iov_base, iov[i].iov_len);
+      s->send_len += iov[i].iov_len;
+    }
+  o->io_streams->messages_sent++;
+  L_DEBUG("hncp_io_stream_sendmsg %d bytes -> %s%%%s",
+          (int)len, ADDR_REPR(to), l->ifname);
+  /* Write errors are noticed (and the stream closed) in _stream_cb. */
+  if (s->connecting)
+    uloop_fd_add(&s->ufd, ULOOP_READ | ULOOP_WRITE);
+  else
+    _stream_write(s);
+  return len;
+}
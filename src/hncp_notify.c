@@ -21,12 +21,98 @@
   if (s->node_change_callback)                  \
     s->node_change_callback(s, n, add)
 
+#define TLV_TYPE_WANTED(s, a)                                   \
+  (!s->tlv_types || (s->tlv_types & HNCP_TLV_TYPE_MASK(tlv_id(a))))
+
+#define TLV_CHANGE_WANTED(s, a)                 \
+  (s->tlv_change_callback && TLV_TYPE_WANTED(s, a))
+
+/* A queued change for tlv_changes_callback; the TLV (copy) follows. */
+typedef struct {
+  struct avl_node in_tlv_changes;
+  hncp_tlv_change_s c;
+} hncp_tlv_change_entry_s, *hncp_tlv_change_entry;
+
+int hncp_tlv_change_cmp(const void *k1, const void *k2,
+                        void *ptr __unused)
+{
+  const hncp_tlv_change_s *c1 = k1, *c2 = k2;
+  int r;
+
+  /* In node order (and by address only as a last resort). */
+  if (c1->node != c2->node)
+    {
+      if ((r = hncp_node_cmp(c1->node, c2->node)))
+        return r;
+      return c1->node < c2->node ? -1 : 1;
+    }
+  /* No TLV = before any TLV of the node (for lookups). */
+  if (!c1->tlv || !c2->tlv)
+    return !!c1->tlv - !!c2->tlv;
+  return tlv_attr_cmp(c1->tlv, c2->tlv);
+}
+
+/* Give changes of the types s wants to its tlv_changes_callback;
+ * filtered has room for num_changes. */
+static void _notify_tlv_changes(hncp_subscriber s,
+                                hncp_tlv_change changes, int num_changes,
+                                hncp_tlv_change filtered)
+{
+  int i, n = 0;
+
+  if (!s->tlv_types)
+    {
+      if (num_changes)
+        s->tlv_changes_callback(s, changes, num_changes);
+      return;
+    }
+  for (i = 0; i < num_changes; i++)
+    if (TLV_TYPE_WANTED(s, changes[i].tlv))
+      filtered[n++] = changes[i];
+  if (n)
+    s->tlv_changes_callback(s, filtered, n);
+}
+
+/* Every TLV of every node, in one batch. */
+static void _notify_all_tlvs(hncp o, hncp_subscriber s, bool add)
+{
+  hncp_tlv_change changes;
+  struct tlv_attr *a;
+  hncp_node n;
+  int i = 0;
+
+  hncp_for_each_node(o, n)
+    hncp_node_for_each_tlv(n, a)
+      i++;
+  if (!i)
+    return;
+  if (!(changes = malloc(2 * i * sizeof(*changes))))
+    {
+      L_ERR("_notify_all_tlvs - out of memory");
+      return;
+    }
+  i = 0;
+  hncp_for_each_node(o, n)
+    hncp_node_for_each_tlv(n, a)
+      {
+        changes[i].node = n;
+        changes[i].tlv = a;
+        changes[i].add = add;
+        i++;
+      }
+  _notify_tlv_changes(s, changes, i, changes + i);
+  free(changes);
+}
+
 void hncp_subscribe(hncp o, hncp_subscriber s)
 {
   hncp_node n;
   hncp_tlv t;
   struct tlv_attr *a;
 
+  /* Queued changes predate the subscription. */
+  if (s->tlv_changes_callback)
+    hncp_notify_subscribers_tlv_changes(o, NULL);
   list_add(&s->lh, &o->subscribers);
   if (s->local_tlv_change_callback)
     {
@@ -39,9 +125,12 @@ void hncp_subscribe(hncp o, hncp_subscriber s)
       if (s->tlv_change_callback)
         {
           hncp_node_for_each_tlv(n, a)
-            s->tlv_change_callback(s, n, a, true);
+            if (TLV_CHANGE_WANTED(s, a))
+              s->tlv_change_callback(s, n, a, true);
         }
     }
+  if (s->tlv_changes_callback)
+    _notify_all_tlvs(o, s, true);
 }
 
 void hncp_unsubscribe(hncp o, hncp_subscriber s)
@@ -55,12 +144,18 @@ void hncp_unsubscribe(hncp o, hncp_subscriber s)
       vlist_for_each_element(&o->tlvs, t, in_tlvs)
         s->local_tlv_change_callback(s, &t->tlv, false);
     }
+  if (s->tlv_changes_callback)
+    {
+      hncp_notify_subscribers_tlv_changes(o, NULL);
+      _notify_all_tlvs(o, s, false);
+    }
   hncp_for_each_node(o, n)
     {
       if (s->tlv_change_callback)
         {
           hncp_node_for_each_tlv(n, a)
-            s->tlv_change_callback(s, n, a, false);
+            if (TLV_CHANGE_WANTED(s, a))
+              s->tlv_change_callback(s, n, a, false);
         }
       NODE_CHANGE_CALLBACK(s, n, false);
     }
@@ -82,111 +177,248 @@ void hncp_unsubscribe(hncp o, hncp_subscriber s)
       break;                                    \
     }
 
-void hncp_notify_subscribers_tlvs_changed(hncp_node n,
-                                          struct tlv_attr *a_old,
-                                          struct tlv_attr *a_new)
+static void _tlv_diff(struct tlv_attr *a_old, struct tlv_attr *a_new,
+                      bool removed, bool added,
+                      hncp_tlv_diff_cb cb, void *context)
 {
-  hncp_subscriber s;
   void *old_end = (void *)a_old + (a_old ? tlv_pad_len(a_old) : 0);
   void *new_end = (void *)a_new + (a_new ? tlv_pad_len(a_new) : 0);
+  struct tlv_attr *op = a_old ? tlv_data(a_old) : NULL;
+  struct tlv_attr *np = a_new ? tlv_data(a_new) : NULL;
   int r;
 
-  /* There are two distinct steps here: First we remove missing, and
-   * then we add new ones. Otherwise, there may be confusion if we get
-   * first new + then remove, and the underlying TLV has same
-   * key.. :-p */
-  list_for_each_entry(s, &n->hncp->subscribers, lh)
-    {
-      struct tlv_attr *op = a_old ? tlv_data(a_old) : NULL;
-      struct tlv_attr *np = a_new ? tlv_data(a_new) : NULL;
-
-      /* If subscriber isn't interested, just skip. */
-      if (!s->tlv_change_callback)
-        continue;
+  /* Keep two pointers, one for old, one for new. */
 
-      /* Keep two pointers, one for old, one for new. */
-
-      /* While there's data in both, and it looks valid, we drain each
-       * 0-1 at the time. */
-      while (op && np)
+  /* While there's data in both, and it looks valid, we drain each
+   * 0-1 at the time. */
+  while (op && np)
+    {
+      ENSURE_VALID(op, old_end);
+      ENSURE_VALID(np, new_end);
+      /* Ok, op and np both point at valid structs. */
+      r = tlv_attr_cmp(op, np);
+      /* If they're equal, we can skip both, no sense giving notification */
+      if (!r)
         {
-          ENSURE_VALID(op, old_end);
-          ENSURE_VALID(np, new_end);
-          /* Ok, op and np both point at valid structs. */
-          r = tlv_attr_cmp(op, np);
-          /* If they're equal, we can skip both, no sense giving notification */
-          if (!r)
-            {
-              op = tlv_next(op);
-              np = tlv_next(np);
-            }
-          else if (r < 0)
-            {
-              /* op < np => op deleted */
-              s->tlv_change_callback(s, n, op, false);
-              op = tlv_next(op);
-            }
-          else
-            {
-              /* op > np => np added */
-              /* in part 2 */
-              np = tlv_next(np);
-            }
+          op = tlv_next(op);
+          np = tlv_next(np);
         }
-      /* Anything left in op was deleted. */
-      while (op)
+      else if (r < 0)
         {
-          ENSURE_VALID(op, old_end);
-          s->tlv_change_callback(s, n, op, false);
+          /* op < np => op deleted */
+          if (removed)
+            cb(op, false, context);
           op = tlv_next(op);
         }
+      else
+        {
+          /* op > np => np added */
+          if (added)
+            cb(np, true, context);
+          np = tlv_next(np);
+        }
     }
-  list_for_each_entry(s, &n->hncp->subscribers, lh)
+  /* Anything left in op was deleted. */
+  while (op && removed)
+    {
+      ENSURE_VALID(op, old_end);
+      cb(op, false, context);
+      op = tlv_next(op);
+    }
+  /* Anything left in np was added. */
+  while (np && added)
     {
-      struct tlv_attr *op = a_old ? tlv_data(a_old) : NULL;
-      struct tlv_attr *np = a_new ? tlv_data(a_new) : NULL;
+      ENSURE_VALID(np, new_end);
+      cb(np, true, context);
+      np = tlv_next(np);
+    }
+}
 
-      /* If subscriber isn't interested, just skip. */
-      if (!s->tlv_change_callback)
-        continue;
+void hncp_tlv_diff(struct tlv_attr *a_old, struct tlv_attr *a_new,
+                   bool add, hncp_tlv_diff_cb cb, void *context)
+{
+  _tlv_diff(a_old, a_new, !add, add, cb, context);
+}
+
+/* Changes that fit in here need no allocation. */
+#define HNCP_NOTIFY_STATIC_CHANGES 32
+
+typedef struct {
+  struct tlv_attr *tlv;
+  bool add;
+} hncp_notify_change_s, *hncp_notify_change;
 
-      /* Keep two pointers, one for old, one for new. */
+typedef struct {
+  uint64_t tlv_types;
+  hncp_notify_change changes;
+  int num_changes, size;
+  bool failed;
+  hncp_notify_change_s buf[HNCP_NOTIFY_STATIC_CHANGES];
+} hncp_notify_tlv_context_s;
 
-      /* While there's data in both, and it looks valid, we drain each
-       * 0-1 at the time. */
-      while (op && np)
+static void _collect_tlv_changed(struct tlv_attr *a, bool add, void *context)
+{
+  hncp_notify_tlv_context_s *c = context;
+  hncp_notify_change nc;
+
+  if (!(c->tlv_types & HNCP_TLV_TYPE_MASK(tlv_id(a))))
+    return;
+  if (c->num_changes == c->size)
+    {
+      if (c->changes == c->buf)
         {
-          ENSURE_VALID(op, old_end);
-          ENSURE_VALID(np, new_end);
-          /* Ok, op and np both point at valid structs. */
-          r = tlv_attr_cmp(op, np);
-          /* If they're equal, we can skip both, no sense giving notification */
-          if (!r)
-            {
-              op = tlv_next(op);
-              np = tlv_next(np);
-            }
-          else if (r < 0)
-            {
-              /* op < np => op deleted */
-              /* we did this in part 1 */
-              op = tlv_next(op);
-            }
-          else
-            {
-              /* op > np => np added */
-              s->tlv_change_callback(s, n, np, true);
-              np = tlv_next(np);
-            }
+          nc = malloc(2 * c->size * sizeof(*nc));
+          if (nc)
+            memcpy(nc, c->buf, sizeof(c->buf));
         }
-      /* Anything left in np was added. */
-      while (np)
+      else
+        nc = realloc(c->changes, 2 * c->size * sizeof(*nc));
+      if (!nc)
         {
-          ENSURE_VALID(np, new_end);
-          s->tlv_change_callback(s, n, np, true);
-          np = tlv_next(np);
+          c->failed = true;
+          return;
+        }
+      c->changes = nc;
+      c->size *= 2;
+    }
+  c->changes[c->num_changes].tlv = a;
+  c->changes[c->num_changes].add = add;
+  c->num_changes++;
+}
+
+static void _notify_tlv_changed(hncp_node n, hncp_notify_change_s *changes,
+                                int num_changes, bool add)
+{
+  hncp_subscriber s;
+  int i;
+
+  list_for_each_entry(s, &n->hncp->subscribers, lh)
+    for (i = 0; i < num_changes; i++)
+      if (changes[i].add == add && TLV_CHANGE_WANTED(s, changes[i].tlv))
+        s->tlv_change_callback(s, n, changes[i].tlv, add);
+}
+
+static void _queue_tlv_change(hncp_node n, struct tlv_attr *a, bool add)
+{
+  hncp o = n->hncp;
+  hncp_tlv_change_s key = { .node = n, .tlv = a };
+  hncp_tlv_change_entry e;
+
+  e = avl_find_element(&o->tlv_changes, &key, e, in_tlv_changes);
+  if (e)
+    {
+      /* Added and removed (or the other way around) since the last
+       * batch; nothing to tell. */
+      if (e->c.add != add)
+        {
+          avl_delete(&o->tlv_changes, &e->in_tlv_changes);
+          free(e);
         }
+      return;
+    }
+  if (!(e = malloc(sizeof(*e) + tlv_pad_len(a))))
+    {
+      L_ERR("_queue_tlv_change - out of memory");
+      return;
     }
+  e->c.node = n;
+  e->c.tlv = (struct tlv_attr *)(e + 1);
+  e->c.add = add;
+  memcpy(e->c.tlv, a, tlv_pad_len(a));
+  e->in_tlv_changes.key = &e->c;
+  avl_insert(&o->tlv_changes, &e->in_tlv_changes);
+  hncp_schedule(o);
+}
+
+void hncp_notify_subscribers_tlv_changes(hncp o, hncp_node n)
+{
+  hncp_tlv_change_s key = { .node = n };
+  int i = 0, num_changes = o->tlv_changes.count;
+  hncp_tlv_change_entry e, *es;
+  hncp_tlv_change changes;
+  hncp_subscriber s;
+
+  if (!num_changes)
+    return;
+  if (n)
+    {
+      e = avl_find_ge_element(&o->tlv_changes, &key, e, in_tlv_changes);
+      if (!e || e->c.node != n)
+        return;
+    }
+  es = malloc(num_changes * sizeof(*es));
+  changes = malloc(2 * num_changes * sizeof(*changes));
+  if (!es || !changes)
+    {
+      L_ERR("hncp_notify_subscribers_tlv_changes - out of memory");
+      free(es);
+      free(changes);
+      return;
+    }
+  /* Removals first, as with tlv_change_callback. */
+  avl_for_each_element(&o->tlv_changes, e, in_tlv_changes)
+    if (!e->c.add)
+      {
+        es[i] = e;
+        changes[i++] = e->c;
+      }
+  avl_for_each_element(&o->tlv_changes, e, in_tlv_changes)
+    if (e->c.add)
+      {
+        es[i] = e;
+        changes[i++] = e->c;
+      }
+  /* Anything queued by the callbacks goes to the next batch. */
+  avl_init(&o->tlv_changes, hncp_tlv_change_cmp, false, NULL);
+  list_for_each_entry(s, &o->subscribers, lh)
+    if (s->tlv_changes_callback)
+      _notify_tlv_changes(s, changes, num_changes, changes + num_changes);
+  for (i = 0; i < num_changes; i++)
+    free(es[i]);
+  free(es);
+  free(changes);
+}
+
+void hncp_notify_subscribers_tlvs_changed(hncp_node n,
+                                          struct tlv_attr *a_old,
+                                          struct tlv_attr *a_new)
+{
+  hncp_notify_tlv_context_s c;
+  hncp_subscriber s;
+  uint64_t batch_types = 0;
+  int i;
+
+  /* Only the types someone is interested in are collected. */
+  c.tlv_types = 0;
+  list_for_each_entry(s, &n->hncp->subscribers, lh)
+    {
+      if (s->tlv_change_callback)
+        c.tlv_types |= s->tlv_types ? s->tlv_types : ~0ULL;
+      if (s->tlv_changes_callback)
+        batch_types |= s->tlv_types ? s->tlv_types : ~0ULL;
+    }
+  c.tlv_types |= batch_types;
+  if (!c.tlv_types)
+    return;
+  c.changes = c.buf;
+  c.num_changes = 0;
+  c.size = HNCP_NOTIFY_STATIC_CHANGES;
+  c.failed = false;
+  _tlv_diff(a_old, a_new, true, true, _collect_tlv_changed, &c);
+  if (c.failed)
+    L_ERR("hncp_notify_subscribers_tlvs_changed - out of memory");
+
+  /* There are two distinct steps here: First we remove missing, and
+   * then we add new ones. Otherwise, there may be confusion if we get
+   * first new + then remove, and the underlying TLV has same
+   * key.. :-p */
+  _notify_tlv_changed(n, c.changes, c.num_changes, false);
+  _notify_tlv_changed(n, c.changes, c.num_changes, true);
+  for (i = 0; i < c.num_changes; i++)
+    if (batch_types & HNCP_TLV_TYPE_MASK(tlv_id(c.changes[i].tlv)))
+      _queue_tlv_change(n, c.changes[i].tlv, c.changes[i].add);
+  if (c.changes != c.buf)
+    free(c.changes);
 }
 
 void hncp_notify_subscribers_local_tlv_changed(hncp o,
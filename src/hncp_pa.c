@@ -466,6 +466,15 @@ static void _tlv_cb(hncp_subscriber s,
 
 }
 
+static void _tlv_changes_cb(hncp_subscriber s,
+                            hncp_tlv_change changes, int num_changes)
+{
+  int i;
+
+  for (i = 0; i < num_changes; i++)
+    _tlv_cb(s, changes[i].node, changes[i].tlv, changes[i].add);
+}
+
 #define APPEND_BUF(buf, len, ibuf, ilen)        \
 do                                              \
   {                                             \
@@ -801,7 +810,11 @@ hncp_glue hncp_pa_glue_create(hncp o, struct pa_data *pa_data)
 
   INIT_LIST_HEAD(&g->external_links);
   vlist_init(&g->dps, compare_dps, update_dp);
-  g->subscriber.tlv_change_callback = _tlv_cb;
+  g->subscriber.tlv_changes_callback = _tlv_changes_cb;
+  g->subscriber.tlv_types = HNCP_TLV_TYPE_MASK(HNCP_T_EXTERNAL_CONNECTION)
+    | HNCP_TLV_TYPE_MASK(HNCP_T_ASSIGNED_PREFIX)
+    | HNCP_TLV_TYPE_MASK(HNCP_T_ROUTER_ADDRESS)
+    | HNCP_TLV_TYPE_MASK(HNCP_T_NODE_DATA_NEIGHBOR);
   /* g->subscriber.node_change_callback = _node_cb; */
   g->subscriber.republish_callback = _republish_cb;
   g->pa_data = pa_data;
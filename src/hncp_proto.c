@@ -37,21 +37,6 @@ static bool _push_node_state_tlv(struct tlv_buf *tb, hncp_node n)
   return true;
 }
 
-static bool _push_node_data_tlv(struct tlv_buf *tb, hncp_node n)
-{
-  int s = n->tlv_container ? tlv_len(n->tlv_container) : 0;
-  hncp_t_node_data_header h;
-  struct tlv_attr *a = tlv_new(tb, HNCP_T_NODE_DATA, sizeof(*h) + s);
-
-  if (!a)
-    return false;
-  h = tlv_data(a);
-  h->node_identifier_hash = n->node_identifier_hash;
-  h->update_number = cpu_to_be32(n->update_number);
-  memcpy((void *)h + sizeof(*h), tlv_data(n->tlv_container), s);
-  return true;
-}
-
 static bool _push_network_state_tlv(struct tlv_buf *tb, hncp o)
 {
   struct tlv_attr *a = tlv_new(tb, HNCP_T_NETWORK_HASH, HNCP_HASH_LEN);
@@ -77,45 +62,297 @@ static bool _push_link_id_tlv(struct tlv_buf *tb, hncp_link l)
   return true;
 }
 
+/* LINK_ID TLV on its own, for the replies sent with an iovec. */
+typedef struct __packed {
+  struct tlv_attr h;
+  hncp_t_link_id_s lid;
+} hncp_link_id_tlv_s;
+
+static void _init_link_id_tlv(hncp_link_id_tlv_s *t, hncp_link l)
+{
+  tlv_init(&t->h, HNCP_T_LINK_ID, sizeof(*t));
+  t->lid.node_identifier_hash = l->hncp->own_node->node_identifier_hash;
+  t->lid.link_id = cpu_to_be32(l->iid);
+}
+
+/* BULK_SYNC TLV on its own, likewise. */
+typedef struct __packed {
+  struct tlv_attr h;
+  hncp_t_bulk_sync_s bs;
+} hncp_bulk_sync_tlv_s;
+
+static void _init_bulk_sync_tlv(hncp_bulk_sync_tlv_s *t)
+{
+  tlv_init(&t->h, HNCP_T_BULK_SYNC, sizeof(*t));
+  t->bs.version = cpu_to_be32(HNCP_BULK_SYNC_VERSION);
+}
+
+static bool _push_bulk_sync_tlv(struct tlv_buf *tb)
+{
+  hncp_t_bulk_sync_s bs = { .version = cpu_to_be32(HNCP_BULK_SYNC_VERSION) };
+
+  return tlv_put(tb, HNCP_T_BULK_SYNC, &bs, sizeof(bs)) != NULL;
+}
+
+/* STREAM_SYNC TLV on its own, likewise. */
+typedef struct __packed {
+  struct tlv_attr h;
+  hncp_t_stream_sync_s ss;
+} hncp_stream_sync_tlv_s;
+
+static void _init_stream_sync_tlv(hncp_stream_sync_tlv_s *t)
+{
+  tlv_init(&t->h, HNCP_T_STREAM_SYNC, sizeof(*t));
+  t->ss.version = cpu_to_be32(HNCP_STREAM_SYNC_VERSION);
+}
+
+static bool _push_stream_sync_tlv(struct tlv_buf *tb)
+{
+  hncp_t_stream_sync_s ss =
+    { .version = cpu_to_be32(HNCP_STREAM_SYNC_VERSION) };
+
+  return tlv_put(tb, HNCP_T_STREAM_SYNC, &ss, sizeof(ss)) != NULL;
+}
+
+/* Bulk sync version to use with a peer that advertised the given
+ * one; 0 if either side does not want it. */
+static uint32_t _bulk_sync_version(hncp o, uint32_t version)
+{
+  if (!o->bulk_sync)
+    return 0;
+  return version < HNCP_BULK_SYNC_VERSION ? version : HNCP_BULK_SYNC_VERSION;
+}
+
 /****************************************** Actual payload sending utilities */
 
-void hncp_link_send_network_state(hncp_link l,
-                                  struct in6_addr *dst,
-                                  size_t maximum_size)
+/* Does the neighbor at dst on l accept streams? */
+static bool _neighbor_stream_sync(hncp_link l, struct in6_addr *dst)
 {
-  struct tlv_buf tb;
-  hncp o = l->hncp;
-  int nn = 0;
+  hncp_neighbor ne;
+
+  vlist_for_each_element(&l->neighbors, ne, in_neighbors)
+    if (ne->stream_sync_version
+        && !memcmp(&ne->last_address, dst, sizeof(*dst)))
+      return true;
+  return false;
+}
+
+/* Send a reply; if it does not fit in a datagram, stream it instead
+ * if both we and the neighbor can. Returns false if it was not sent. */
+static bool _send_reply(hncp_link l, struct in6_addr *dst,
+                        const struct iovec *iov, int iovcnt)
+{
+  size_t len = 0;
+  int i;
+
+  for (i = 0 ; i < iovcnt ; i++)
+    len += iov[i].iov_len;
+  if (len > HNCP_MAXIMUM_DATAGRAM_SIZE && l->hncp->stream_sync
+      && _neighbor_stream_sync(l, dst)
+      && hncp_io_stream_sendmsg(l, iov, iovcnt, dst) >= 0)
+    return true;
+  return hncp_io_sendmsg(l, iov, iovcnt, dst) >= 0;
+}
+
+/* Make sure o->network_state contains the NETWORK_HASH TLV and the
+ * NODE_STATE TLVs for the current network hash. */
+static bool _update_network_state(hncp o)
+{
+  struct tlv_buf *tb = &o->network_state;
   hncp_node n;
+  int nn = 0;
 
-  memset(&tb, 0, sizeof(tb));
-  tlv_buf_init(&tb, 0); /* not passed anywhere */
-  if (!_push_link_id_tlv(&tb, l))
-    goto done;
   hncp_calculate_network_hash(o);
-  if (!_push_network_state_tlv(&tb, o))
-    goto done;
+  if (o->network_state_valid
+      && o->network_state_graph_dirty == o->graph_dirty)
+    {
+      o->network_state_hits++;
+      return true;
+    }
+  o->network_state_misses++;
+  o->network_state_valid = false;
   hncp_for_each_node(o, n)
     if (!o->graph_dirty || n == o->own_node)
       nn++;
+  if (nn > o->network_state_nodes_size)
+    {
+      hncp_node *nodes = realloc(o->network_state_nodes, nn * sizeof(*nodes));
+
+      if (!nodes)
+        return false;
+      o->network_state_nodes = nodes;
+      o->network_state_nodes_size = nn;
+    }
+  o->num_network_state_nodes = 0;
+  /* not passed anywhere */
+  tlv_buf_init_size(tb, 0, 2 * TLV_SIZE + HNCP_HASH_LEN
+                    + nn * (TLV_SIZE + sizeof(hncp_t_node_state_s)));
+  if (!_push_network_state_tlv(tb, o))
+    return false;
+  hncp_for_each_node(o, n)
+    if (!o->graph_dirty || n == o->own_node)
+      {
+        if (!_push_node_state_tlv(tb, n))
+          return false;
+        o->network_state_nodes[o->num_network_state_nodes++] = n;
+      }
+  o->network_state_graph_dirty = o->graph_dirty;
+  o->network_state_valid = true;
+  L_DEBUG("_update_network_state: %d nodes (%u hits, %u misses)",
+          nn, o->network_state_hits, o->network_state_misses);
+  return true;
+}
+
+/* Refresh the fields of cached NODE_STATE TLVs that may change
+ * without network hash changing. */
+static void _patch_network_state(hncp o)
+{
+  hnetd_time_t now = hncp_time(o);
+  struct tlv_attr *a = tlv_data(o->network_state.head);
+  hncp_t_node_state ns;
+  hncp_node n;
+  int i;
+
+  for (i = 0 ; i < o->num_network_state_nodes ; i++)
+    {
+      a = tlv_next(a);
+      ns = tlv_data(a);
+      n = o->network_state_nodes[i];
+      ns->update_number = cpu_to_be32(n->update_number);
+      ns->ms_since_origination = cpu_to_be32(now - n->origination_time);
+    }
+}
+
+/* BUCKET_HASHES TLV on its own, likewise. */
+typedef struct __packed {
+  struct tlv_attr h;
+  hncp_t_bucket_hashes_s bh;
+} hncp_bucket_hashes_tlv_s;
+
+static void _init_bucket_hashes_tlv(hncp_bucket_hashes_tlv_s *t, hncp o)
+{
+  int i;
+
+  hncp_calculate_bucket_hashes(o);
+  tlv_init(&t->h, HNCP_T_BUCKET_HASHES, sizeof(*t));
+  t->bh.version = cpu_to_be32(HNCP_BUCKET_SYNC_VERSION);
+  for (i = 0 ; i < HNCP_BUCKETS ; i++)
+    memcpy(t->bh.hashes[i], &o->bucket_hashes[i], HNCP_HASH64_LEN);
+}
+
+/* Send network state, with NODE_STATEs of just the given buckets (0
+ * = all). If they do not fit in maximum_size, only the network hash
+ * (and bucket hashes, with bucket sync) is sent. Returns the length
+ * sent, or 0 if nothing was. */
+static size_t _send_network_state(hncp_link l, struct in6_addr *dst,
+                                size_t maximum_size, uint64_t buckets)
+{
+  /* The NETWORK_HASH and NODE_STATE TLVs are shared by all links;
+   * only LINK_ID (and the extension TLVs) is produced here. */
+  hncp o = l->hncp;
+  hncp_link_id_tlv_s lid;
+  hncp_bulk_sync_tlv_s bs;
+  hncp_stream_sync_tlv_s ss;
+  hncp_bucket_hashes_tlv_s bh;
+  size_t extra = sizeof(lid) + (o->bulk_sync ? sizeof(bs) : 0)
+    + (o->stream_sync ? sizeof(ss) : 0);
+  size_t nh_len = TLV_SIZE + HNCP_HASH_LEN;
+  size_t ns_len = TLV_SIZE + sizeof(hncp_t_node_state_s);
+  struct iovec iov[HNCP_BUCKETS + 5];
+  unsigned char *base;
+  size_t len = 0;
+  bool short_form = true;
+  int c = 0, i, j, b;
+
+  if (!_update_network_state(o))
+    return 0;
+  base = tlv_data(o->network_state.head);
+  _init_link_id_tlv(&lid, l);
+  iov[c].iov_base = &lid;
+  iov[c++].iov_len = sizeof(lid);
+  iov[c].iov_base = base;
+  iov[c++].iov_len = nh_len;
   if (!maximum_size
-      || maximum_size >= (tlv_len(tb.head) + nn * sizeof(hncp_t_node_state_s)))
+      || maximum_size >= extra + tlv_len(o->network_state.head))
     {
-      hncp_for_each_node(o, n)
-        {
-          if (!o->graph_dirty || n == o->own_node)
-            if (!_push_node_state_tlv(&tb, n))
-              goto done;
-        }
+      _patch_network_state(o);
+      if (!buckets)
+        iov[1].iov_len = tlv_len(o->network_state.head);
+      /* Nodes are in hash order, so each bucket is a contiguous run
+       * of NODE_STATEs. */
+      else
+        for (i = 0 ; i < o->num_network_state_nodes ; i = j)
+          {
+            b = hncp_hash_bucket(&o->network_state_nodes[i]
+                                 ->node_identifier_hash);
+            for (j = i + 1 ; j < o->num_network_state_nodes ; j++)
+              if (hncp_hash_bucket(&o->network_state_nodes[j]
+                                   ->node_identifier_hash) != b)
+                break;
+            if (!(buckets & (1ULL << b)))
+              continue;
+            iov[c].iov_base = base + nh_len + i * ns_len;
+            iov[c++].iov_len = (j - i) * ns_len;
+          }
+      short_form = false;
     }
-  if (maximum_size && tlv_len(tb.head) > maximum_size)
-    goto done;
+  if (o->bulk_sync)
+    {
+      _init_bulk_sync_tlv(&bs);
+      iov[c].iov_base = &bs;
+      iov[c++].iov_len = sizeof(bs);
+    }
+  if (o->stream_sync)
+    {
+      _init_stream_sync_tlv(&ss);
+      iov[c].iov_base = &ss;
+      iov[c++].iov_len = sizeof(ss);
+    }
+  if (short_form && o->bucket_sync)
+    {
+      _init_bucket_hashes_tlv(&bh, o);
+      iov[c].iov_base = &bh;
+      iov[c++].iov_len = sizeof(bh);
+    }
+  for (i = 0 ; i < c ; i++)
+    len += iov[i].iov_len;
+  if (maximum_size && len > maximum_size)
+    return 0;
   L_DEBUG("hncp_link_send_network_state -> %s%%" HNCP_LINK_F,
           ADDR_REPR(dst), HNCP_LINK_D(l));
-  hncp_io_sendto(o, tlv_data(tb.head), tlv_len(tb.head),
-                 l->ifname, dst);
- done:
-  tlv_buf_free(&tb);
+  _send_reply(l, dst, iov, c);
+  return len;
+}
+
+void hncp_link_send_network_state(hncp_link l,
+                                  struct in6_addr *dst,
+                                  size_t maximum_size)
+{
+  _send_network_state(l, dst, maximum_size, 0);
+}
+
+static hncp_node_data_reply _node_data_reply(hncp_node n)
+{
+  hncp_node_data_reply r = &n->node_data_reply;
+  int s = n->tlv_container ? tlv_len(n->tlv_container) : 0;
+
+  /* The update number is sometimes bumped directly (self flush,
+   * collisions), so check it too. */
+  if (n->node_data_reply_valid
+      && r->node_data.update_number == cpu_to_be32(n->update_number))
+    return r;
+  hncp_calculate_node_data_hash(n);
+  tlv_init(&r->node_state_header, HNCP_T_NODE_STATE,
+           TLV_SIZE + sizeof(r->node_state));
+  r->node_state.node_identifier_hash = n->node_identifier_hash;
+  r->node_state.update_number = cpu_to_be32(n->update_number);
+  r->node_state.node_data_hash = n->node_data_hash;
+  tlv_init(&r->node_data_header, HNCP_T_NODE_DATA,
+           TLV_SIZE + sizeof(r->node_data) + s);
+  r->node_data.node_identifier_hash = n->node_identifier_hash;
+  r->node_data.update_number = cpu_to_be32(n->update_number);
+  n->node_data_reply_valid = true;
+  return r;
 }
 
 void hncp_link_send_node_data(hncp_link l,
@@ -125,243 +362,1077 @@ void hncp_link_send_node_data(hncp_link l,
   /* Send two things:
      - node state tlv
      - node data tlv
-  */
-  struct tlv_buf tb;
 
-  memset(&tb, 0, sizeof(tb));
-  tlv_buf_init(&tb, 0); /* not passed anywhere */
-  if (_push_link_id_tlv(&tb, l)
-      && _push_node_state_tlv(&tb, n)
-      && _push_node_data_tlv(&tb, n))
+     Both (sans the container itself) come from a per-node cache; the
+     container is sent straight from the node without copying. */
+  hncp_link_id_tlv_s lid;
+  hncp_node_data_reply r = _node_data_reply(n);
+  int s = n->tlv_container ? tlv_len(n->tlv_container) : 0;
+  struct iovec iov[3] = {
+    { .iov_base = &lid, .iov_len = sizeof(lid) },
+    { .iov_base = r, .iov_len = sizeof(*r) },
+    { .iov_base = s ? tlv_data(n->tlv_container) : NULL, .iov_len = s }
+  };
+
+  _init_link_id_tlv(&lid, l);
+  r->node_state.ms_since_origination =
+    cpu_to_be32(hncp_time(l->hncp) - n->origination_time);
+  L_DEBUG("hncp_link_send_node_state %s -> %s%%" HNCP_LINK_F,
+          HNCP_NODE_REPR(n), ADDR_REPR(dst), HNCP_LINK_D(l));
+  _send_reply(l, dst, iov, s ? 3 : 2);
+}
+
+/* Ask for network state, with NODE_STATEs of just the given buckets
+ * (0 = all). */
+static void _send_req_network_state(hncp_link l, struct in6_addr *dst,
+                                    uint64_t buckets)
+{
+  hncp o = l->hncp;
+  hncp_t_req_buckets_s rb = { .buckets = cpu_to_be64(buckets) };
+  struct tlv_buf *tb = hncp_get_send_buf(o, 0);
+
+  if (!tb)
+    return;
+  if (_push_link_id_tlv(tb, l)
+      && tlv_new(tb, HNCP_T_REQ_NET_HASH, 0)
+      && (!o->stream_sync || _push_stream_sync_tlv(tb))
+      && (!buckets || tlv_put(tb, HNCP_T_REQ_BUCKETS, &rb, sizeof(rb))))
+    {
+      L_DEBUG("hncp_link_send_req_network_state -> %s%%" HNCP_LINK_F,
+              ADDR_REPR(dst), HNCP_LINK_D(l));
+      o->network_state_requests++;
+      if (buckets)
+        o->network_state_bucket_requests++;
+      hncp_io_sendto(l, tlv_data(tb->head), tlv_len(tb->head), dst);
+    }
+  hncp_put_send_buf(o, tb);
+}
+
+void hncp_link_send_req_network_state(hncp_link l,
+                                      struct in6_addr *dst)
+{
+  _send_req_network_state(l, dst, 0);
+}
+
+void hncp_link_send_keepalive(hncp_link l)
+{
+  hncp o = l->hncp;
+  hnetd_time_t now = hncp_time(o);
+  hnetd_time_t heard_after = now - l->conf->ping_worried_t;
+  hncp_t_keepalive_header kh;
+  hncp_t_keepalive_neighbor kn;
+  hncp_neighbor ne;
+  struct tlv_buf *tb;
+  struct tlv_attr *a;
+  int i = 0, n = 0, max;
+
+  hncp_calculate_network_hash(o);
+  if (!(tb = hncp_get_send_buf(o, HNCP_MAXIMUM_MULTICAST_SIZE)))
+    return;
+  if (!_push_link_id_tlv(tb, l)
+      || !_push_network_state_tlv(tb, o)
+      || (o->stream_sync && !_push_stream_sync_tlv(tb)))
+    goto done;
+
+  /* Neighbors that do not fit are left to unicast pings. */
+  max = ((int)HNCP_MAXIMUM_MULTICAST_SIZE - (int)tlv_len(tb->head)
+         - (int)sizeof(struct tlv_attr) - (int)sizeof(*kh)) / sizeof(*kn);
+  vlist_for_each_element(&l->neighbors, ne, in_neighbors)
+    if (ne->last_heard >= heard_after)
+      n++;
+  if (n > max)
+    n = max;
+  if (n < 0 || !(a = tlv_new(tb, HNCP_T_KEEPALIVE,
+                             sizeof(*kh) + n * sizeof(*kn))))
+    goto done;
+  kh = tlv_data(a);
+  kh->version = cpu_to_be32(HNCP_KEEPALIVE_VERSION);
+  kn = (hncp_t_keepalive_neighbor)(kh + 1);
+  vlist_for_each_element(&l->neighbors, ne, in_neighbors)
+    if (ne->last_heard >= heard_after && i < n)
+      {
+        memcpy(kn[i].node_identifier_hash64, &ne->node_identifier_hash,
+               HNCP_HASH64_LEN);
+        kn[i].link_id = cpu_to_be32(ne->iid);
+        i++;
+      }
+  L_DEBUG("hncp_link_send_keepalive %d neighbors -> " HNCP_LINK_F,
+          n, HNCP_LINK_D(l));
+  l->last_keepalive = now;
+  o->keepalives_sent++;
+  hncp_io_sendto(l, tlv_data(tb->head), tlv_len(tb->head),
+                 &o->multicast_address);
+ done:
+  hncp_put_send_buf(o, tb);
+}
+
+static int _compare_hash_p(const void *a, const void *b)
+{
+  return memcmp(*(hncp_hash *)a, *(hncp_hash *)b, HNCP_HASH_LEN);
+}
+
+/* Fill in NODE_DATA_BASE for the node data we have of h, if we
+ * want a delta against it. */
+static bool _node_data_base(hncp o, hncp_hash h, hncp_t_node_data_base b)
+{
+  hncp_node n;
+
+  if (!o->delta_sync)
+    return false;
+  n = hncp_find_node_by_hash(o, h, false);
+  if (!n || !n->tlv_container || n->node_data_delta_failed)
+    return false;
+  hncp_calculate_node_data_hash(n);
+  b->node_identifier_hash = n->node_identifier_hash;
+  b->update_number = cpu_to_be32(n->update_number);
+  b->node_data_hash = n->node_data_hash;
+  return true;
+}
+
+static void _send_req_node_data(hncp_link l, struct in6_addr *dst,
+                                hncp_hash *h, hncp_t_node_data_base_s *b,
+                                bool *has_base, int n)
+{
+  hncp o = l->hncp;
+  struct tlv_buf *tb;
+  int i;
+
+  tb = hncp_get_send_buf(o, n * (2 * TLV_SIZE + HNCP_HASH_LEN
+                                 + sizeof(*b)) + 64);
+  if (!tb)
+    return;
+  if (!_push_link_id_tlv(tb, l))
+    goto out;
+  for (i = 0 ; i < n ; i++)
+    if (!tlv_put(tb, HNCP_T_REQ_NODE_DATA, h[i], HNCP_HASH_LEN))
+      goto out;
+  if (o->bulk_sync && !_push_bulk_sync_tlv(tb))
+    goto out;
+  for (i = 0 ; i < n ; i++)
+    if (has_base[i]
+        && !tlv_put(tb, HNCP_T_NODE_DATA_BASE, &b[i], sizeof(b[i])))
+      goto out;
+  if (o->stream_sync && !_push_stream_sync_tlv(tb))
+    goto out;
+  L_DEBUG("hncp_link_send_req_node_data %d -> %s%%" HNCP_LINK_F,
+          n, ADDR_REPR(dst), HNCP_LINK_D(l));
+  hncp_io_sendto(l, tlv_data(tb->head), tlv_len(tb->head), dst);
+ out:
+  hncp_put_send_buf(o, tb);
+}
+
+/* Request the node data of the given nodes in one message (or more,
+ * if the NODE_DATA_BASE TLVs do not fit in HNCP_BULK_SYNC_SIZE). */
+void hncp_link_send_req_node_data(hncp_link l,
+                                  struct in6_addr *dst,
+                                  hncp_hash *h, int n)
+{
+  hncp_t_node_data_base_s b[n];
+  bool has_base[n];
+  size_t len0 = 3 * TLV_SIZE + sizeof(hncp_t_link_id_s)
+    + sizeof(hncp_t_bulk_sync_s) + sizeof(hncp_t_stream_sync_s);
+  size_t len = len0, s;
+  int i, first = 0;
+
+  /* Keep the TLVs in order. */
+  if (n > 1)
+    qsort(h, n, sizeof(*h), _compare_hash_p);
+  for (i = 0 ; i < n ; i++)
+    {
+      has_base[i] = _node_data_base(l->hncp, h[i], &b[i]);
+      s = TLV_SIZE + HNCP_HASH_LEN
+        + (has_base[i] ? TLV_SIZE + sizeof(b[i]) : 0);
+      if (i > first && len + s > HNCP_BULK_SYNC_SIZE)
+        {
+          _send_req_node_data(l, dst, h + first, b + first, has_base + first,
+                              i - first);
+          first = i;
+          len = len0;
+        }
+      len += s;
+    }
+  if (n > first)
+    _send_req_node_data(l, dst, h + first, b + first, has_base + first,
+                        n - first);
+}
+
+static int _compare_node_state_p(const void *a, const void *b)
+{
+  hncp_node_data_reply r1 = *(hncp_node_data_reply *)a;
+  hncp_node_data_reply r2 = *(hncp_node_data_reply *)b;
+
+  return memcmp(&r1->node_state_header, &r2->node_state_header,
+                TLV_SIZE + sizeof(r1->node_state));
+}
+
+static int _compare_node_data_p(const void *a, const void *b)
+{
+  hncp_node_data_reply r1 = *(hncp_node_data_reply *)a;
+  hncp_node_data_reply r2 = *(hncp_node_data_reply *)b;
+
+  return memcmp(&r1->node_data_header, &r2->node_data_header,
+                TLV_SIZE + sizeof(r1->node_data));
+}
+
+/* Send the node state and node data of several nodes in one
+ * message; all NODE_STATE TLVs first, then all NODE_DATA TLVs, both
+ * in order. */
+static void _send_node_data_bulk(hncp_link l,
+                                 struct in6_addr *dst,
+                                 hncp_node_data_reply *r, int n)
+{
+  hncp_link_id_tlv_s lid;
+  struct iovec iov[1 + 3 * HNCP_BULK_SYNC_MAX_REPLIES];
+  hncp_node node;
+  int i, c = 0, s;
+
+  _init_link_id_tlv(&lid, l);
+  iov[c].iov_base = &lid;
+  iov[c++].iov_len = sizeof(lid);
+  qsort(r, n, sizeof(*r), _compare_node_state_p);
+  for (i = 0 ; i < n ; i++)
+    {
+      iov[c].iov_base = &r[i]->node_state_header;
+      iov[c++].iov_len = TLV_SIZE + sizeof(r[i]->node_state);
+    }
+  qsort(r, n, sizeof(*r), _compare_node_data_p);
+  for (i = 0 ; i < n ; i++)
+    {
+      node = container_of(r[i], hncp_node_s, node_data_reply);
+      s = node->tlv_container ? tlv_len(node->tlv_container) : 0;
+      iov[c].iov_base = &r[i]->node_data_header;
+      iov[c++].iov_len = TLV_SIZE + sizeof(r[i]->node_data);
+      if (s)
+        {
+          iov[c].iov_base = tlv_data(node->tlv_container);
+          iov[c++].iov_len = s;
+        }
+    }
+  L_DEBUG("_send_node_data_bulk %d -> %s%%" HNCP_LINK_F,
+          n, ADDR_REPR(dst), HNCP_LINK_D(l));
+  _send_reply(l, dst, iov, c);
+}
+
+/* Reply to REQ_NODE_DATA for several nodes, packing as many of them
+ * per message as fit HNCP_BULK_SYNC_SIZE. */
+static void _send_node_data_packed(hncp_link l,
+                                   struct in6_addr *dst,
+                                   hncp_node *nodes, int n)
+{
+  hncp_node_data_reply r[HNCP_BULK_SYNC_MAX_REPLIES];
+  hnetd_time_t now = hncp_time(l->hncp);
+  size_t len = sizeof(hncp_link_id_tlv_s), s;
+  int i, c = 0;
+
+  for (i = 0 ; i < n ; i++)
+    {
+      s = sizeof(hncp_node_data_reply_s)
+        + (nodes[i]->tlv_container ? tlv_len(nodes[i]->tlv_container) : 0);
+      if (c && (c == HNCP_BULK_SYNC_MAX_REPLIES
+                || len + s > HNCP_BULK_SYNC_SIZE))
+        {
+          _send_node_data_bulk(l, dst, r, c);
+          c = 0;
+          len = sizeof(hncp_link_id_tlv_s);
+        }
+      r[c] = _node_data_reply(nodes[i]);
+      r[c++]->node_state.ms_since_origination =
+        cpu_to_be32(now - nodes[i]->origination_time);
+      len += s;
+    }
+  if (c)
+    _send_node_data_bulk(l, dst, r, c);
+}
+
+typedef struct {
+  struct tlv_buf *tb;
+  bool failed;
+} hncp_delta_buf_s;
+
+static void _delta_put(struct tlv_attr *a, __unused bool add, void *context)
+{
+  hncp_delta_buf_s *db = context;
+
+  if (!db->failed && !tlv_put_raw(db->tb, a, tlv_pad_len(a)))
+    db->failed = true;
+}
+
+/* The NODE_DATA_BASE the requester sent for n, if any. */
+static hncp_t_node_data_base _find_node_data_base(hncp_message m, hncp_node n)
+{
+  int i;
+
+  for (i = 0 ; i < m->num_node_data_bases ; i++)
+    if (!memcmp(&m->node_data_bases[i]->node_identifier_hash,
+                &n->node_identifier_hash, HNCP_HASH_LEN))
+      return m->node_data_bases[i];
+  return NULL;
+}
+
+/* Reply to REQ_NODE_DATA of n with NODE_STATE + NODE_DATA_DELTA, if
+ * the requester has the version we kept, and the delta is smaller
+ * than the whole node data. Returns false if it was not sent. */
+static bool _send_node_data_delta(hncp_link l, struct in6_addr *dst,
+                                  hncp_node n, hncp_message m)
+{
+  hncp o = l->hncp;
+  hncp_t_node_data_base b = _find_node_data_base(m, n);
+  hncp_node_data_reply r;
+  hncp_t_node_data_delta_header dh;
+  hncp_delta_buf_s db;
+  struct iovec iov;
+  void *cookie;
+  bool sent = false;
+  int removed;
+
+  if (!b || !o->delta_sync || !n->prev_tlv_container || !n->tlv_container
+      || memcmp(&b->node_data_hash, &n->prev_node_data_hash, HNCP_HASH_LEN))
+    return false;
+  r = _node_data_reply(n);
+  r->node_state.ms_since_origination =
+    cpu_to_be32(hncp_time(o) - n->origination_time);
+  memset(&db, 0, sizeof(db));
+  db.tb = hncp_get_send_buf(o, sizeof(r->node_data)
+                            + tlv_len(n->tlv_container) + 64);
+  if (!db.tb)
+    return false;
+  if (!_push_link_id_tlv(db.tb, l)
+      || !tlv_put(db.tb, HNCP_T_NODE_STATE,
+                  &r->node_state, sizeof(r->node_state)))
+    goto out;
+  cookie = tlv_nest_start(db.tb, HNCP_T_NODE_DATA_DELTA, sizeof(*dh));
+  if (!db.tb->head)
+    goto out;
+  hncp_tlv_diff(n->prev_tlv_container, n->tlv_container, false,
+                _delta_put, &db);
+  removed = tlv_len(db.tb->head) - sizeof(*dh);
+  hncp_tlv_diff(n->prev_tlv_container, n->tlv_container, true,
+                _delta_put, &db);
+  if (db.failed
+      || tlv_len(db.tb->head) >= sizeof(r->node_data)
+      + tlv_len(n->tlv_container))
+    goto out;
+  dh = tlv_data(db.tb->head);
+  dh->node_identifier_hash = n->node_identifier_hash;
+  dh->update_number = cpu_to_be32(n->update_number);
+  dh->base_update_number = b->update_number;
+  dh->removed_length = cpu_to_be32(removed);
+  tlv_nest_end(db.tb, cookie);
+  L_DEBUG("_send_node_data_delta %s -> %s%%" HNCP_LINK_F,
+          HNCP_NODE_REPR(n), ADDR_REPR(dst), HNCP_LINK_D(l));
+  iov.iov_base = tlv_data(db.tb->head);
+  iov.iov_len = tlv_len(db.tb->head);
+  sent = _send_reply(l, dst, &iov, 1);
+ out:
+  hncp_put_send_buf(o, db.tb);
+  return sent;
+}
+
+/************************************************************ Input handling */
+
+static hncp_neighbor
+_heard(hncp_link l, hncp_t_link_id lid, struct in6_addr *src)
+{
+  hncp_neighbor_s nc;
+  hncp_neighbor n;
+  hncp o = l->hncp;
+
+  memset(&nc, 0, sizeof(nc));
+  nc.node_identifier_hash = lid->node_identifier_hash;
+  nc.iid = be32_to_cpu(lid->link_id);
+  nc.link = l;
+  n = vlist_find(&l->neighbors, &nc, &nc, in_neighbors);
+  if (!n)
+    {
+      /* new neighbor */
+      n = hncp_pool_alloc(&o->neighbor_pool);
+      if (!n)
+        return NULL;
+      *n = nc;
+      vlist_add(&l->neighbors, &n->in_neighbors, n);
+      L_DEBUG(HNCP_NEIGH_F " added on " HNCP_LINK_F,
+              HNCP_NEIGH_D(n), HNCP_LINK_D(l));
+    }
+
+  n->last_address = *src;
+  n->last_heard = hncp_time(o);
+  if (n->in_sync && n->ping_count)
+    {
+      n->ping_count = 0;
+      hncp_neighbor_schedule(n);
+    }
+  return n;
+}
+
+static bool
+_handle_collision(hncp o)
+{
+  /* XXX - consider also case where security is enabled; for now,
+   * we just handle collisions insecurely. */
+  int delta = hncp_io_time(o) - o->collisions[o->last_collision];
+  if (delta < HNCP_UPDATE_COLLISION_N)
+    {
+      L_ERR("%d hash conflicts encountered in %.3fs - changing own id",
+            HNCP_UPDATE_COLLISIONS_IN_N,
+            1.0 * delta / HNETD_TIME_PER_SECOND);
+      hncp_hash_s h;
+      int i;
+
+      for (i = 0; i < HNCP_HASH_LEN; i++)
+        h.buf[i] = random() % 256;
+      hncp_set_own_hash(o, &h);
+      return true;
+    }
+  else
+    {
+      int c = o->last_collision;
+      o->collisions[c] = hncp_io_time(o);
+      c = (c + 1) % HNCP_UPDATE_COLLISIONS_IN_N;
+      o->last_collision = c;
+    }
+  return false;
+}
+
+/* Note that we are about to request the node data described by ns
+ * from src on l. Returns false if the same (or newer) update has
+ * already been requested from someone, and we are still waiting. */
+static bool _request_node_data(hncp_link l, struct in6_addr *src,
+                               hncp_t_node_state ns)
+{
+  hncp o = l->hncp;
+  hnetd_time_t now = hncp_time(o);
+  uint32_t update_number = be32_to_cpu(ns->update_number);
+  hncp_pending_request r;
+
+  r = avl_find_element(&o->pending_requests, &ns->node_identifier_hash,
+                       r, avl);
+  if (r && r->update_number >= update_number && r->timeout > now)
+    {
+      L_DEBUG("node data request for %llx already pending",
+              hncp_hash64(&ns->node_identifier_hash));
+      o->node_data_requests_suppressed++;
+      if (r->iid != l->iid || memcmp(&r->address, src, sizeof(*src)))
+        {
+          r->has_alternate = true;
+          r->alternate_iid = l->iid;
+          r->alternate_address = *src;
+        }
+      return false;
+    }
+  if (!r)
+    {
+      r = calloc(1, sizeof(*r));
+      if (!r)
+        return true;
+      r->node_identifier_hash = ns->node_identifier_hash;
+      r->avl.key = &r->node_identifier_hash;
+      avl_insert(&o->pending_requests, &r->avl);
+      /* Make sure hncp_run knows about the timeout. */
+      hncp_schedule(o);
+    }
+  r->update_number = update_number;
+  r->timeout = now + HNCP_REQUEST_TIMEOUT;
+  r->retries = 0;
+  r->iid = l->iid;
+  r->address = *src;
+  r->has_alternate = false;
+  o->node_data_requests++;
+  return true;
+}
+
+/* Node data up to update_number has arrived. */
+static void _request_done(hncp o, hncp_hash h, uint32_t update_number)
+{
+  hncp_pending_request r;
+
+  r = avl_find_element(&o->pending_requests, h, r, avl);
+  if (!r || r->update_number > update_number)
+    return;
+  avl_delete(&o->pending_requests, &r->avl);
+  free(r);
+}
+
+hnetd_time_t hncp_run_pending_requests(hncp o)
+{
+  hnetd_time_t now, next = 0;
+  hncp_pending_request r, r2;
+  struct in6_addr a;
+  hncp_hash h;
+  hncp_link l;
+
+  if (avl_is_empty(&o->pending_requests))
+    return 0;
+  now = hncp_time(o);
+  avl_for_each_element_safe(&o->pending_requests, r, avl, r2)
+    {
+      if (r->timeout > now)
+        {
+          next = TMIN(next, r->timeout);
+          continue;
+        }
+      l = r->has_alternate && r->retries < HNCP_REQUEST_RETRIES
+        ? hncp_find_link_by_id(o, r->alternate_iid) : NULL;
+      if (!l)
+        {
+          L_DEBUG("node data request for %llx timed out",
+                  hncp_hash64(&r->node_identifier_hash));
+          avl_delete(&o->pending_requests, &r->avl);
+          free(r);
+          continue;
+        }
+      /* Ask the other one instead (and maybe the first one again,
+       * if this one does not answer either). */
+      L_DEBUG("retrying node data request for %llx on " HNCP_LINK_F,
+              hncp_hash64(&r->node_identifier_hash), HNCP_LINK_D(l));
+      a = r->address;
+      r->address = r->alternate_address;
+      r->alternate_address = a;
+      r->alternate_iid = r->iid;
+      r->iid = l->iid;
+      r->retries++;
+      r->timeout = now + HNCP_REQUEST_TIMEOUT;
+      o->node_data_requests_retried++;
+      h = &r->node_identifier_hash;
+      hncp_link_send_req_node_data(l, &r->address, &h, 1);
+      next = TMIN(next, r->timeout);
+    }
+  return next;
+}
+
+void hncp_flush_pending_requests(hncp o)
+{
+  hncp_pending_request r, r2;
+
+  avl_remove_all_elements(&o->pending_requests, r, avl, r2)
+    free(r);
+}
+
+/* Decode a received message in one pass over its TLVs. Everything
+ * the handler looks at is length-checked here, so handle_message
+ * only has to deal with the protocol logic. */
+bool hncp_message_decode(hncp_message m, void *data, ssize_t len)
+{
+  struct tlv_attr *a;
+
+  m->link_id = NULL;
+  m->network_hash = NULL;
+  m->request = NULL;
+  m->num_node_data_requests = 0;
+  m->bulk_sync_version = 0;
+  m->stream_sync_version = 0;
+  m->bucket_hashes = NULL;
+  m->req_buckets = 0;
+  m->num_node_data_bases = 0;
+  m->num_node_states = 0;
+  m->num_node_data = 0;
+  m->keepalive = NULL;
+  m->num_keepalive_neighbors = 0;
+  tlv_for_each_in_buf(a, data, len)
+    switch (tlv_id(a))
+      {
+      case HNCP_T_LINK_ID:
+        /* Error to have multiple top level link id's. */
+        if (m->link_id)
+          {
+            L_INFO("got multiple link ids - ignoring");
+            return false;
+          }
+        if (tlv_len(a) != sizeof(hncp_t_link_id_s))
+          {
+            L_INFO("got invalid sized link id - ignoring");
+            return false;
+          }
+        m->link_id = tlv_data(a);
+        break;
+      case HNCP_T_NETWORK_HASH:
+        if (tlv_len(a) != HNCP_HASH_LEN)
+          {
+            L_DEBUG("got invalid network hash length: %d", tlv_len(a));
+            return false;
+          }
+        if (m->network_hash)
+          {
+            L_DEBUG("ignoring message with multiple network hashes");
+            return false;
+          }
+        m->network_hash = tlv_data(a);
+        break;
+      case HNCP_T_NODE_STATE:
+        if (tlv_len(a) != sizeof(hncp_t_node_state_s))
+          {
+            L_INFO("invalid length node state TLV received - ignoring");
+            return false;
+          }
+        /* Cannot overflow given the payload size, but be paranoid. */
+        if (m->num_node_states == m->max_node_states)
+          {
+            L_INFO("too many node state TLVs received - ignoring");
+            return false;
+          }
+        m->node_states[m->num_node_states++] = tlv_data(a);
+        break;
+      case HNCP_T_NODE_DATA:
+        if (m->num_node_data == (int)HNCP_BULK_SYNC_MAX_REPLIES)
+          {
+            L_INFO("received too many node data TLVs, ignoring");
+            return false;
+          }
+        if (tlv_len(a) < sizeof(hncp_t_node_data_header_s))
+          {
+            L_INFO("received invalid node data TLV, ignoring");
+            return false;
+          }
+        m->node_data[m->num_node_data++] = a;
+        break;
+      case HNCP_T_NODE_DATA_DELTA:
+        if (m->num_node_data == (int)HNCP_BULK_SYNC_MAX_REPLIES)
+          {
+            L_INFO("received too many node data TLVs, ignoring");
+            return false;
+          }
+        if (tlv_len(a) < sizeof(hncp_t_node_data_delta_header_s)
+            || tlv_len(a) - sizeof(hncp_t_node_data_delta_header_s)
+            < be32_to_cpu(((hncp_t_node_data_delta_header)
+                           tlv_data(a))->removed_length))
+          {
+            L_INFO("received invalid node data delta TLV, ignoring");
+            return false;
+          }
+        m->node_data[m->num_node_data++] = a;
+        break;
+      case HNCP_T_NODE_DATA_BASE:
+        if (tlv_len(a) != sizeof(hncp_t_node_data_base_s))
+          {
+            L_INFO("got invalid sized node data base - ignoring");
+            return false;
+          }
+        if (m->num_node_data_bases == (int)HNCP_BULK_SYNC_MAX_REQUESTS)
+          {
+            L_INFO("got too many node data bases - ignoring");
+            return false;
+          }
+        m->node_data_bases[m->num_node_data_bases++] = tlv_data(a);
+        break;
+      case HNCP_T_REQ_NODE_DATA:
+        if (tlv_len(a) != HNCP_HASH_LEN)
+          return false;
+        if (m->num_node_data_requests == (int)HNCP_BULK_SYNC_MAX_REQUESTS)
+          {
+            L_INFO("got too many node data requests - ignoring");
+            return false;
+          }
+        m->node_data_requests[m->num_node_data_requests++] = tlv_data(a);
+        /* fall through */
+      case HNCP_T_REQ_NET_HASH:
+        if (!m->request)
+          m->request = a;
+        break;
+      case HNCP_T_BULK_SYNC:
+        if (tlv_len(a) < sizeof(hncp_t_bulk_sync_s))
+          {
+            L_INFO("got invalid sized bulk sync - ignoring");
+            return false;
+          }
+        m->bulk_sync_version =
+          be32_to_cpu(((hncp_t_bulk_sync)tlv_data(a))->version);
+        break;
+      case HNCP_T_STREAM_SYNC:
+        if (tlv_len(a) < sizeof(hncp_t_stream_sync_s))
+          {
+            L_INFO("got invalid sized stream sync - ignoring");
+            return false;
+          }
+        m->stream_sync_version =
+          be32_to_cpu(((hncp_t_stream_sync)tlv_data(a))->version);
+        break;
+      case HNCP_T_BUCKET_HASHES:
+        /* Another version (or bucket count) is simply not used. */
+        if (tlv_len(a) != sizeof(hncp_t_bucket_hashes_s)
+            || be32_to_cpu(((hncp_t_bucket_hashes)tlv_data(a))->version)
+            != HNCP_BUCKET_SYNC_VERSION)
+          {
+            L_DEBUG("ignoring bucket hashes of another version");
+            break;
+          }
+        m->bucket_hashes = tlv_data(a);
+        break;
+      case HNCP_T_KEEPALIVE:
+        {
+          hncp_t_keepalive_header kh = tlv_data(a);
+
+          if (tlv_len(a) < sizeof(*kh)
+              || (tlv_len(a) - sizeof(*kh))
+              % sizeof(hncp_t_keepalive_neighbor_s))
+            {
+              L_INFO("got invalid sized keepalive - ignoring");
+              return false;
+            }
+          if (be32_to_cpu(kh->version) != HNCP_KEEPALIVE_VERSION)
+            {
+              L_DEBUG("ignoring keepalive of another version");
+              break;
+            }
+          m->keepalive = kh;
+          m->keepalive_neighbors = (hncp_t_keepalive_neighbor)(kh + 1);
+          m->num_keepalive_neighbors = (tlv_len(a) - sizeof(*kh))
+            / sizeof(hncp_t_keepalive_neighbor_s);
+        }
+        break;
+      case HNCP_T_REQ_BUCKETS:
+        if (tlv_len(a) != sizeof(hncp_t_req_buckets_s))
+          {
+            L_INFO("got invalid sized bucket request - ignoring");
+            return false;
+          }
+        m->req_buckets =
+          be64_to_cpu(((hncp_t_req_buckets)tlv_data(a))->buckets);
+        break;
+      }
+  if (!m->link_id)
+    {
+      L_INFO("did not get link ids - ignoring");
+      return false;
+    }
+  return true;
+}
+
+/* The neighbor has shown it hears us (not just that we hear it). */
+static void _neighbor_responded(hncp_neighbor ne)
+{
+  hncp o = ne->link->hncp;
+
+  if (!ne->last_response)
+    {
+      o->links_dirty = true;
+      hncp_schedule(o);
+    }
+  ne->last_response = hncp_time(o);
+  ne->ping_count = 0;
+  hncp_neighbor_schedule(ne);
+}
+
+/* Being listed in a multicast keepalive is as good as a reply to a
+ * ping. Answer with one of our own (unless we just sent one), so that
+ * the sender learns the same about us. */
+static void _handle_keepalive(hncp_link l, hncp_neighbor ne,
+                              hncp_message m)
+{
+  hncp o = l->hncp;
+  hncp_t_keepalive_neighbor kn;
+  int i;
+
+  for (i = 0; i < m->num_keepalive_neighbors; i++)
+    {
+      kn = &m->keepalive_neighbors[i];
+      if (be32_to_cpu(kn->link_id) == l->iid
+          && !memcmp(kn->node_identifier_hash64,
+                     &o->own_node->node_identifier_hash,
+                     HNCP_HASH64_LEN))
+        {
+          L_DEBUG("listed in keepalive of " HNCP_NEIGH_F " on " HNCP_LINK_F,
+                  HNCP_NEIGH_D(ne), HNCP_LINK_D(l));
+          _neighbor_responded(ne);
+          break;
+        }
+    }
+  if (o->multicast_keepalive
+      && hncp_time(o) - l->last_keepalive >= HNCP_KEEPALIVE_MIN_INTERVAL)
+    hncp_link_send_keepalive(l);
+}
+
+/* Is the node something we can give the node data of? */
+static bool _can_send_node_data(hncp o, hncp_node n)
+{
+  if (n == o->own_node)
+    return true;
+  if (o->graph_dirty)
+    {
+      L_DEBUG("prune pending, ignoring node data request");
+      return false;
+    }
+  if (n->last_reachable_prune != o->last_prune)
+    {
+      L_DEBUG("not reachable request, ignoring");
+      return false;
+    }
+  return true;
+}
+
+static void
+_handle_request(hncp_link l, struct in6_addr *src, hncp_message m)
+{
+  hncp o = l->hncp;
+  hncp_node nodes[HNCP_BULK_SYNC_MAX_REQUESTS];
+  hncp_node n;
+  int i, c = 0;
+
+  if (tlv_id(m->request) == HNCP_T_REQ_NET_HASH)
+    {
+      o->network_state_replies++;
+      o->network_state_reply_bytes +=
+        _send_network_state(l, src, 0, m->req_buckets);
+      return;
+    }
+  for (i = 0 ; i < m->num_node_data_requests ; i++)
     {
-      L_DEBUG("hncp_link_send_node_state %s -> %s%%" HNCP_LINK_F,
-              HNCP_NODE_REPR(n), ADDR_REPR(dst), HNCP_LINK_D(l));
-      hncp_io_sendto(l->hncp, tlv_data(tb.head), tlv_len(tb.head),
-                     l->ifname, dst);
+      n = hncp_find_node_by_hash(o, m->node_data_requests[i], false);
+      if (n && _can_send_node_data(o, n)
+          && !_send_node_data_delta(l, src, n, m))
+        nodes[c++] = n;
     }
-  tlv_buf_free(&tb);
+  if (c > 1 && _bulk_sync_version(o, m->bulk_sync_version))
+    {
+      _send_node_data_packed(l, src, nodes, c);
+      return;
+    }
+  for (i = 0 ; i < c ; i++)
+    hncp_link_send_node_data(l, src, nodes[i]);
 }
 
-void hncp_link_send_req_network_state(hncp_link l,
-                                      struct in6_addr *dst)
+static struct tlv_attr *_delta_tlv(struct tlv_attr *a, void *end, bool *ok)
 {
-  struct tlv_buf tb;
-
-  memset(&tb, 0, sizeof(tb));
-  tlv_buf_init(&tb, 0); /* not passed anywhere */
-  if (_push_link_id_tlv(&tb, l)
-      && tlv_new(&tb, HNCP_T_REQ_NET_HASH, 0))
+  if ((void *)a >= end)
+    return NULL;
+  if (end - (void *)a < (int)TLV_SIZE || tlv_raw_len(a) < TLV_SIZE
+      || end - (void *)a < (int)tlv_pad_len(a))
     {
-      L_DEBUG("hncp_link_send_req_network_state -> %s%%" HNCP_LINK_F,
-              ADDR_REPR(dst), HNCP_LINK_D(l));
-      hncp_io_sendto(l->hncp, tlv_data(tb.head), tlv_len(tb.head),
-                     l->ifname, dst);
+      *ok = false;
+      return NULL;
     }
-  tlv_buf_free(&tb);
+  return a;
 }
 
-void hncp_link_send_req_node_data(hncp_link l,
-                                  struct in6_addr *dst,
-                                  hncp_t_node_state ns)
+/* Put the current node data of n, minus the removed and plus the
+ * added TLVs of NODE_DATA_DELTA a, in tb. The result is only good if
+ * it has the hash the sender says it has. */
+static bool _apply_node_data_delta(struct tlv_buf *tb, hncp_node n,
+                                   hncp_t_node_state ns, struct tlv_attr *a)
 {
-  struct tlv_buf tb;
-  struct tlv_attr *a;
+  hncp_t_node_data_delta_header dh = tlv_data(a);
+  void *rp_end = (void *)(dh + 1) + be32_to_cpu(dh->removed_length);
+  void *ap_end = tlv_data(a) + tlv_len(a);
+  void *op_end;
+  struct tlv_attr *op, *rp, *ap, *p;
+  hncp_hash_s h;
+  bool ok = true;
 
-  memset(&tb, 0, sizeof(tb));
-  tlv_buf_init(&tb, 0); /* not passed anywhere */
-  if (_push_link_id_tlv(&tb, l)
-      && (a = tlv_new(&tb, HNCP_T_REQ_NODE_DATA, HNCP_HASH_LEN)))
+  if (!n->tlv_container
+      || be32_to_cpu(dh->base_update_number) != n->update_number)
+    return false;
+  op_end = tlv_data(n->tlv_container) + tlv_len(n->tlv_container);
+  op = _delta_tlv(tlv_data(n->tlv_container), op_end, &ok);
+  rp = _delta_tlv((struct tlv_attr *)(dh + 1), rp_end, &ok);
+  ap = _delta_tlv(rp_end, ap_end, &ok);
+  /* Same walk as hncp_tlv_diff, in reverse: drop the TLVs that are
+   * both in the old data and removed, and merge in the added ones. */
+  while (ok && (op || ap))
     {
-      L_DEBUG("hncp_link_send_req_node_state -> %s%%" HNCP_LINK_F,
-              ADDR_REPR(dst), HNCP_LINK_D(l));
-      memcpy(tlv_data(a), &ns->node_identifier_hash, HNCP_HASH_LEN);
-      hncp_io_sendto(l->hncp, tlv_data(tb.head), tlv_len(tb.head),
-                     l->ifname, dst);
+      if (op && rp && !tlv_attr_cmp(op, rp))
+        {
+          op = _delta_tlv(tlv_next(op), op_end, &ok);
+          rp = _delta_tlv(tlv_next(rp), rp_end, &ok);
+          continue;
+        }
+      if (op && (!ap || tlv_attr_cmp(op, ap) < 0))
+        {
+          /* Removing something we do not have? */
+          if (rp && tlv_attr_cmp(rp, op) < 0)
+            return false;
+          p = op;
+          op = _delta_tlv(tlv_next(op), op_end, &ok);
+        }
+      else
+        {
+          /* Adding something we already have? */
+          if (op && !tlv_attr_cmp(op, ap))
+            return false;
+          p = ap;
+          ap = _delta_tlv(tlv_next(ap), ap_end, &ok);
+        }
+      if (!tlv_put_raw(tb, p, tlv_pad_len(p)))
+        return false;
     }
-  tlv_buf_free(&tb);
+  if (!ok || rp)
+    return false;
+  hncp_calculate_node_data_hash_of(&n->node_identifier_hash,
+                                   be32_to_cpu(ns->update_number),
+                                   tb->head, &h);
+  return !memcmp(&h, &ns->node_data_hash, HNCP_HASH_LEN);
 }
 
-/************************************************************ Input handling */
-
-static hncp_neighbor
-_heard(hncp_link l, hncp_t_link_id lid, struct in6_addr *src)
+/* Handle NODE_STATE + NODE_DATA (or NODE_DATA_DELTA) TLV pair of a
+ * node. Returns false if the rest of the message should not be
+ * looked at. */
+static bool
+_handle_node_data(hncp_link l, struct in6_addr *src,
+                  hncp_t_node_state ns, struct tlv_attr *a)
 {
-  hncp_neighbor_s nc;
-  hncp_neighbor n;
   hncp o = l->hncp;
+  hncp_t_node_data_header nd = tlv_data(a);
+  unsigned char *nd_data = (unsigned char *)nd + sizeof(*nd);
+  int nd_len = tlv_len(a) - sizeof(*nd);
+  hncp_node n;
+  struct tlv_buf tb;
+  uint32_t new_update_number;
 
-  memset(&nc, 0, sizeof(nc));
-  nc.node_identifier_hash = lid->node_identifier_hash;
-  nc.iid = be32_to_cpu(lid->link_id);
-  n = vlist_find(&l->neighbors, &nc, &nc, in_neighbors);
+  /* Is it actually valid? Should be same update #. */
+  if (ns->update_number != nd->update_number)
+    {
+      L_INFO("node data and state update number mismatch, ignoring");
+      return true;
+    }
+  new_update_number = be32_to_cpu(ns->update_number);
+  o->node_data_received++;
+  o->node_data_received_bytes += tlv_raw_len(a);
+  /* Let's see if it's more recent. */
+  n = hncp_find_node_by_hash(o, &ns->node_identifier_hash, true);
   if (!n)
+    return true;
+  if (new_update_number < n->update_number
+      || (n->update_number == new_update_number
+          && !memcmp(&n->node_data_hash,
+                     &ns->node_data_hash,
+                     sizeof(n->node_data_hash))))
     {
-      /* new neighbor */
-      n = malloc(sizeof(nc));
-      if (!n)
-        return NULL;
-      *n = nc;
-      vlist_add(&l->neighbors, &n->in_neighbors, n);
-      L_DEBUG(HNCP_NEIGH_F " added on " HNCP_LINK_F,
-              HNCP_NEIGH_D(n), HNCP_LINK_D(l));
+      L_DEBUG("received update number %d, but already have %d",
+              new_update_number, n->update_number);
+      o->node_data_duplicates++;
+      o->node_data_duplicate_bytes += tlv_raw_len(a);
+      /* What we have is as good as what we asked for. */
+      _request_done(o, &n->node_identifier_hash, n->update_number);
+      return true;
     }
-
-  n->last_address = *src;
-  n->last_heard = hncp_time(o);
-  if (n->in_sync)
-    n->ping_count = 0;
-  return n;
-}
-
-static bool
-_handle_collision(hncp o)
-{
-  /* XXX - consider also case where security is enabled; for now,
-   * we just handle collisions insecurely. */
-  int delta = hncp_io_time(o) - o->collisions[o->last_collision];
-  if (delta < HNCP_UPDATE_COLLISION_N)
+  assert(new_update_number >= n->update_number);
+  if (hncp_node_is_self(n))
     {
-      L_ERR("%d hash conflicts encountered in %.3fs - changing own id",
-            HNCP_UPDATE_COLLISIONS_IN_N,
-            1.0 * delta / HNETD_TIME_PER_SECOND);
-      hncp_hash_s h;
-      int i;
+      L_DEBUG("received %d update number from network, own %d",
+              new_update_number, n->update_number);
+      if (_handle_collision(o))
+        return false;
+      n->update_number = new_update_number;
+      n->node_data_hash_dirty = true;
+      hncp_invalidate_network_hash(o, n);
+      o->republish_tlvs = true;
+      hncp_schedule(o);
+      return true;
+    }
+  /* Ok. nd contains more recent TLV data than what we have
+   * already. Woot. */
+  memset(&tb, 0, sizeof(tb));
+  /* not passed anywhere */
+  tlv_buf_init_size(&tb, 0, TLV_SIZE + nd_len);
+  if (tlv_id(a) == HNCP_T_NODE_DATA_DELTA)
+    {
+      if (!_apply_node_data_delta(&tb, n, ns, a))
+        {
+          hncp_hash h = &ns->node_identifier_hash;
 
-      for (i = 0; i < HNCP_HASH_LEN; i++)
-        h.buf[i] = random() % 256;
-      hncp_set_own_hash(o, &h);
+          L_INFO("node data delta for %s did not apply, asking for all",
+                 HNCP_NODE_REPR(n));
+          tlv_buf_free(&tb);
+          o->node_data_delta_failures++;
+          n->node_data_delta_failed = true;
+          /* Replaced by the request for all of it. */
+          _request_done(o, h, new_update_number);
+          if (_request_node_data(l, src, ns))
+            hncp_link_send_req_node_data(l, src, &h, 1);
+          return true;
+        }
+      o->node_data_deltas++;
+    }
+  else if (!tlv_put_raw(&tb, nd_data, nd_len))
+    {
+      L_DEBUG("tlv_put_raw failed");
+      tlv_buf_free(&tb);
       return true;
     }
   else
     {
-      int c = o->last_collision;
-      o->collisions[c] = hncp_io_time(o);
-      c = (c + 1) % HNCP_UPDATE_COLLISIONS_IN_N;
-      o->last_collision = c;
+      hncp_hash_s h;
+
+      /* Verify the data once here; from then on the hash stands for
+       * it (deltas were already verified above). */
+      hncp_calculate_node_data_hash_of(&n->node_identifier_hash,
+                                       new_update_number, tb.head, &h);
+      if (memcmp(&h, &ns->node_data_hash, HNCP_HASH_LEN))
+        {
+          L_INFO("node data for %s does not match its hash, ignoring",
+                 HNCP_NODE_REPR(n));
+          tlv_buf_free(&tb);
+          o->node_data_hash_mismatches++;
+          return true;
+        }
     }
-  return false;
+  n->node_data_delta_failed = false;
+  hncp_node_set_hashed(n, new_update_number,
+                       hncp_time(o) - be32_to_cpu(ns->ms_since_origination),
+                       tb.head, &ns->node_data_hash);
+  _request_done(o, &n->node_identifier_hash, new_update_number);
+  return true;
 }
 
-/* Handle a single received message. */
+/* Buckets whose hashes differ from ours; 0 (= ask for all) if the
+ * message has none, or we do not use them. */
+static uint64_t _differing_buckets(hncp o, hncp_message m)
+{
+  uint64_t buckets = 0;
+  int i;
+
+  if (!o->bucket_sync || !m->bucket_hashes)
+    return 0;
+  hncp_calculate_bucket_hashes(o);
+  for (i = 0 ; i < HNCP_BUCKETS ; i++)
+    if (memcmp(m->bucket_hashes->hashes[i], &o->bucket_hashes[i],
+               HNCP_HASH64_LEN))
+      buckets |= 1ULL << i;
+  return buckets;
+}
+
+/* Handle a single decoded message. */
 static void
-handle_message(hncp_link l,
-               struct in6_addr *src,
-               unsigned char *data, ssize_t len,
-               bool multicast)
+_handle_message(hncp_link l,
+                struct in6_addr *src,
+                hncp_message m,
+                bool multicast)
 {
   hncp o = l->hncp;
-  struct tlv_attr *a;
   hncp_node n;
-  hncp_t_link_id lid = NULL;
-  unsigned char *nethash = NULL;
-  int nodestates = 0;
   hncp_neighbor ne = NULL;
   hncp_t_node_state ns;
   hncp_t_node_data_header nd;
-  unsigned char *nd_data = NULL;
-  int nd_len = 0;
-  struct tlv_buf tb;
   uint32_t new_update_number;
-
-  /* Validate that link id exists. */
-  tlv_for_each_in_buf(a, data, len)
-    if (tlv_id(a) == HNCP_T_LINK_ID)
-      {
-        /* Error to have multiple top level link id's. */
-        if (lid)
-          {
-            L_INFO("got multiple link ids - ignoring");
-            return;
-          }
-        if (tlv_len(a) != sizeof(*lid))
-          {
-            L_INFO("got invalid sized link id - ignoring");
-            return;
-          }
-        lid = tlv_data(a);
-      }
-
-  if (!lid)
-    {
-      L_INFO("did not get link ids - ignoring");
-      return;
-    }
+  hncp_hash reqs[HNCP_BULK_SYNC_MAX_REQUESTS];
+  int i, j, nreqs = 0;
+  bool bulk;
 
   /* We cannot simply ignore same node identifier; it might be someone
    * with duplicated node identifier (hash). If we don't react in some way,
    * it's possible (local) node id collisions stick around forever.
    * However, we can't add them to neighbors so we don't do _heard here. */
-  if (memcmp(&lid->node_identifier_hash,
+  if (memcmp(&m->link_id->node_identifier_hash,
              &o->own_node->node_identifier_hash,
              HNCP_HASH_LEN) != 0)
     {
-      ne = _heard(l, lid, src);
+      ne = _heard(l, m->link_id, src);
       if (!ne)
         return;
+      /* Network states and requests say whether the sender wants
+       * replies that are too large for a datagram streamed. */
+      if (m->network_hash || m->request)
+        ne->stream_sync_version = m->stream_sync_version;
+      if (m->keepalive && multicast)
+        _handle_keepalive(l, ne, m);
     }
 
-  /* Estimates what's in the payload + handles the few
-   * request messages we support. */
-  tlv_for_each_in_buf(a, data, len)
+  /* Handle the few request messages we support. */
+  if (m->request)
     {
-      switch (tlv_id(a))
-        {
-        case HNCP_T_NETWORK_HASH:
-          if (tlv_len(a) != HNCP_HASH_LEN)
-            {
-              L_DEBUG("got invalid network hash length: %d", tlv_len(a));
-              return;
-            }
-          if (nethash)
-            {
-              L_DEBUG("ignoring message with multiple network hashes");
-              return;
-            }
-          nethash = tlv_data(a);
-          break;
-        case HNCP_T_NODE_STATE:
-          nodestates++;
-          break;
-        case HNCP_T_REQ_NET_HASH:
-          /* Ignore if in multicast. */
-          if (multicast)
-            {
-              L_INFO("ignoring req-net-hash in multicast");
-              return;
-            }
-          hncp_link_send_network_state(l, src, 0);
-          return;
-        case HNCP_T_REQ_NODE_DATA:
-          /* Ignore if in multicast. */
-          if (multicast)
-            {
-              L_INFO("ignoring req-net-hash in unicast");
-              return;
-            }
-          if (tlv_len(a) != HNCP_HASH_LEN)
-            return;
-
-          n = hncp_find_node_by_hash(o, tlv_data(a), false);
-          if (n)
-            {
-              if (n != o->own_node)
-                {
-                  if (o->graph_dirty)
-                    {
-                      L_DEBUG("prune pending, ignoring node data request");
-                      return;
-                    }
-
-                  if (n->last_reachable_prune != o->last_prune)
-                    {
-                      L_DEBUG("not reachable request, ignoring");
-                      return;
-                    }
-                }
-              hncp_link_send_node_data(l, src, n);
-            }
-          return;
-        }
+      /* Ignore if in multicast. */
+      if (multicast)
+        L_INFO("ignoring request in multicast");
+      else
+        _handle_request(l, src, m);
+      return;
     }
 
   /* Requests were handled above. So what's left is response
@@ -370,15 +1441,9 @@ handle_message(hncp_link l,
    * recently. */
   if (!multicast && ne)
     {
-      if (!ne->last_response)
-        {
-          o->links_dirty = true;
-          hncp_schedule(o);
-        }
       L_DEBUG("unicast received from " HNCP_NEIGH_F " on " HNCP_LINK_F,
               HNCP_NEIGH_D(ne), HNCP_LINK_D(l));
-      ne->last_response = hncp_time(o);
-      ne->ping_count = 0;
+      _neighbor_responded(ne);
     }
 
   /* Three different cases to be handled for solicited/unsolicited responses:
@@ -386,10 +1451,10 @@ handle_message(hncp_link l,
      - network hash + node states
      - node state + node data
   */
-  if (nethash)
+  if (m->network_hash)
     {
       /* We don't care, if network hash state IS same. */
-      if (memcmp(nethash, &o->network_hash, HNCP_HASH_LEN) == 0)
+      if (memcmp(m->network_hash, &o->network_hash, HNCP_HASH_LEN) == 0)
         {
           L_DEBUG("received network state which is consistent");
 
@@ -410,60 +1475,64 @@ handle_message(hncp_link l,
           /* may cause us to get worried sooner */
           hncp_schedule(o);
           ne->in_sync = false;
+          hncp_neighbor_schedule(ne);
         }
 
       if (multicast)
         {
           /* Reset trickle on the link */
           L_DEBUG("received inconsistent multicast network state %s != %s",
-                  HEX_REPR(nethash, HNCP_HASH_LEN),
+                  HEX_REPR(m->network_hash, HNCP_HASH_LEN),
                   HEX_REPR(&o->network_hash, HNCP_HASH_LEN));
           hncp_link_reset_trickle(l);
         }
 
-      /* Short form (raw network hash) */
-      if (!nodestates)
+      /* Short form (raw network hash, perhaps with bucket hashes) */
+      if (!m->num_node_states)
         {
           if (multicast)
-            hncp_link_send_req_network_state(l, src);
+            _send_req_network_state(l, src, _differing_buckets(o, m));
           else
             L_INFO("unicast short form network status received - ignoring");
           return;
         }
       /* Long form (has node states). */
       /* The exercise becomes just to ask for any node state that
-       * differs from local and is more recent. */
-      tlv_for_each_in_buf(a, data, len)
-        if (tlv_id(a) == HNCP_T_NODE_STATE)
-          {
-            if (tlv_len(a) != sizeof(hncp_t_node_state_s))
-              {
-                L_INFO("invalid length node state TLV received - ignoring");
-                return;
-              }
-            ns = tlv_data(a);
-            n = hncp_find_node_by_hash(o, &ns->node_identifier_hash, false);
-            new_update_number = be32_to_cpu(ns->update_number);
-            bool interesting = !n
-              || (new_update_number > n->update_number
-                  || (new_update_number == n->update_number
-                      && memcmp(&n->node_data_hash,
-                                &ns->node_data_hash,
-                                sizeof(n->node_data_hash)) != 0));
-            if (interesting)
-              {
-                L_DEBUG("saw something new for %llx/%p (update number %d)",
-                        hncp_hash64(&ns->node_identifier_hash),
-                        n, new_update_number);
-                hncp_link_send_req_node_data(l, src, ns);
-              }
-            else
-              {
-                L_DEBUG("saw something old for %llx/%p (update number %d)",
-                        hncp_hash64(&ns->node_identifier_hash),
-                        n, new_update_number);
-              }
-          }
+       * differs from local and is more recent. If the peer supports
+       * it, the requests are packed together. */
+      bulk = _bulk_sync_version(o, m->bulk_sync_version) > 0;
+      for (i = 0 ; i < m->num_node_states ; i++)
+        {
+          ns = m->node_states[i];
+          n = hncp_find_node_by_hash(o, &ns->node_identifier_hash, false);
+          new_update_number = be32_to_cpu(ns->update_number);
+          bool interesting = !n
+            || (new_update_number > n->update_number
+                || (new_update_number == n->update_number
+                    && memcmp(&n->node_data_hash,
+                              &ns->node_data_hash,
+                              sizeof(n->node_data_hash)) != 0));
+          if (interesting && _request_node_data(l, src, ns))
+            {
+              L_DEBUG("saw something new for %llx/%p (update number %d)",
+                      hncp_hash64(&ns->node_identifier_hash),
+                      n, new_update_number);
+              reqs[nreqs++] = &ns->node_identifier_hash;
+              if (!bulk || nreqs == (int)HNCP_BULK_SYNC_MAX_REQUESTS)
+                {
+                  hncp_link_send_req_node_data(l, src, reqs, nreqs);
+                  nreqs = 0;
+                }
+            }
+          else if (!interesting)
+            {
+              L_DEBUG("saw something old for %llx/%p (update number %d)",
+                      hncp_hash64(&ns->node_identifier_hash),
+                      n, new_update_number);
+            }
+        }
+      if (nreqs)
+        hncp_link_send_req_node_data(l, src, reqs, nreqs);
       return;
     }
   /* We don't accept node data via multicast. */
@@ -473,118 +1542,82 @@ handle_message(hncp_link l,
       return;
     }
 
-  /* Look for node state + node data. */
-  ns = NULL;
-  nd = NULL;
-  tlv_for_each_in_buf(a, data, len)
-    switch(tlv_id(a))
-      {
-      case HNCP_T_NODE_STATE:
-        if (ns)
-          {
-            L_INFO("received multiple node state TLVs, ignoring");
-            return;
-          }
-        if (tlv_len(a) != sizeof(hncp_t_node_state_s))
-          {
-            L_INFO("received invalid node state TLVs, ignoring");
-            return;
-          }
-        ns = tlv_data(a);
-        break;
-      case HNCP_T_NODE_DATA:
-        if (nd)
-          {
-            L_INFO("received multiple node data TLVs, ignoring");
-            return;
-          }
-        nd_len = tlv_len(a) - sizeof(hncp_t_node_data_header_s);
-        if (nd_len < 0)
-          {
-            L_INFO("received invalid node data TLV, ignoring");
-            return;
-          }
-        nd = tlv_data(a);
-        nd_data = (unsigned char *)nd + sizeof(hncp_t_node_data_header_s);
-        break;
-      }
-  if (!ns || !nd)
+  /* Look for node state + node data; there may be several of both
+   * in bulk replies. */
+  if (!m->num_node_states || !m->num_node_data)
     {
       L_INFO("node data or node state TLV missing, ignoring");
       return;
     }
-  /* If they're for different nodes, not interested. */
-  if (memcmp(&ns->node_identifier_hash, &nd->node_identifier_hash, HNCP_HASH_LEN))
-    {
-      L_INFO("node data and state identifier mismatch, ignoring");
-      return;
-    }
-  /* Is it actually valid? Should be same update #. */
-  if (ns->update_number != nd->update_number)
-    {
-      L_INFO("node data and state update number mismatch, ignoring");
-      return;
-    }
-  /* Let's see if it's more recent. */
-  n = hncp_find_node_by_hash(o, &ns->node_identifier_hash, true);
-  if (!n)
-    return;
-  new_update_number = be32_to_cpu(ns->update_number);
-  if (new_update_number < n->update_number
-      || (n->update_number == new_update_number
-          && !memcmp(&n->node_data_hash,
-                     &ns->node_data_hash,
-                     sizeof(n->node_data_hash))))
+  if (m->num_node_states != m->num_node_data)
     {
-      L_DEBUG("received update number %d, but already have %d",
-              new_update_number, n->update_number);
+      L_INFO("node data and state count mismatch, ignoring");
       return;
     }
-  assert(new_update_number >= n->update_number);
-  if (hncp_node_is_self(n))
+  for (i = 0 ; i < m->num_node_data ; i++)
     {
-      L_DEBUG("received %d update number from network, own %d",
-              new_update_number, n->update_number);
-      if (_handle_collision(o))
+      nd = tlv_data(m->node_data[i]);
+      /* If they're for different nodes, not interested. */
+      for (j = 0 ; j < m->num_node_states ; j++)
+        if (!memcmp(&m->node_states[j]->node_identifier_hash,
+                    &nd->node_identifier_hash, HNCP_HASH_LEN))
+          break;
+      if (j == m->num_node_states)
+        {
+          L_INFO("node data and state identifier mismatch, ignoring");
+          continue;
+        }
+      if (!_handle_node_data(l, src, m->node_states[j], m->node_data[i]))
         return;
-      n->update_number = new_update_number;
-      o->republish_tlvs = true;
-      hncp_schedule(o);
-      return;
-    }
-  /* Ok. nd contains more recent TLV data than what we have
-   * already. Woot. */
-  memset(&tb, 0, sizeof(tb));
-  tlv_buf_init(&tb, 0); /* not passed anywhere */
-  if (tlv_put_raw(&tb, nd_data, nd_len))
-    {
-      hncp_node_set(n, new_update_number,
-                    hncp_time(o) - be32_to_cpu(ns->ms_since_origination),
-                    tb.head);
     }
-  else
+}
+
+/* Handle a single received message. */
+static void
+handle_message(hncp_link l,
+               struct in6_addr *src,
+               unsigned char *data, ssize_t len,
+               bool multicast)
+{
+  hncp_t_node_state node_states[HNCP_MESSAGE_MAX_NODE_STATES];
+  hncp_message_s m;
+
+  m.node_states = node_states;
+  m.max_node_states = HNCP_MESSAGE_MAX_NODE_STATES;
+  /* Stream messages may be larger than any datagram. */
+  if (len > HNCP_MAXIMUM_PAYLOAD_SIZE)
     {
-      L_DEBUG("tlv_put_raw failed");
-      tlv_buf_free(&tb);
+      m.max_node_states = len / (TLV_SIZE + sizeof(hncp_t_node_state_s));
+      m.node_states = malloc(m.max_node_states * sizeof(*m.node_states));
+      if (!m.node_states)
+        return;
     }
+  if (hncp_message_decode(&m, data, len))
+    _handle_message(l, src, &m, multicast);
+  if (m.node_states != node_states)
+    free(m.node_states);
 }
 
+void hncp_handle_stream_message(hncp_link l, struct in6_addr *src,
+                                void *data, size_t len)
+{
+  L_DEBUG("hncp_handle_stream_message %d bytes from %s%%" HNCP_LINK_F,
+          (int)len, ADDR_REPR(src), HNCP_LINK_D(l));
+  handle_message(l, src, data, len, false);
+}
 
 void hncp_poll(hncp o)
 {
   unsigned char buf[HNCP_MAXIMUM_PAYLOAD_SIZE];
   ssize_t read;
-  char srcif[IFNAMSIZ];
   struct in6_addr src;
   struct in6_addr dst;
   hncp_link l;
 
-  while ((read = hncp_io_recvfrom(o, buf, sizeof(buf), srcif, &src, &dst)) > 0)
+  hncp_io_batch_begin(o);
+  /* Only datagrams received on our links are returned. */
+  while ((read = hncp_io_recvfrom(o, buf, sizeof(buf), &l, &src, &dst)) > 0)
     {
-      /* First off. If it's off some link we aren't supposed to use, ignore. */
-      l = hncp_find_link_by_name(o, srcif, false);
-      if (!l)
-        continue;
       /* If it's multicast, it's valid if and only if it's aimed at
        * the multicast address. */
       if (IN6_IS_ADDR_MULTICAST(&dst))
@@ -600,6 +1633,7 @@ void hncp_poll(hncp o)
         continue;
       handle_message(l, &src, buf, read, false);
     }
+  hncp_io_batch_end(o);
 }
 
 /* Utilities for formatting TLVs. */
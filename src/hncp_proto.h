@@ -26,6 +26,28 @@
  */
 #define HNCP_VERSION 1
 
+/* Version of the (opt-in) bulk synchronization extension; see
+ * HNCP_T_BULK_SYNC. */
+#define HNCP_BULK_SYNC_VERSION 1
+
+/* Version of the (opt-in) stream transport extension; see
+ * HNCP_T_STREAM_SYNC. */
+#define HNCP_STREAM_SYNC_VERSION 1
+
+/* Version of the (opt-in) bucket synchronization extension; see
+ * HNCP_T_BUCKET_HASHES. */
+#define HNCP_BUCKET_SYNC_VERSION 1
+
+/* Bucket sync splits the node identifier hash space into this many
+ * buckets by its topmost bits. At most 64, as HNCP_T_REQ_BUCKETS is
+ * a bitmask of them. */
+#define HNCP_BUCKET_BITS 6
+#define HNCP_BUCKETS (1 << HNCP_BUCKET_BITS)
+
+/* Version of the (opt-in) multicast keepalive extension; see
+ * HNCP_T_KEEPALIVE. */
+#define HNCP_KEEPALIVE_VERSION 1
+
 /* Let's assume we use MD5 for the time being.. */
 #define HNCP_HASH_LEN 16
 
@@ -80,6 +102,39 @@ enum {
 
   HNCP_T_ROUTING_PROTOCOL = 60,
 
+  /* Non-standard extensions of this implementation, all opt-in and
+   * ignored by other implementations. They use the private use
+   * range (768-1023) so that they cannot clash with standard TLVs,
+   * and may still be renumbered. */
+
+  /* Message-level extension (not stored anywhere): the sender packs
+   * multiple REQ_NODE_DATA TLVs per message, and accepts replies with
+   * multiple NODE_STATE + NODE_DATA TLVs. */
+  HNCP_T_BULK_SYNC = 768,
+
+  /* Message-level extension (not stored anywhere): node data version
+   * the sender of REQ_NODE_DATA already has, and a reply relative to
+   * it (instead of NODE_DATA). */
+  HNCP_T_NODE_DATA_BASE = 769,
+  HNCP_T_NODE_DATA_DELTA = 770,
+
+  /* Message-level extension (not stored anywhere): the sender
+   * accepts TCP connections on HNCP_PORT, and replies that do not fit
+   * in a datagram may be sent to it over one. */
+  HNCP_T_STREAM_SYNC = 771,
+
+  /* Message-level extension (not stored anywhere): hash of the node
+   * data hashes in each bucket, sent along with the network hash when
+   * NODE_STATEs do not fit; and a request (with REQ_NET_HASH) for
+   * just the NODE_STATEs in some buckets. */
+  HNCP_T_BUCKET_HASHES = 772,
+  HNCP_T_REQ_BUCKETS = 773,
+
+  /* Message-level extension (not stored anywhere): multicast on a
+   * link, with the neighbors the sender has recently heard there.
+   * Being in it is as good as a reply to a ping. */
+  HNCP_T_KEEPALIVE = 774,
+
   HNCP_T_SIGNATURE = 0xFFFF /* not implemented */
 };
 
@@ -133,6 +188,54 @@ typedef struct __packed {
   char user_agent[];
 } hncp_t_version_s, *hncp_t_version;
 
+/* HNCP_T_BULK_SYNC */
+typedef struct __packed {
+  uint32_t version;
+} hncp_t_bulk_sync_s, *hncp_t_bulk_sync;
+
+/* HNCP_T_STREAM_SYNC */
+typedef struct __packed {
+  uint32_t version;
+} hncp_t_stream_sync_s, *hncp_t_stream_sync;
+
+/* HNCP_T_BUCKET_HASHES; the hashes are truncated to HNCP_HASH64_LEN. */
+typedef struct __packed {
+  uint32_t version;
+  unsigned char hashes[HNCP_BUCKETS][HNCP_HASH64_LEN];
+} hncp_t_bucket_hashes_s, *hncp_t_bucket_hashes;
+
+/* HNCP_T_REQ_BUCKETS */
+typedef struct __packed {
+  uint64_t buckets; /* bit i set = bucket i wanted */
+} hncp_t_req_buckets_s, *hncp_t_req_buckets;
+
+/* HNCP_T_KEEPALIVE; the header is followed by the neighbors. */
+typedef struct __packed {
+  uint32_t version;
+} hncp_t_keepalive_header_s, *hncp_t_keepalive_header;
+
+typedef struct __packed {
+  unsigned char node_identifier_hash64[HNCP_HASH64_LEN];
+  uint32_t link_id;
+} hncp_t_keepalive_neighbor_s, *hncp_t_keepalive_neighbor;
+
+/* HNCP_T_NODE_DATA_BASE */
+typedef struct __packed {
+  hncp_hash_s node_identifier_hash;
+  uint32_t update_number;
+  hncp_hash_s node_data_hash;
+} hncp_t_node_data_base_s, *hncp_t_node_data_base;
+
+/* HNCP_T_NODE_DATA_DELTA; the header is followed by the removed TLVs
+ * (removed_length bytes), and then the added ones, both in order. The
+ * first two fields are the same as in the NODE_DATA header. */
+typedef struct __packed {
+  hncp_hash_s node_identifier_hash;
+  uint32_t update_number;
+  uint32_t base_update_number;
+  uint32_t removed_length;
+} hncp_t_node_data_delta_header_s, *hncp_t_node_data_delta_header;
+
 /* HNCP_T_EXTERNAL_CONNECTION - just container, no own content */
 
 /* HNCP_T_DELEGATED_PREFIX */
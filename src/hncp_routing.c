@@ -20,8 +20,8 @@
 #include "iface.h"
 
 static void hncp_routing_run(struct uloop_timeout *t);
-static void hncp_routing_callback(hncp_subscriber s, __unused hncp_node n,
-		__unused struct tlv_attr *tlv, __unused bool add);
+static void hncp_routing_callback(hncp_subscriber s,
+		__unused hncp_tlv_change changes, __unused int num_changes);
 
 static const char *hncp_routing_names[HNCP_ROUTING_MAX] = {
 		[HNCP_ROUTING_NONE] = "Fallback routing",
@@ -111,7 +111,12 @@ static void hncp_routing_intaddr(struct iface_user *u, __unused const char *ifna
 hncp_bfs hncp_routing_create(hncp hncp, const char *script)
 {
 	hncp_bfs bfs = calloc(1, sizeof(*bfs));
-	bfs->subscr.tlv_change_callback = hncp_routing_callback;
+	bfs->subscr.tlv_changes_callback = hncp_routing_callback;
+	bfs->subscr.tlv_types = HNCP_TLV_TYPE_MASK(HNCP_T_NODE_DATA_NEIGHBOR)
+		| HNCP_TLV_TYPE_MASK(HNCP_T_EXTERNAL_CONNECTION)
+		| HNCP_TLV_TYPE_MASK(HNCP_T_ASSIGNED_PREFIX)
+		| HNCP_TLV_TYPE_MASK(HNCP_T_ROUTER_ADDRESS)
+		| HNCP_TLV_TYPE_MASK(HNCP_T_ROUTING_PROTOCOL);
 	bfs->hncp = hncp;
 	bfs->t.cb = hncp_routing_run;
 	bfs->active = HNCP_ROUTING_MAX;
@@ -172,8 +177,8 @@ void hncp_routing_destroy(hncp_bfs bfs)
 	free(bfs);
 }
 
-static void hncp_routing_callback(hncp_subscriber s, __unused hncp_node n,
-		__unused struct tlv_attr *tlv, __unused bool add)
+static void hncp_routing_callback(hncp_subscriber s,
+		__unused hncp_tlv_change changes, __unused int num_changes)
 {
 	hncp_bfs bfs = container_of(s, hncp_bfs_s, subscr);
 	uloop_timeout_set(&bfs->t, 0);
@@ -253,61 +258,57 @@ static void hncp_routing_run(struct uloop_timeout *t)
 		c = container_of(list_first_entry(&queue, struct hncp_bfs_head, head), hncp_node_s, bfs);
 		L_WARN("Router %d", c->node_identifier_hash.buf[0]);
 
-		struct tlv_attr *a, *a2;
-		hncp_node_for_each_tlv(c, a) {
-			hncp_t_assigned_prefix_header ap;
-			hncp_t_node_data_neighbor ne;
-			if ((ne = hncp_tlv_neighbor(a))) {
-
-				n = hncp_find_node_by_hash(hncp,
-					&ne->neighbor_node_identifier_hash, false);
-
-				if (!(n = hncp_node_find_neigh_bidir(c, ne)))
-					continue; // Connection not mutual
+		hncp_adjacency adj;
+		hncp_node_for_each_adjacency(c, adj) {
+			n = adj->node;
 
-				if (n->bfs.next_hop || n == hncp->own_node)
-					continue; // Already visited
+			if (n->bfs.next_hop || n == hncp->own_node)
+				continue; // Already visited
 
+			if (c == hncp->own_node) { // We are at the start, lookup neighbor
+				hncp_link link = hncp_find_link_by_id(hncp, be32_to_cpu(adj->link_id));
+				if (!link)
+					continue;
 
-				if (c == hncp->own_node) { // We are at the start, lookup neighbor
-					hncp_link link = hncp_find_link_by_id(hncp, be32_to_cpu(ne->link_id));
-					if (!link)
-						continue;
+				hncp_neighbor_s *neigh, query = {
+					.node_identifier_hash = n->node_identifier_hash,
+					.iid = be32_to_cpu(adj->neighbor_link_id)
+				};
 
-					hncp_neighbor_s *neigh, query = {
-						.node_identifier_hash = ne->neighbor_node_identifier_hash,
-						.iid = be32_to_cpu(ne->neighbor_link_id)
-					};
-
-					neigh = vlist_find(&link->neighbors, &query, &query, in_neighbors);
-					if (neigh) {
-						n->bfs.next_hop = &neigh->last_address;
-						n->bfs.ifname = link->ifname;
-					}
+				neigh = vlist_find(&link->neighbors, &query, &query, in_neighbors);
+				if (neigh) {
+					n->bfs.next_hop = &neigh->last_address;
+					n->bfs.ifname = link->ifname;
+				}
 
-					struct tlv_attr *na;
-					hncp_t_router_address ra;
-					hncp_node_for_each_tlv_with_type(n, na, HNCP_T_ROUTER_ADDRESS) {
-						if ((ra = hncp_tlv_router_address(na))) {
-							if (ra->link_id == ne->neighbor_link_id &&
-							    IN6_IS_ADDR_V4MAPPED(&ra->address)) {
-								n->bfs.next_hop4 = &ra->address;
-								break;
-							}
+				struct tlv_attr *na;
+				hncp_t_router_address ra;
+				hncp_node_for_each_tlv_with_type(n, na, HNCP_T_ROUTER_ADDRESS) {
+					if ((ra = hncp_tlv_router_address(na))) {
+						if (ra->link_id == adj->neighbor_link_id &&
+						    IN6_IS_ADDR_V4MAPPED(&ra->address)) {
+							n->bfs.next_hop4 = &ra->address;
+							break;
 						}
 					}
-				} else { // Inherit next-hop from predecessor
-					n->bfs.next_hop = c->bfs.next_hop;
-					n->bfs.next_hop4 = c->bfs.next_hop4;
-					n->bfs.ifname = c->bfs.ifname;
 				}
+			} else { // Inherit next-hop from predecessor
+				n->bfs.next_hop = c->bfs.next_hop;
+				n->bfs.next_hop4 = c->bfs.next_hop4;
+				n->bfs.ifname = c->bfs.ifname;
+			}
 
-				if (!n->bfs.next_hop || !n->bfs.ifname)
-					continue;
+			if (!n->bfs.next_hop || !n->bfs.ifname)
+				continue;
 
-				n->bfs.hopcount = c->bfs.hopcount + 1;
-				list_add_tail(&n->bfs.head, &queue);
-			} else if (tlv_id(a) == HNCP_T_EXTERNAL_CONNECTION && c != hncp->own_node) {
+			n->bfs.hopcount = c->bfs.hopcount + 1;
+			list_add_tail(&n->bfs.head, &queue);
+		}
+
+		struct tlv_attr *a, *a2;
+		hncp_node_for_each_tlv(c, a) {
+			hncp_t_assigned_prefix_header ap;
+			if (tlv_id(a) == HNCP_T_EXTERNAL_CONNECTION && c != hncp->own_node) {
 				hncp_t_delegated_prefix_header dp;
 				tlv_for_each_attr(a2, a)
 					if ((dp = hncp_tlv_dp(a2))) {
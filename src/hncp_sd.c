@@ -888,6 +888,11 @@ hncp_sd hncp_sd_create(hncp h, hncp_sd_params p)
   /* Set up the hncp subscriber */
   sd->subscriber.local_tlv_change_callback = _local_tlv_cb;
   sd->subscriber.tlv_change_callback = _tlv_cb;
+  sd->subscriber.tlv_types = HNCP_TLV_TYPE_MASK(HNCP_T_DNS_ROUTER_NAME)
+    | HNCP_TLV_TYPE_MASK(HNCP_T_DNS_DELEGATED_ZONE)
+    | HNCP_TLV_TYPE_MASK(HNCP_T_DNS_DOMAIN_NAME)
+    | HNCP_TLV_TYPE_MASK(HNCP_T_ROUTER_ADDRESS)
+    | HNCP_TLV_TYPE_MASK(HNCP_T_EXTERNAL_CONNECTION);
   sd->subscriber.republish_callback = _republish_cb;
   sd->subscriber.link_change_callback = _force_republish_cb;
   hncp_subscribe(h, &sd->subscriber);
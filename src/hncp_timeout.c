@@ -13,6 +13,104 @@
 
 #include "hncp_i.h"
 
+/***************************************************************** Timer heap */
+
+static void _timer_place(hncp o, hncp_timer t, int i)
+{
+  o->timers[i] = t;
+  t->index = i + 1;
+}
+
+static void _timer_sift_up(hncp o, int i)
+{
+  hncp_timer t = o->timers[i];
+  int p;
+
+  for ( ; i > 0 ; i = p)
+    {
+      p = (i - 1) / 2;
+      if (o->timers[p]->time <= t->time)
+        break;
+      _timer_place(o, o->timers[p], i);
+    }
+  _timer_place(o, t, i);
+}
+
+static void _timer_sift_down(hncp o, int i)
+{
+  hncp_timer t = o->timers[i];
+  int c;
+
+  for ( ; (c = 2 * i + 1) < o->num_timers ; i = c)
+    {
+      if (c + 1 < o->num_timers
+          && o->timers[c + 1]->time < o->timers[c]->time)
+        c++;
+      if (t->time <= o->timers[c]->time)
+        break;
+      _timer_place(o, o->timers[c], i);
+    }
+  _timer_place(o, t, i);
+}
+
+static void _timer_fix(hncp o, int i)
+{
+  if (i > 0 && o->timers[(i - 1) / 2]->time > o->timers[i]->time)
+    _timer_sift_up(o, i);
+  else
+    _timer_sift_down(o, i);
+}
+
+/* False if t could not be put in the heap. */
+static bool _timer_set(hncp o, hncp_timer t, hnetd_time_t time)
+{
+  int i = t->index - 1;
+
+  t->time = time;
+  if (i < 0)
+    {
+      if (o->num_timers == o->timers_size)
+        {
+          int size = o->timers_size ? o->timers_size * 2 : 16;
+          hncp_timer *timers = realloc(o->timers, size * sizeof(*timers));
+
+          if (!timers)
+            {
+              L_ERR("unable to allocate timer heap of %d", size);
+              return false;
+            }
+          o->timers = timers;
+          o->timers_size = size;
+        }
+      i = o->num_timers++;
+      o->timers[i] = t;
+    }
+  _timer_fix(o, i);
+  return true;
+}
+
+/* hncp_run puts the timers that are not in the heap back in. */
+static void _timer_retry(hncp o)
+{
+  o->timers_retry = true;
+  /* Within hncp_run, it schedules the retry itself. */
+  if (!o->now)
+    hncp_schedule(o);
+}
+
+void hncp_timer_cancel(hncp o, hncp_timer t)
+{
+  int i = t->index - 1;
+
+  if (i < 0)
+    return;
+  t->index = 0;
+  if (i == --o->num_timers)
+    return;
+  o->timers[i] = o->timers[o->num_timers];
+  _timer_fix(o, i);
+}
+
 static void trickle_set_i(hncp_link l, int i)
 {
   hnetd_time_t now = hncp_time(l->hncp);
@@ -42,6 +140,7 @@ static void trickle_set_i(hncp_link l, int i)
   l->trickle_send_time = now + t;
   l->trickle_interval_end_time = now + i;
   l->trickle_c = 0;
+  hncp_link_schedule(l);
   L_DEBUG(HNCP_LINK_F " trickle set to %d/%d", HNCP_LINK_D(l), t, i);
 }
 
@@ -70,14 +169,14 @@ static void trickle_send(hncp_link l)
   l->trickle_send_time = 0;
 }
 
-static void _node_set_reachable(hncp_node n, bool value)
+static void _node_set_reachable(hncp_node n, bool value, hnetd_time_t t)
 {
   hncp o = n->hncp;
   bool is_reachable = o->last_prune == n->last_reachable_prune;
 
   if (is_reachable != value)
     {
-      o->network_hash_dirty = true;
+      hncp_invalidate_network_hash(o, n);
 
       if (!value)
         hncp_notify_subscribers_tlvs_changed(n, n->tlv_container_valid, NULL);
@@ -88,46 +187,94 @@ static void _node_set_reachable(hncp_node n, bool value)
         hncp_notify_subscribers_tlvs_changed(n, NULL, n->tlv_container_valid);
     }
   if (value)
-    n->last_reachable_prune = hncp_time(o);
+    n->last_reachable_prune = t;
+}
+
+static bool _prune_stack_reserve(hncp o)
+{
+  int size = o->nodes.avl.count;
+  hncp_prune_frame stack;
+
+  if (size <= o->prune_stack_size)
+    return true;
+  stack = realloc(o->prune_stack, size * sizeof(*stack));
+  if (!stack)
+    {
+      L_ERR("unable to allocate prune stack for %d nodes", size);
+      return false;
+    }
+  o->prune_stack = stack;
+  o->prune_stack_size = size;
+  return true;
 }
 
-static void hncp_prune_rec(hncp_node n)
+/* Depth-first traversal of the (bidirectional) graph starting at n.
+ * The visit callback returns true if the node was not yet visited,
+ * and its neighbors should be looked at too. Nodes are visited in the
+ * same order as a recursive traversal would, but the stack is
+ * _prune_stack_reserve'd in hncp instead of being the call stack. */
+static void _prune_traverse(hncp_node n, bool (*visit)(hncp_node n))
 {
-  struct tlv_attr *tlvs, *a;
-  hncp_t_node_data_neighbor ne;
-  hncp_node n2;
+  hncp o = n->hncp;
+  hncp_prune_frame f;
+  int depth = 0;
 
-  if (!n)
+  if (!visit(n))
     return;
+  o->prune_stack[depth++] = (hncp_prune_frame_s) { .node = n };
+  while (depth)
+    {
+      f = &o->prune_stack[depth - 1];
+      hncp_node_get_adjacencies(f->node);
+      if (f->i >= f->node->num_adjacencies)
+        {
+          depth--;
+          continue;
+        }
+      n = f->node->adjacencies[f->i++].node;
+      if (!visit(n))
+        continue;
+      assert(depth < o->prune_stack_size);
+      o->prune_stack[depth++] = (hncp_prune_frame_s) { .node = n };
+    }
+}
+
+static bool _prune_visit(hncp_node n)
+{
+  struct tlv_attr *tlvs;
 
   /* Stop the iteration if we're already added to current
    * generation. */
   if (n->in_nodes.version == n->hncp->nodes.version)
-    return;
+    return false;
 
   tlvs = hncp_node_get_tlvs(n);
 
-  L_DEBUG("hncp_prune_rec %llx / %p = %p",
+  L_DEBUG("hncp_prune_visit %llx / %p = %p",
           hncp_hash64(&n->node_identifier_hash), n, tlvs);
 
   /* No TLVs? No point recursing, unless the node is us (we have to
    * visit it always in any case). */
   if (!tlvs && n != n->hncp->own_node)
-    return;
+    return false;
 
   /* Refresh the entry - we clearly did reach it. */
   vlist_add(&n->hncp->nodes, &n->in_nodes, n);
-  _node_set_reachable(n, true);
-
-  /* Look at it's neighbors. */
-  tlv_for_each_attr(a, tlvs)
-    if ((ne = hncp_tlv_neighbor(a)))
-      {
-        /* Ignore if it's not _bidirectional_ neighbor. Unidirectional
-         * ones lead to graph not settling down. */
-        if ((n2 = hncp_node_find_neigh_bidir(n, ne)))
-          hncp_prune_rec(n2);
-      }
+  _node_set_reachable(n, true, hncp_time(n->hncp));
+
+  /* Look at it's (bidirectional) neighbors. Unidirectional ones
+   * lead to graph not settling down, so they are not included. */
+  return true;
+}
+
+static void _clear_prune_seeds(hncp o)
+{
+  int i;
+
+  for (i = 0 ; i < o->num_prune_seeds ; i++)
+    o->prune_seeds[i]->prune_seed = false;
+  o->num_prune_seeds = 0;
+  o->graph_dirty_full = false;
 }
 
 static void hncp_prune(hncp o)
@@ -140,11 +287,20 @@ static void hncp_prune(hncp o)
 
   L_DEBUG("hncp_prune %p", o);
 
+  if (!_prune_stack_reserve(o))
+    {
+      /* Try again later. */
+      o->graph_dirty = true;
+      o->graph_dirty_full = true;
+      return;
+    }
+  _clear_prune_seeds(o);
+
   /* Prune the node graph. IOW, start at own node, flood fill, and zap
    * anything that didn't seem appropriate. */
   vlist_update(&o->nodes);
 
-  hncp_prune_rec(o->own_node);
+  _prune_traverse(o->own_node, _prune_visit);
 
   hncp_node n;
   hnetd_time_t next_time = 0;
@@ -157,13 +313,62 @@ static void hncp_prune(hncp o)
       next_time = TMIN(next_time,
                        n->last_reachable_prune + HNCP_PRUNE_GRACE_PERIOD + 1);
       vlist_add(&o->nodes, &n->in_nodes, n);
-      _node_set_reachable(n, false);
+      _node_set_reachable(n, false, 0);
     }
   o->next_prune = next_time;
   vlist_flush(&o->nodes);
   o->last_prune = now;
 }
 
+/* Make the node, and the previously unreachable nodes reachable
+ * through it, reachable. */
+static bool _prune_grow_visit(hncp_node n)
+{
+  hncp o = n->hncp;
+
+  if (n->last_reachable_prune == o->last_prune)
+    return false;
+  _node_set_reachable(n, true, o->last_prune);
+  return true;
+}
+
+/* Only edges were added to the graph; follow the new ones from the
+ * nodes that gained them, leaving the rest of the graph alone. */
+static void hncp_prune_incremental(hncp o)
+{
+  hncp_adjacency adj;
+  hncp_node n;
+
+  L_DEBUG("hncp_prune_incremental %p (%d seeds)", o, o->num_prune_seeds);
+
+  if (!_prune_stack_reserve(o))
+    {
+      o->graph_dirty = true;
+      o->graph_dirty_full = true;
+      return;
+    }
+
+  while (o->num_prune_seeds && !o->graph_dirty_full)
+    {
+      n = o->prune_seeds[--o->num_prune_seeds];
+      n->prune_seed = false;
+      if (n->last_reachable_prune == o->last_prune)
+        {
+          hncp_node_for_each_adjacency(n, adj)
+            _prune_traverse(adj->node, _prune_grow_visit);
+        }
+      else if (hncp_node_get_tlvs(n))
+        {
+          hncp_node_for_each_adjacency(n, adj)
+            if (adj->node->last_reachable_prune == o->last_prune)
+              {
+                _prune_traverse(n, _prune_grow_visit);
+                break;
+              }
+        }
+    }
+}
+
 void hncp_link_reset_trickle(hncp_link l)
 {
   if (l->join_pending)
@@ -172,18 +377,128 @@ void hncp_link_reset_trickle(hncp_link l)
   hncp_schedule(l->hncp);
 }
 
+static hnetd_time_t _link_next_time(hncp_link l)
+{
+  if (l->join_pending)
+    return l->hncp->join_failed_time + HNCP_REJOIN_INTERVAL;
+  return TMIN(l->trickle_interval_end_time, l->trickle_send_time);
+}
+
+static void _link_timer_cb(hncp_timer t, hnetd_time_t now)
+{
+  hncp_link l = container_of(t, hncp_link_s, timer);
+  hncp o = l->hncp;
+
+  /* If we're in join pending state, we retry every
+   * HNCP_REJOIN_INTERVAL if necessary. */
+  if (l->join_pending)
+    {
+      if (now - o->join_failed_time >= HNCP_REJOIN_INTERVAL
+          && hncp_link_join(l))
+        trickle_set_i(l, l->conf->trickle_imin);
+      hncp_link_schedule(l);
+      return;
+    }
+
+  if (l->trickle_interval_end_time <= now)
+    trickle_upgrade(l);
+  else if (l->trickle_send_time && l->trickle_send_time <= now)
+    trickle_send(l);
+  hncp_link_schedule(l);
+}
+
+void hncp_link_schedule(hncp_link l)
+{
+  l->timer.cb = _link_timer_cb;
+  if (!_timer_set(l->hncp, &l->timer, _link_next_time(l)))
+    _timer_retry(l->hncp);
+}
+
+static hnetd_time_t _neighbor_next_time(hncp_neighbor n, hnetd_time_t now)
+{
+  hncp_link_conf conf = n->link->conf;
+
+  if (n->ping_count)
+    return n->last_ping + (conf->ping_retry_base_t << n->ping_count);
+  /* For new neighbors, send ~immediate ping */
+  if (!n->last_response)
+    return now;
+  /* if they're in sync with me, we can just use last_heard */
+  if (n->last_heard > n->last_response && n->in_sync)
+    return n->last_heard + conf->ping_worried_t;
+  return n->last_response + conf->ping_worried_t;
+}
+
+static void _neighbor_timer_cb(hncp_timer t, hnetd_time_t now)
+{
+  hncp_neighbor n = container_of(t, hncp_neighbor_s, timer);
+  hncp_link l = n->link;
+  hncp o = l->hncp;
+  hnetd_time_t next_time = _neighbor_next_time(n, now);
+
+  /* Hearing from the neighbor only pushes the deadline later; that
+   * is noticed here, not when it happens. */
+  if (next_time > now)
+    {
+      if (!_timer_set(o, t, next_time))
+        _timer_retry(o);
+      return;
+    }
+
+  if (n->ping_count++ == l->conf->ping_retries)
+    {
+      /* Zap the neighbor */
+      L_DEBUG(HNCP_NEIGH_F " gone on " HNCP_LINK_F,
+              HNCP_NEIGH_D(n), HNCP_LINK_D(l));
+      vlist_delete(&l->neighbors, &n->in_neighbors);
+      return;
+    }
+
+  n->last_ping = hncp_time(o);
+  if (o->multicast_keepalive && n->ping_count == 1)
+    {
+      /* First try is a keepalive on the link, shared with every other
+       * neighbor due about now; only the retries are unicast. */
+      if (now - l->last_keepalive >= HNCP_KEEPALIVE_MIN_INTERVAL)
+        hncp_link_send_keepalive(l);
+    }
+  else
+    {
+      /* Send a ping */
+      L_DEBUG("pinging " HNCP_NEIGH_F "  on " HNCP_LINK_F,
+              HNCP_NEIGH_D(n), HNCP_LINK_D(l));
+      o->pings_sent++;
+      hncp_link_send_req_network_state(l, &n->last_address);
+    }
+  if (!_timer_set(o, t, _neighbor_next_time(n, now)))
+    _timer_retry(o);
+}
+
+void hncp_neighbor_schedule(hncp_neighbor n)
+{
+  hncp o = n->link->hncp;
+  hnetd_time_t next_time = _neighbor_next_time(n, hncp_time(o));
+
+  n->timer.cb = _neighbor_timer_cb;
+  if ((!n->timer.index || next_time < n->timer.time)
+      && !_timer_set(o, &n->timer, next_time))
+    _timer_retry(o);
+}
+
 void hncp_run(hncp o)
 {
   hnetd_time_t next = 0;
   hnetd_time_t now = hncp_io_time(o);
   hncp_link l;
-  hncp_neighbor n, n2;
-  int time_since_failed_join = now - o->join_failed_time;
+  hncp_timer t;
 
   /* Assumption: We're within RTC step here -> can use same timestamp
    * all the way. */
   o->now = now;
 
+  /* Whatever we send here goes out in one batch at the end. */
+  hncp_io_batch_begin(o);
+
   /* If we weren't before, we are now processing within timeout (no
    * sense scheduling extra timeouts within hncp_self_flush or hncp_prune). */
   o->immediate_scheduled = true;
@@ -194,6 +509,11 @@ void hncp_run(hncp o)
 
   if (!o->disable_prune)
     {
+      if (o->graph_dirty && !o->graph_dirty_full)
+        {
+          o->graph_dirty = false;
+          hncp_prune_incremental(o);
+        }
       if (o->graph_dirty)
         o->next_prune = HNCP_MINIMUM_PRUNE_INTERVAL + o->last_prune;
 
@@ -214,6 +534,9 @@ void hncp_run(hncp o)
    * events within hncp_run). */
   o->immediate_scheduled = false;
 
+  /* Changes to node data since the last run, in one go. */
+  hncp_notify_subscribers_tlv_changes(o, NULL);
+
   /* First off: If the network hash is dirty, recalculate it (and hope
    * the outcome ISN'T). */
   if (o->network_hash_dirty)
@@ -232,77 +555,44 @@ void hncp_run(hncp o)
         }
     }
 
-  vlist_for_each_element(&o->links, l, in_links)
-    {
-      /* If we're in join pending state, we retry every
-       * HNCP_REJOIN_INTERVAL if necessary. */
-      if (l->join_pending)
-        {
-          if (time_since_failed_join >= HNCP_REJOIN_INTERVAL
-              && hncp_link_join(l))
-            trickle_set_i(l, l->conf->trickle_imin);
-          else
-            {
-              next = TMIN(next, now + HNCP_REJOIN_INTERVAL - (now - o->join_failed_time));
-              continue;
-            }
-        }
-
-      if (l->trickle_interval_end_time <= now)
-        trickle_upgrade(l);
-      else if (l->trickle_send_time && l->trickle_send_time <= now)
-        trickle_send(l);
+  /* Node data requests that have not been answered in time. */
+  next = TMIN(next, hncp_run_pending_requests(o));
 
-      next = TMIN(next, l->trickle_interval_end_time);
-      next = TMIN(next, l->trickle_send_time);
+  /* Links and neighbors whose timers did not fit in the heap. */
+  if (o->timers_retry)
+    {
+      hncp_neighbor ne;
 
-      /* Look at neighbors we should be worried about.. */
-      /* vlist_for_each_element(&l->neighbors, n, in_neighbors) */
-      avl_for_each_element_safe(&l->neighbors.avl, n, in_neighbors.avl, n2)
+      o->timers_retry = false;
+      vlist_for_each_element(&o->links, l, in_links)
         {
-          hnetd_time_t next_time;
-
-          if (!n->ping_count)
-            {
-              /* For new neighbors, send ~immediate ping */
-              if (!n->last_response)
-                next_time = now;
-              /* if they're in sync with me, we can just use last_heard */
-              else if (n->last_heard > n->last_response && n->in_sync)
-                next_time = n->last_heard + l->conf->ping_worried_t;
-              else
-                next_time = n->last_response + l->conf->ping_worried_t;
-            }
-          else
-            next_time = n->last_ping + (l->conf->ping_retry_base_t << n->ping_count);
-
-          /* No cause to do anything right now. */
-          if (next_time > now)
-            {
-              next = TMIN(next, next_time);
-              continue;
-            }
-
-          if (n->ping_count++== l->conf->ping_retries)
-            {
-              /* Zap the neighbor */
-              L_DEBUG(HNCP_NEIGH_F " gone on " HNCP_LINK_F,
-                      HNCP_NEIGH_D(n), HNCP_LINK_D(l));
-              vlist_delete(&l->neighbors, &n->in_neighbors);
-              continue;
-            }
-
-          n->last_ping = hncp_time(o);
-          /* Send a ping */
-          L_DEBUG("pinging " HNCP_NEIGH_F "  on " HNCP_LINK_F,
-                  HNCP_NEIGH_D(n), HNCP_LINK_D(l));
-          hncp_link_send_req_network_state(l, &n->last_address);
+          if (!l->timer.index)
+            hncp_link_schedule(l);
+          vlist_for_each_element(&l->neighbors, ne, in_neighbors)
+            if (!ne->timer.index)
+              hncp_neighbor_schedule(ne);
         }
     }
 
-  if (next && !o->immediate_scheduled)
+  /* Links (Trickle, rejoin) and neighbors (ping) that are due; the
+   * callbacks put them back in the heap if they are still around. */
+  while (o->num_timers && o->timers[0]->time <= now)
+    {
+      t = o->timers[0];
+      hncp_timer_cancel(o, t);
+      o->timers_run++;
+      t->cb(t, now);
+    }
+  if (o->num_timers)
+    next = TMIN(next, o->timers[0]->time);
+  if (o->timers_retry)
+    next = TMIN(next, now + HNCP_TIMER_RETRY_INTERVAL);
+
+  if (next && !o->immediate_scheduled && o->io_init_done)
     hncp_io_schedule(o, next - now);
 
+  hncp_io_batch_end(o);
+
   /* Clear the cached time, it's most likely no longer valid. */
   o->now = 0;
 }
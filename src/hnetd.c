@@ -112,6 +112,11 @@ int usage() {
 	 "\t--ip6prefix v:x:y:z::/prefix\n"
 	 "\t--ulaprefix v:x:y:z::/prefix\n"
 	 "\t--loglevel [0-9]\n"
+	 "\t--bulk-sync\n"
+	 "\t--delta-sync\n"
+	 "\t--stream-sync\n"
+	 "\t--bucket-sync\n"
+	 "\t--multicast-keepalive\n"
 	 );
     return(3);
 }
@@ -180,11 +185,21 @@ int main(__unused int argc, char *argv[])
 	const char *pd_socket_path = "/var/run/hnetd_pd";
 	const char *pa_ip4prefix = NULL;
 	const char *pa_ulaprefix = NULL;
+	bool bulk_sync = false;
+	bool delta_sync = false;
+	bool stream_sync = false;
+	bool bucket_sync = false;
+	bool multicast_keepalive = false;
 
 	enum {
 		GOL_IPPREFIX = 1000,
 		GOL_ULAPREFIX,
 		GOL_LOGLEVEL,
+		GOL_BULKSYNC,
+		GOL_DELTASYNC,
+		GOL_STREAMSYNC,
+		GOL_BUCKETSYNC,
+		GOL_KEEPALIVE,
 	};
 
 	struct option longopts[] = {
@@ -192,6 +207,11 @@ int main(__unused int argc, char *argv[])
 			{ "ip4prefix",   required_argument,      NULL,           GOL_IPPREFIX },
 			{ "ulaprefix",   required_argument,      NULL,           GOL_ULAPREFIX },
 			{ "loglevel",    required_argument,      NULL,           GOL_LOGLEVEL },
+			{ "bulk-sync",   no_argument,            NULL,           GOL_BULKSYNC },
+			{ "delta-sync",  no_argument,            NULL,           GOL_DELTASYNC },
+			{ "stream-sync", no_argument,            NULL,           GOL_STREAMSYNC },
+			{ "bucket-sync", no_argument,            NULL,           GOL_BUCKETSYNC },
+			{ "multicast-keepalive", no_argument,    NULL,           GOL_KEEPALIVE },
 			{ "help",	 no_argument,		 NULL,           '?' },
 			{ NULL,          0,                      NULL,           0 }
 	};
@@ -234,6 +254,21 @@ int main(__unused int argc, char *argv[])
 		case GOL_LOGLEVEL:
 			log_level = atoi(optarg);
 			break;
+		case GOL_BULKSYNC:
+			bulk_sync = true;
+			break;
+		case GOL_DELTASYNC:
+			delta_sync = true;
+			break;
+		case GOL_STREAMSYNC:
+			stream_sync = true;
+			break;
+		case GOL_BUCKETSYNC:
+			bucket_sync = true;
+			break;
+		case GOL_KEEPALIVE:
+			multicast_keepalive = true;
+			break;
 		default:
 			L_ERR("Unrecognized option");
 		case '?': return usage();
@@ -279,6 +314,12 @@ int main(__unused int argc, char *argv[])
 		L_ERR("Unable to initialize HNCP");
 		return 42;
 	}
+	hncp_set_bulk_sync(h, bulk_sync);
+	hncp_set_delta_sync(h, delta_sync);
+	hncp_set_bucket_sync(h, bucket_sync);
+	hncp_set_multicast_keepalive(h, multicast_keepalive);
+	if (stream_sync)
+		hncp_set_stream_sync(h, true);
 
 	if (!(hg = hncp_pa_glue_create(h, &pa.data))) {
 		L_ERR("Unable to connect hncp and pa");
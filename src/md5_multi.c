@@ -0,0 +1,286 @@
+/*
+ * Copyright (c) 2014 cisco Systems, Inc.
+ *
+ * Multi-buffer MD5 (RFC 1321). The compression function is written
+ * once in terms of the V_* vector operations below, and run on as
+ * many messages as there are lanes; a lane whose message is done is
+ * refilled with the next one, so messages of different lengths keep
+ * all lanes busy.
+ *
+ * The instruction set is chosen at compile time: AVX2 (if enabled,
+ * e.g. -mavx2 or -march=native), SSE2 (always there on x86-64), NEON,
+ * or plain C one message at a time.
+ *
+ */
+
+#include "md5_multi.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+#define LANES 8
+typedef __m256i vec;
+#define V_ADD(a, b) _mm256_add_epi32(a, b)
+#define V_AND(a, b) _mm256_and_si256(a, b)
+#define V_OR(a, b) _mm256_or_si256(a, b)
+#define V_XOR(a, b) _mm256_xor_si256(a, b)
+#define V_NOT(a) _mm256_xor_si256(a, _mm256_set1_epi32(-1))
+#define V_ROTL(a, s) \
+	_mm256_or_si256(_mm256_slli_epi32(a, s), _mm256_srli_epi32(a, 32 - (s)))
+#define V_SET1(x) _mm256_set1_epi32((int)(x))
+#define V_LOAD(p) _mm256_loadu_si256((const __m256i *)(p))
+#define V_STORE(p, v) _mm256_storeu_si256((__m256i *)(p), v)
+
+#elif defined(__SSE2__)
+
+#include <emmintrin.h>
+
+#define LANES 4
+typedef __m128i vec;
+#define V_ADD(a, b) _mm_add_epi32(a, b)
+#define V_AND(a, b) _mm_and_si128(a, b)
+#define V_OR(a, b) _mm_or_si128(a, b)
+#define V_XOR(a, b) _mm_xor_si128(a, b)
+#define V_NOT(a) _mm_xor_si128(a, _mm_set1_epi32(-1))
+#define V_ROTL(a, s) \
+	_mm_or_si128(_mm_slli_epi32(a, s), _mm_srli_epi32(a, 32 - (s)))
+#define V_SET1(x) _mm_set1_epi32((int)(x))
+#define V_LOAD(p) _mm_loadu_si128((const __m128i *)(p))
+#define V_STORE(p, v) _mm_storeu_si128((__m128i *)(p), v)
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+#include <arm_neon.h>
+
+#define LANES 4
+typedef uint32x4_t vec;
+#define V_ADD(a, b) vaddq_u32(a, b)
+#define V_AND(a, b) vandq_u32(a, b)
+#define V_OR(a, b) vorrq_u32(a, b)
+#define V_XOR(a, b) veorq_u32(a, b)
+#define V_NOT(a) vmvnq_u32(a)
+#define V_ROTL(a, s) vsriq_n_u32(vshlq_n_u32(a, s), a, 32 - (s))
+#define V_SET1(x) vdupq_n_u32(x)
+#define V_LOAD(p) vld1q_u32(p)
+#define V_STORE(p, v) vst1q_u32(p, v)
+
+#else
+
+#define LANES 1
+typedef uint32_t vec;
+#define V_ADD(a, b) ((a) + (b))
+#define V_AND(a, b) ((a) & (b))
+#define V_OR(a, b) ((a) | (b))
+#define V_XOR(a, b) ((a) ^ (b))
+#define V_NOT(a) (~(a))
+#define V_ROTL(a, s) (((a) << (s)) | ((a) >> (32 - (s))))
+#define V_SET1(x) ((uint32_t)(x))
+#define V_LOAD(p) (*(p))
+#define V_STORE(p, v) (*(p) = (v))
+
+#endif
+
+#define F(b, c, d) V_XOR(d, V_AND(b, V_XOR(c, d)))
+#define G(b, c, d) V_XOR(c, V_AND(d, V_XOR(b, c)))
+#define H(b, c, d) V_XOR(V_XOR(b, c), d)
+#define I(b, c, d) V_XOR(c, V_OR(b, V_NOT(d)))
+
+#define STEP(f, a, b, c, d, i, k, s) \
+	a = V_ADD(b, V_ROTL(V_ADD(V_ADD(a, f(b, c, d)), \
+				  V_ADD(V_SET1(k), w[i])), s))
+
+/* One 64 byte block of each lane; W[i][l] is word i of lane l. */
+static void _compress(uint32_t state[4][LANES], uint32_t W[16][LANES])
+{
+	vec a = V_LOAD(state[0]), b = V_LOAD(state[1]);
+	vec c = V_LOAD(state[2]), d = V_LOAD(state[3]);
+	vec aa = a, bb = b, cc = c, dd = d;
+	vec w[16];
+	int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = V_LOAD(W[i]);
+
+	STEP(F, a, b, c, d, 0, 0xd76aa478, 7);
+	STEP(F, d, a, b, c, 1, 0xe8c7b756, 12);
+	STEP(F, c, d, a, b, 2, 0x242070db, 17);
+	STEP(F, b, c, d, a, 3, 0xc1bdceee, 22);
+	STEP(F, a, b, c, d, 4, 0xf57c0faf, 7);
+	STEP(F, d, a, b, c, 5, 0x4787c62a, 12);
+	STEP(F, c, d, a, b, 6, 0xa8304613, 17);
+	STEP(F, b, c, d, a, 7, 0xfd469501, 22);
+	STEP(F, a, b, c, d, 8, 0x698098d8, 7);
+	STEP(F, d, a, b, c, 9, 0x8b44f7af, 12);
+	STEP(F, c, d, a, b, 10, 0xffff5bb1, 17);
+	STEP(F, b, c, d, a, 11, 0x895cd7be, 22);
+	STEP(F, a, b, c, d, 12, 0x6b901122, 7);
+	STEP(F, d, a, b, c, 13, 0xfd987193, 12);
+	STEP(F, c, d, a, b, 14, 0xa679438e, 17);
+	STEP(F, b, c, d, a, 15, 0x49b40821, 22);
+
+	STEP(G, a, b, c, d, 1, 0xf61e2562, 5);
+	STEP(G, d, a, b, c, 6, 0xc040b340, 9);
+	STEP(G, c, d, a, b, 11, 0x265e5a51, 14);
+	STEP(G, b, c, d, a, 0, 0xe9b6c7aa, 20);
+	STEP(G, a, b, c, d, 5, 0xd62f105d, 5);
+	STEP(G, d, a, b, c, 10, 0x02441453, 9);
+	STEP(G, c, d, a, b, 15, 0xd8a1e681, 14);
+	STEP(G, b, c, d, a, 4, 0xe7d3fbc8, 20);
+	STEP(G, a, b, c, d, 9, 0x21e1cde6, 5);
+	STEP(G, d, a, b, c, 14, 0xc33707d6, 9);
+	STEP(G, c, d, a, b, 3, 0xf4d50d87, 14);
+	STEP(G, b, c, d, a, 8, 0x455a14ed, 20);
+	STEP(G, a, b, c, d, 13, 0xa9e3e905, 5);
+	STEP(G, d, a, b, c, 2, 0xfcefa3f8, 9);
+	STEP(G, c, d, a, b, 7, 0x676f02d9, 14);
+	STEP(G, b, c, d, a, 12, 0x8d2a4c8a, 20);
+
+	STEP(H, a, b, c, d, 5, 0xfffa3942, 4);
+	STEP(H, d, a, b, c, 8, 0x8771f681, 11);
+	STEP(H, c, d, a, b, 11, 0x6d9d6122, 16);
+	STEP(H, b, c, d, a, 14, 0xfde5380c, 23);
+	STEP(H, a, b, c, d, 1, 0xa4beea44, 4);
+	STEP(H, d, a, b, c, 4, 0x4bdecfa9, 11);
+	STEP(H, c, d, a, b, 7, 0xf6bb4b60, 16);
+	STEP(H, b, c, d, a, 10, 0xbebfbc70, 23);
+	STEP(H, a, b, c, d, 13, 0x289b7ec6, 4);
+	STEP(H, d, a, b, c, 0, 0xeaa127fa, 11);
+	STEP(H, c, d, a, b, 3, 0xd4ef3085, 16);
+	STEP(H, b, c, d, a, 6, 0x04881d05, 23);
+	STEP(H, a, b, c, d, 9, 0xd9d4d039, 4);
+	STEP(H, d, a, b, c, 12, 0xe6db99e5, 11);
+	STEP(H, c, d, a, b, 15, 0x1fa27cf8, 16);
+	STEP(H, b, c, d, a, 2, 0xc4ac5665, 23);
+
+	STEP(I, a, b, c, d, 0, 0xf4292244, 6);
+	STEP(I, d, a, b, c, 7, 0x432aff97, 10);
+	STEP(I, c, d, a, b, 14, 0xab9423a7, 15);
+	STEP(I, b, c, d, a, 5, 0xfc93a039, 21);
+	STEP(I, a, b, c, d, 12, 0x655b59c3, 6);
+	STEP(I, d, a, b, c, 3, 0x8f0ccc92, 10);
+	STEP(I, c, d, a, b, 10, 0xffeff47d, 15);
+	STEP(I, b, c, d, a, 1, 0x85845dd1, 21);
+	STEP(I, a, b, c, d, 8, 0x6fa87e4f, 6);
+	STEP(I, d, a, b, c, 15, 0xfe2ce6e0, 10);
+	STEP(I, c, d, a, b, 6, 0xa3014314, 15);
+	STEP(I, b, c, d, a, 13, 0x4e0811a1, 21);
+	STEP(I, a, b, c, d, 4, 0xf7537e82, 6);
+	STEP(I, d, a, b, c, 11, 0xbd3af235, 10);
+	STEP(I, c, d, a, b, 2, 0x2ad7d2bb, 15);
+	STEP(I, b, c, d, a, 9, 0xeb86d391, 21);
+
+	V_STORE(state[0], V_ADD(a, aa));
+	V_STORE(state[1], V_ADD(b, bb));
+	V_STORE(state[2], V_ADD(c, cc));
+	V_STORE(state[3], V_ADD(d, dd));
+}
+
+struct md5_lane {
+	md5_multi_job job;
+	size_t block, blocks;
+};
+
+/* Blocks of the padded message: data, 0x80, zeros, 64-bit length. */
+static size_t _blocks(md5_multi_job j)
+{
+	return (j->prefix_len + j->data_len + 8) / 64 + 1;
+}
+
+/* Put block k of the padded message of j to lane l of W. */
+static void _load_block(md5_multi_job j, size_t k, uint32_t W[16][LANES], int l)
+{
+	size_t len = j->prefix_len + j->data_len;
+	size_t off = k * 64, i = 0, n;
+	uint64_t bits = (uint64_t)len * 8;
+	unsigned char b[64];
+	const unsigned char *p;
+
+	/* Most blocks are just data; no need to copy those. */
+	if (off >= j->prefix_len && off + 64 <= len) {
+		p = (const unsigned char *)j->data + (off - j->prefix_len);
+	} else {
+		if (off < j->prefix_len) {
+			n = j->prefix_len - off;
+			if (n > 64)
+				n = 64;
+			memcpy(b, (const unsigned char *)j->prefix + off, n);
+			i = n;
+		}
+		if (i < 64 && off + i < len) {
+			n = len - (off + i);
+			if (n > 64 - i)
+				n = 64 - i;
+			memcpy(b + i, (const unsigned char *)j->data
+			       + (off + i - j->prefix_len), n);
+			i += n;
+		}
+		memset(b + i, 0, 64 - i);
+		if (len >= off && len < off + 64)
+			b[len - off] = 0x80;
+		if (k == _blocks(j) - 1)
+			for (n = 0; n < 8; n++)
+				b[56 + n] = bits >> (8 * n);
+		p = b;
+	}
+	for (i = 0; i < 16; i++, p += 4)
+		W[i][l] = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void _start(struct md5_lane *lane, uint32_t state[4][LANES], int l,
+		   md5_multi_job j)
+{
+	lane->job = j;
+	lane->block = 0;
+	lane->blocks = _blocks(j);
+	state[0][l] = 0x67452301;
+	state[1][l] = 0xefcdab89;
+	state[2][l] = 0x98badcfe;
+	state[3][l] = 0x10325476;
+}
+
+int md5_multi_lanes(void)
+{
+	return LANES;
+}
+
+void md5_multi(md5_multi_job jobs, int n)
+{
+	uint32_t state[4][LANES], W[16][LANES];
+	struct md5_lane lane[LANES];
+	unsigned char *dst;
+	int next = 0, active = 0, l, i;
+
+	memset(state, 0, sizeof(state));
+	memset(W, 0, sizeof(W));
+	for (l = 0; l < LANES; l++) {
+		lane[l].job = NULL;
+		if (next < n) {
+			_start(&lane[l], state, l, &jobs[next++]);
+			active++;
+		}
+	}
+	while (active) {
+		/* Idle lanes hash whatever was left in W; never mind. */
+		for (l = 0; l < LANES; l++)
+			if (lane[l].job)
+				_load_block(lane[l].job, lane[l].block, W, l);
+		_compress(state, W);
+		for (l = 0; l < LANES; l++) {
+			if (!lane[l].job || ++lane[l].block < lane[l].blocks)
+				continue;
+			dst = lane[l].job->digest;
+			for (i = 0; i < 16; i++)
+				dst[i] = state[i / 4][l] >> (8 * (i % 4));
+			lane[l].job = NULL;
+			active--;
+			if (next < n) {
+				_start(&lane[l], state, l, &jobs[next++]);
+				active++;
+			}
+		}
+	}
+}
@@ -0,0 +1,31 @@
+/*
+ * Copyright (c) 2014 cisco Systems, Inc.
+ *
+ * Multi-buffer MD5: hashes several independent messages at once, one
+ * per SIMD lane (8 with AVX2, 4 with SSE2 or NEON; one at a time
+ * without any of them). Results are the same as with libubox md5.
+ *
+ */
+
+#ifndef MD5_MULTI_H
+#define MD5_MULTI_H
+
+#include <stddef.h>
+
+/* Each message is a prefix (e.g. a header built on the stack)
+ * followed by data. */
+typedef struct md5_multi_job_struct {
+	const void *prefix;
+	size_t prefix_len;
+	const void *data;
+	size_t data_len;
+	void *digest; /* 16 bytes */
+} md5_multi_job_s, *md5_multi_job;
+
+/* Number of messages hashed in parallel. */
+int md5_multi_lanes(void);
+
+/* Hash the n messages of jobs, writing each one's digest. */
+void md5_multi(md5_multi_job jobs, int n);
+
+#endif /* MD5_MULTI_H */
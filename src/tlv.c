@@ -22,11 +22,19 @@ static bool
 tlv_buffer_grow(struct tlv_buf *buf, int minlen)
 {
 	int delta = ((minlen / 256) + 1) * 256;
+	void *p;
+
+	/* At least double, so that filling a buffer takes a logarithmic
+	 * number of reallocs. */
+	if (delta < buf->buflen)
+		delta = buf->buflen;
+	p = realloc(buf->buf, buf->buflen + delta);
+	if (!p)
+		return false;
+	buf->buf = p;
+	memset(buf->buf + buf->buflen, 0, delta);
 	buf->buflen += delta;
-	buf->buf = realloc(buf->buf, buf->buflen);
-	if (buf->buf)
-		memset(buf->buf + buf->buflen - delta, 0, delta);
-	return !!buf->buf;
+	return true;
 }
 
 void
@@ -70,6 +78,8 @@ tlv_add(struct tlv_buf *buf, struct tlv_attr *pos, int id, int payload)
 
 	if (required > 0) {
 		tlv_buf_grow(buf, required);
+		if (offset - TLV_COOKIE + (int)sizeof(struct tlv_attr) + payload > buf->buflen)
+			return NULL;
 		attr = offset_to_attr(buf, offset);
 	} else {
 		attr = pos;
@@ -82,11 +92,19 @@ tlv_add(struct tlv_buf *buf, struct tlv_attr *pos, int id, int payload)
 
 int
 tlv_buf_init(struct tlv_buf *buf, int id)
+{
+	return tlv_buf_init_size(buf, id, 0);
+}
+
+int
+tlv_buf_init_size(struct tlv_buf *buf, int id, int size)
 {
 	if (!buf->grow)
 		buf->grow = tlv_buffer_grow;
 
 	buf->head = buf->buf;
+	if (size > buf->buflen)
+		tlv_buf_grow(buf, size - buf->buflen);
 	if (tlv_add(buf, buf->buf, id, 0) == NULL)
 		return -ENOMEM;
 
@@ -143,6 +161,8 @@ tlv_put_raw(struct tlv_buf *buf, const void *ptr, int len)
 		return NULL;
 
 	attr = tlv_add(buf, tlv_next(buf->head), 0, len - sizeof(struct tlv_attr));
+	if (!attr)
+		return NULL;
 	tlv_set_raw_len(buf->head, tlv_pad_len(buf->head) + len);
 	memcpy(attr, ptr, len);
 	return attr;
@@ -113,6 +113,8 @@ extern void tlv_set_raw_len(struct tlv_attr *attr, unsigned int len);
 extern bool tlv_attr_equal(const struct tlv_attr *a1, const struct tlv_attr *a2);
 extern int tlv_attr_cmp(const struct tlv_attr *a1, const struct tlv_attr *a2);
 extern int tlv_buf_init(struct tlv_buf *buf, int id);
+/* As tlv_buf_init, but with room for (at least) size bytes up front. */
+extern int tlv_buf_init_size(struct tlv_buf *buf, int id, int size);
 extern void tlv_buf_free(struct tlv_buf *buf);
 extern void tlv_buf_grow(struct tlv_buf *buf, int required);
 extern struct tlv_attr *tlv_new(struct tlv_buf *buf, int id, int payload);
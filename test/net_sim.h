@@ -115,6 +115,12 @@ typedef struct net_sim_t {
   int next_free_iid;
 
   bool accept_time_errors;
+
+  /* Enable bulk sync on nodes as they are created. */
+  bool bulk_sync;
+  bool delta_sync;
+  bool bucket_sync;
+  bool multicast_keepalive;
 } net_sim_s, *net_sim;
 
 int pa_update_eap(net_node node, const struct prefix *prefix,
@@ -171,6 +177,104 @@ void net_sim_init(net_sim s)
   s->next_free_iid = 100;
 }
 
+/* Log node data request statistics, summed over all nodes. */
+void net_sim_log_requests(net_sim s)
+{
+  unsigned int sent = 0, suppressed = 0, retried = 0;
+  unsigned int received = 0, received_bytes = 0;
+  unsigned int duplicates = 0, duplicate_bytes = 0;
+  unsigned int deltas = 0, delta_failures = 0, hash_mismatches = 0;
+  unsigned int ns_requests = 0, ns_bucket_requests = 0;
+  unsigned int ns_replies = 0, ns_reply_bytes = 0;
+  unsigned int pings = 0, keepalives = 0;
+  net_node n;
+
+  list_for_each_entry(n, &s->nodes, h)
+    {
+      sent += n->n.node_data_requests;
+      suppressed += n->n.node_data_requests_suppressed;
+      retried += n->n.node_data_requests_retried;
+      received += n->n.node_data_received;
+      received_bytes += n->n.node_data_received_bytes;
+      duplicates += n->n.node_data_duplicates;
+      duplicate_bytes += n->n.node_data_duplicate_bytes;
+      deltas += n->n.node_data_deltas;
+      delta_failures += n->n.node_data_delta_failures;
+      hash_mismatches += n->n.node_data_hash_mismatches;
+      ns_requests += n->n.network_state_requests;
+      ns_bucket_requests += n->n.network_state_bucket_requests;
+      ns_replies += n->n.network_state_replies;
+      ns_reply_bytes += n->n.network_state_reply_bytes;
+      pings += n->n.pings_sent;
+      keepalives += n->n.keepalives_sent;
+    }
+  L_NOTICE("node data requests: %u sent, %u suppressed, %u retried; "
+           "received %u (%u bytes), %u duplicates (%u bytes), "
+           "%u deltas (%u failed), %u hash mismatches",
+           sent, suppressed, retried, received, received_bytes,
+           duplicates, duplicate_bytes, deltas, delta_failures,
+           hash_mismatches);
+  L_NOTICE("network state requests: %u sent (%u for buckets), "
+           "%u replies (%u bytes)",
+           ns_requests, ns_bucket_requests, ns_replies, ns_reply_bytes);
+  L_NOTICE("liveness: %u pings, %u keepalives", pings, keepalives);
+}
+
+/* Resident set size, in kilobytes. */
+long net_sim_rss_kb(void)
+{
+  FILE *f = fopen("/proc/self/statm", "r");
+  long pages = 0;
+
+  if (!f)
+    return 0;
+  if (fscanf(f, "%*s %ld", &pages) != 1)
+    pages = 0;
+  fclose(f);
+  return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/* Log allocator statistics, summed over all nodes; returns false if
+ * the node pool of some node does not match its nodes. */
+bool net_sim_log_allocs(net_sim s)
+{
+  unsigned int node_allocs = 0, node_slabs = 0, node_slab_allocs = 0;
+  unsigned int neigh_allocs = 0, neigh_slabs = 0;
+  unsigned int arena_allocs = 0, arena_in_use = 0, arena_slabs = 0;
+  unsigned int arena_slab_allocs = 0, large_allocs = 0;
+  bool ok = true;
+  net_node n;
+  int i;
+
+  list_for_each_entry(n, &s->nodes, h)
+    {
+      if (n->n.node_pool.in_use != n->n.nodes.avl.count)
+        ok = false;
+      node_allocs += n->n.node_pool.allocs;
+      node_slabs += n->n.node_pool.slabs;
+      node_slab_allocs += n->n.node_pool.slab_allocs;
+      neigh_allocs += n->n.neighbor_pool.allocs;
+      neigh_slabs += n->n.neighbor_pool.slabs;
+      for (i = 0 ; i < HNCP_ARENA_CLASSES ; i++)
+        {
+          arena_allocs += n->n.arena[i].allocs;
+          arena_in_use += n->n.arena[i].in_use;
+          arena_slabs += n->n.arena[i].slabs;
+          arena_slab_allocs += n->n.arena[i].slab_allocs;
+        }
+      large_allocs += n->n.arena_large_allocs;
+    }
+  L_NOTICE("allocs: %u nodes (%u slabs, %u allocated), "
+           "%u neighbors (%u slabs), "
+           "%u arena (%u in use, %u slabs, %u allocated, %u large); "
+           "rss %ld kB",
+           node_allocs, node_slabs, node_slab_allocs,
+           neigh_allocs, neigh_slabs,
+           arena_allocs, arena_in_use, arena_slabs, arena_slab_allocs,
+           large_allocs, net_sim_rss_kb());
+  return ok;
+}
+
 bool net_sim_is_converged(net_sim s)
 {
   net_node n, n2, fn = NULL;
@@ -298,6 +402,10 @@ hncp net_sim_find_hncp(net_sim s, const char *name)
   sput_fail_unless(r, "hncp_init");
   if (!r)
     return NULL;
+  hncp_set_bulk_sync(&n->n, s->bulk_sync);
+  hncp_set_delta_sync(&n->n, s->delta_sync);
+  hncp_set_bucket_sync(&n->n, s->bucket_sync);
+  hncp_set_multicast_keepalive(&n->n, s->multicast_keepalive);
   list_add_tail(&n->h, &s->nodes);
   INIT_LIST_HEAD(&n->messages);
 #ifndef DISABLE_HNCP_PA
@@ -516,6 +624,12 @@ bool hncp_io_set_ifname_enabled(hncp o, const char *ifname, bool enabled)
   return true;
 }
 
+int hncp_io_get_ifindex(hncp o, const char *ifname)
+{
+  /* No real interfaces; the links are found by name instead. */
+  return 0;
+}
+
 int hncp_io_get_hwaddrs(unsigned char *buf, int buf_left)
 {
   return 0;
@@ -544,7 +658,7 @@ void hncp_io_schedule(hncp o, int msecs)
 }
 
 ssize_t hncp_io_recvfrom(hncp o, void *buf, size_t len,
-                         char *ifname,
+                         hncp_link *l,
                          struct in6_addr *src,
                          struct in6_addr *dst)
 {
@@ -554,14 +668,14 @@ ssize_t hncp_io_recvfrom(hncp o, void *buf, size_t len,
   list_for_each_entry(m, &node->messages, h)
     {
       int s = m->len > len ? len : m->len;
-      strcpy(ifname, m->l->ifname);
+      *l = m->l;
       *src = m->src;
       *dst = m->dst;
       memcpy(buf, m->buf, s);
       list_del(&m->h);
       free(m->buf);
       free(m);
-      L_DEBUG("%s/%s: hncp_io_recvfrom %d bytes", node->name, ifname, s);
+      L_DEBUG("%s/%s: hncp_io_recvfrom %d bytes", node->name, (*l)->ifname, s);
       return s;
     }
   return - 1;
@@ -575,6 +689,9 @@ sanity_check_buf(void *buf, size_t len)
   int last_len;
   bool ok = true;
   size_t dhs = sizeof(hncp_t_node_data_header_s);
+  size_t ddhs = sizeof(hncp_t_node_data_delta_header_s);
+  hncp_t_node_data_delta_header ddh;
+  size_t rlen;
 
   tlv_for_each_in_buf(a, buf, len)
     {
@@ -596,6 +713,13 @@ sanity_check_buf(void *buf, size_t len)
         case HNCP_T_NODE_DATA:
           sanity_check_buf(tlv_data(a)+dhs, tlv_len(a)-dhs);
           break;
+        case HNCP_T_NODE_DATA_DELTA:
+          /* Removed and added TLVs are each in order. */
+          ddh = tlv_data(a);
+          rlen = be32_to_cpu(ddh->removed_length);
+          sanity_check_buf(tlv_data(a)+ddhs, rlen);
+          sanity_check_buf(tlv_data(a)+ddhs+rlen, tlv_len(a)-ddhs-rlen);
+          break;
         }
     }
   sput_fail_unless(ok, "tlv ordering valid");
@@ -643,19 +767,15 @@ void _sendto(net_sim s, void *buf, size_t len, hncp_link sl, hncp_link dl,
           is_multicast ? "multicast" : "unicast");
 }
 
-ssize_t hncp_io_sendto(hncp o, void *buf, size_t len,
-                       const char *ifname,
+ssize_t hncp_io_sendto(hncp_link l, void *buf, size_t len,
                        const struct in6_addr *dst)
 {
+  hncp o = l->hncp;
   net_node node = container_of(o, net_node_s, n);
   net_sim s = node->s;
-  hncp_link l = hncp_find_link_by_name(o, ifname, false);
   bool is_multicast = memcmp(dst, &o->multicast_address, sizeof(*dst)) == 0;
   net_neigh n;
 
-  if (!l)
-    return -1;
-
   sanity_check_buf(buf, len);
   if (is_multicast)
     {
@@ -681,6 +801,42 @@ ssize_t hncp_io_sendto(hncp o, void *buf, size_t len,
   return 1;
 }
 
+ssize_t hncp_io_sendmsg(hncp_link l, const struct iovec *iov, int iovcnt,
+                        const struct in6_addr *dst)
+{
+  unsigned char buf[HNCP_MAXIMUM_PAYLOAD_SIZE];
+  size_t len = 0;
+  int i;
+
+  for (i = 0 ; i < iovcnt ; i++)
+    {
+      if (len + iov[i].iov_len > sizeof(buf))
+        return -1;
+      memcpy(buf + len, iov[i].iov_base, iov[i].iov_len);
+      len += iov[i].iov_len;
+    }
+  return hncp_io_sendto(l, buf, len, dst);
+}
+
+void hncp_io_batch_begin(hncp o)
+{
+}
+
+void hncp_io_batch_end(hncp o)
+{
+}
+
+bool hncp_io_stream_set_enabled(hncp o, bool enabled)
+{
+  return !enabled;
+}
+
+ssize_t hncp_io_stream_sendmsg(hncp_link l, const struct iovec *iov,
+                               int iovcnt, const struct in6_addr *dst)
+{
+  return -1;
+}
+
 hnetd_time_t hncp_io_time(hncp o)
 {
   return hnetd_time();
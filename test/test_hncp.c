@@ -197,6 +197,144 @@ void hncp_int(void)
   tlv_buf_free(&tb);
 }
 
+typedef struct {
+  hncp_subscriber_s s;
+  int added, removed;
+} counting_subscriber_s;
+
+static void _count_tlv_cb(hncp_subscriber s,
+                          hncp_node n, struct tlv_attr *tlv, bool add)
+{
+  counting_subscriber_s *c = container_of(s, counting_subscriber_s, s);
+
+  sput_fail_unless(!s->tlv_types
+                   || (s->tlv_types & HNCP_TLV_TYPE_MASK(tlv_id(tlv))),
+                   "only types subscribed to");
+  if (add)
+    c->added++;
+  else
+    c->removed++;
+}
+
+void hncp_subscribe_types(void)
+{
+  hncp o = hncp_create();
+  counting_subscriber_s all = { .s.tlv_change_callback = _count_tlv_cb };
+  counting_subscriber_s custom = {
+    .s.tlv_change_callback = _count_tlv_cb,
+    .s.tlv_types = HNCP_TLV_TYPE_MASK(HNCP_T_CUSTOM) };
+  counting_subscriber_s high = {
+    .s.tlv_change_callback = _count_tlv_cb,
+    .s.tlv_types = HNCP_TLV_TYPE_MASK(123) };
+  struct tlv_buf tb;
+  struct tlv_attr *t1, *t2;
+  int all_added;
+
+  sput_fail_if(!o, "create works");
+  hncp_self_flush(hncp_get_first_node(o));
+  hncp_subscribe(o, &all.s);
+  hncp_subscribe(o, &custom.s);
+  hncp_subscribe(o, &high.s);
+  all_added = all.added;
+  sput_fail_unless(all_added > 0, "all: existing TLVs");
+  sput_fail_unless(!custom.added && !high.added, "typed: no existing TLVs");
+
+  memset(&tb, 0, sizeof(tb));
+  tlv_buf_init(&tb, 0);
+  t1 = tlv_put(&tb, HNCP_T_CUSTOM, NULL, 0);
+  t2 = tlv_put(&tb, 123, NULL, 0);
+  hncp_add_tlv(o, t1);
+  hncp_add_tlv(o, t2);
+  hncp_self_flush(hncp_get_first_node(o));
+  sput_fail_unless(all.added == all_added + 2, "all: 2 added");
+  sput_fail_unless(custom.added == 1 && !custom.removed, "custom: 1 added");
+  sput_fail_unless(high.added == 1 && !high.removed, "high: 1 added");
+
+  hncp_remove_tlv(o, t1);
+  hncp_self_flush(hncp_get_first_node(o));
+  sput_fail_unless(all.removed == 1, "all: 1 removed");
+  sput_fail_unless(custom.removed == 1, "custom: 1 removed");
+  sput_fail_unless(!high.removed, "high: none removed");
+
+  hncp_unsubscribe(o, &high.s);
+  sput_fail_unless(high.removed == 1, "high: removed on unsubscribe");
+  hncp_unsubscribe(o, &custom.s);
+  hncp_unsubscribe(o, &all.s);
+  hncp_destroy(o);
+  tlv_buf_free(&tb);
+}
+
+typedef struct {
+  hncp_subscriber_s s;
+  int batches, added, removed;
+} batch_subscriber_s;
+
+static void _batch_cb(hncp_subscriber s,
+                      hncp_tlv_change changes, int num_changes)
+{
+  batch_subscriber_s *b = container_of(s, batch_subscriber_s, s);
+  int i;
+
+  sput_fail_unless(num_changes > 0, "non-empty batch");
+  b->batches++;
+  for (i = 0; i < num_changes; i++)
+    {
+      if (changes[i].add)
+        b->added++;
+      else
+        {
+          sput_fail_unless(!b->added, "removals first");
+          b->removed++;
+        }
+    }
+}
+
+void hncp_subscribe_batch(void)
+{
+  hncp o = hncp_create();
+  batch_subscriber_s b = { .s.tlv_changes_callback = _batch_cb };
+  struct tlv_buf tb;
+  struct tlv_attr *t1, *t2;
+
+  sput_fail_if(!o, "create works");
+  hncp_self_flush(hncp_get_first_node(o));
+  hncp_subscribe(o, &b.s);
+  sput_fail_unless(b.batches == 1 && b.added > 0, "existing TLVs in a batch");
+
+  memset(&tb, 0, sizeof(tb));
+  tlv_buf_init(&tb, 0);
+  t1 = tlv_put(&tb, HNCP_T_CUSTOM, NULL, 0);
+  t2 = tlv_put(&tb, 123, NULL, 0);
+  hncp_add_tlv(o, t1);
+  hncp_self_flush(hncp_get_first_node(o));
+  hncp_add_tlv(o, t2);
+  hncp_self_flush(hncp_get_first_node(o));
+  sput_fail_unless(b.batches == 1, "nothing before hncp_run");
+  b.added = b.removed = 0;
+  hncp_run(o);
+  sput_fail_unless(b.batches == 2, "one batch per run");
+  sput_fail_unless(b.added == 2 && !b.removed, "both TLVs added");
+
+  /* Removed and added back between runs = no change. */
+  hncp_remove_tlv(o, t1);
+  hncp_self_flush(hncp_get_first_node(o));
+  hncp_add_tlv(o, t1);
+  hncp_self_flush(hncp_get_first_node(o));
+  hncp_run(o);
+  sput_fail_unless(b.batches == 2, "changes cancelled out");
+
+  b.added = b.removed = 0;
+  hncp_remove_tlv(o, t2);
+  hncp_run(o);
+  sput_fail_unless(b.batches == 3 && b.removed == 1 && !b.added,
+                   "removal batched");
+
+  hncp_unsubscribe(o, &b.s);
+  sput_fail_unless(b.batches == 4, "remaining TLVs removed in a batch");
+  hncp_destroy(o);
+  tlv_buf_free(&tb);
+}
+
 int main(int argc, char **argv)
 {
   setbuf(stdout, NULL); /* so that it's in sync with stderr when redirected */
@@ -205,6 +343,8 @@ int main(int argc, char **argv)
   sput_enter_suite("hncp"); /* optional */
   sput_run_test(hncp_ext);
   sput_run_test(hncp_int);
+  sput_run_test(hncp_subscribe_types);
+  sput_run_test(hncp_subscribe_batch);
   sput_leave_suite(); /* optional */
   sput_finish_testing();
   return sput_get_return_value();
@@ -0,0 +1,496 @@
+/*
+ * $Id: test_hncp_io.c $
+ *
+ * Copyright (c) 2014 cisco Systems, Inc.
+ *
+ * Tests (and benchmarks) the real hncp_io over the loopback
+ * interface. hncp_io.c is included directly so that its private
+ * batching state and syscall counters can be looked at.
+ *
+ */
+
+#include "hncp_io.c"
+#include "sput.h"
+
+int log_level = LOG_NOTICE;
+
+#define LOOPBACK_IFNAME "lo"
+#define LOOPBACK_MESSAGES 64
+#define LOOPBACK_ROUNDS 100
+
+static void _fill(unsigned char *buf, int len, int i)
+{
+  memset(buf, i, len);
+  buf[0] = i >> 8;
+}
+
+/* Send n messages to ourselves, and receive them back. Returns the
+ * number received intact. */
+static int _loopback_round(hncp_link l, int n, bool batch)
+{
+  hncp o = l->hncp;
+  unsigned char buf[HNCP_MAXIMUM_PAYLOAD_SIZE];
+  unsigned char exp[HNCP_MAXIMUM_PAYLOAD_SIZE];
+  hncp_link rl;
+  struct in6_addr src, dst;
+  ssize_t len;
+  int i, ok = 0;
+
+  if (batch)
+    hncp_io_batch_begin(o);
+  for (i = 0 ; i < n ; i++)
+    {
+      int slen = 100 + i * 10;
+
+      _fill(buf, slen, i);
+      if (hncp_io_sendto(l, buf, slen, &in6addr_loopback) != slen)
+        break;
+    }
+  if (batch)
+    hncp_io_batch_end(o);
+  for (i = 0 ; i < n ; i++)
+    {
+      int elen = 100 + i * 10;
+
+      len = hncp_io_recvfrom(o, buf, sizeof(buf), &rl, &src, &dst);
+      if (len < 0)
+        break;
+      _fill(exp, elen, i);
+      if (len == elen && !memcmp(buf, exp, elen) && rl == l
+          && IN6_IS_ADDR_LOOPBACK(&src) && IN6_IS_ADDR_LOOPBACK(&dst))
+        ok++;
+    }
+  return ok;
+}
+
+static hncp_link _create_loopback(hncp *o)
+{
+  hncp_link l;
+
+  *o = hncp_create();
+  sput_fail_unless(*o, "hncp_create");
+  if (!*o)
+    return NULL;
+  hncp_if_set_enabled(*o, LOOPBACK_IFNAME, true);
+  l = hncp_find_link_by_name(*o, LOOPBACK_IFNAME, false);
+  sput_fail_unless(l && l->ifindex == (int)if_nametoindex(LOOPBACK_IFNAME),
+                   "loopback ifindex");
+  sput_fail_unless(l && hncp_find_link_by_ifindex(*o, l->ifindex) == l,
+                   "loopback by ifindex");
+  if (!l)
+    hncp_destroy(*o);
+  return l;
+}
+
+static void _loopback(bool batch)
+{
+  hncp o;
+  hncp_link l = _create_loopback(&o);
+  struct hncp_io_batch_struct *b;
+  int i, ok = 0;
+
+  if (!l)
+    return;
+  b = o->io_batch;
+  if (!batch)
+    b->recv_batch = 1;
+  for (i = 0 ; i < LOOPBACK_ROUNDS ; i++)
+    ok += _loopback_round(l, LOOPBACK_MESSAGES, batch);
+  sput_fail_unless(ok == LOOPBACK_ROUNDS * LOOPBACK_MESSAGES,
+                   "all messages looped back");
+  sput_fail_unless(b->send_packets == LOOPBACK_ROUNDS * LOOPBACK_MESSAGES,
+                   "send packets");
+  sput_fail_unless(b->recv_packets == LOOPBACK_ROUNDS * LOOPBACK_MESSAGES,
+                   "recv packets");
+  if (batch)
+    sput_fail_unless(b->send_syscalls * HNCP_IO_BATCH == b->send_packets,
+                     "full send batches");
+  else
+    sput_fail_unless(b->send_syscalls == b->send_packets,
+                     "one send per syscall");
+  L_NOTICE("%s: %d messages, %.3f send and %.3f recv syscalls/message",
+           batch ? "batched" : "unbatched", ok,
+           (double)b->send_syscalls / ok, (double)b->recv_syscalls / ok);
+  hncp_destroy(o);
+}
+
+void hncp_io_loopback_unbatched(void)
+{
+  _loopback(false);
+}
+
+void hncp_io_loopback_batched(void)
+{
+  _loopback(true);
+}
+
+void hncp_io_batch_nesting(void)
+{
+  hncp o;
+  hncp_link l = _create_loopback(&o), rl;
+  unsigned char buf[100];
+  struct in6_addr src, dst;
+
+  if (!l)
+    return;
+  memset(buf, 42, sizeof(buf));
+  hncp_io_batch_begin(o);
+  hncp_io_batch_begin(o);
+  hncp_io_sendto(l, buf, sizeof(buf), &in6addr_loopback);
+  hncp_io_batch_end(o);
+  sput_fail_unless(o->io_batch->num_send == 1, "queued until outermost end");
+  sput_fail_unless(hncp_io_recvfrom(o, buf, sizeof(buf), &rl,
+                                    &src, &dst) < 0, "nothing sent yet");
+  hncp_io_batch_end(o);
+  sput_fail_unless(o->io_batch->num_send == 0, "flushed");
+  sput_fail_unless(hncp_io_recvfrom(o, buf, sizeof(buf), &rl,
+                                    &src, &dst) == sizeof(buf), "received");
+  sput_fail_unless(rl == l, "on loopback link");
+  hncp_destroy(o);
+}
+
+void hncp_io_zero_length(void)
+{
+  hncp o;
+  hncp_link l = _create_loopback(&o), rl;
+  unsigned char buf[100];
+  struct in6_addr src, dst;
+
+  if (!l)
+    return;
+  memset(buf, 42, sizeof(buf));
+  hncp_io_batch_begin(o);
+  hncp_io_sendto(l, buf, 0, &in6addr_loopback);
+  hncp_io_sendto(l, buf, sizeof(buf), &in6addr_loopback);
+  hncp_io_batch_end(o);
+  sput_fail_unless(hncp_io_recvfrom(o, buf, sizeof(buf), &rl,
+                                    &src, &dst) == sizeof(buf),
+                   "empty datagram skipped");
+  sput_fail_unless(o->io_batch->recv_packets == 2, "both received");
+  hncp_destroy(o);
+}
+
+void hncp_io_large_datagram(void)
+{
+  hncp o;
+  hncp_link l = _create_loopback(&o), rl;
+  static unsigned char buf[HNCP_MAXIMUM_PAYLOAD_SIZE];
+  struct in6_addr src, dst;
+  int i;
+
+  if (!l)
+    return;
+  memset(buf, 42, sizeof(buf));
+  /* The first one of a batch may be as large as it gets. */
+  sput_fail_unless(hncp_io_sendto(l, buf, 5000, &in6addr_loopback) == 5000,
+                   "sent large");
+  sput_fail_unless(hncp_io_recvfrom(o, buf, sizeof(buf), &rl,
+                                    &src, &dst) == 5000, "received large");
+  /* Later ones only have a slot; if they do not fit it, they are lost,
+   * and the next ones are received one by one. */
+  hncp_io_batch_begin(o);
+  hncp_io_sendto(l, buf, 100, &in6addr_loopback);
+  hncp_io_sendto(l, buf, 5000, &in6addr_loopback);
+  hncp_io_batch_end(o);
+  sput_fail_unless(hncp_io_recvfrom(o, buf, sizeof(buf), &rl,
+                                    &src, &dst) == 100, "received small");
+  sput_fail_unless(hncp_io_recvfrom(o, buf, sizeof(buf), &rl,
+                                    &src, &dst) < 0, "large one dropped");
+  sput_fail_unless(o->io_batch->recv_truncated == 1, "truncated");
+  hncp_io_batch_begin(o);
+  for (i = 0 ; i < 4 ; i++)
+    hncp_io_sendto(l, buf, 5000, &in6addr_loopback);
+  hncp_io_batch_end(o);
+  for (i = 0 ; i < 4 ; i++)
+    if (hncp_io_recvfrom(o, buf, sizeof(buf), &rl, &src, &dst) != 5000)
+      break;
+  sput_fail_unless(i == 4, "received large ones one by one");
+  sput_fail_unless(o->io_batch->recv_truncated == 1, "no more truncated");
+  hncp_destroy(o);
+}
+
+void hncp_io_stale_ifindex(void)
+{
+  hncp o;
+  hncp_link l = _create_loopback(&o), rl;
+  unsigned char buf[100];
+  struct in6_addr src, dst;
+  int ifindex;
+
+  if (!l)
+    return;
+  ifindex = l->ifindex;
+  /* Pretend we missed the interface getting a new ifindex; both
+   * sending and receiving should notice and fix it up. */
+  hncp_link_set_ifindex(l, 0);
+  sput_fail_unless(!hncp_find_link_by_ifindex(o, ifindex), "forgotten");
+  memset(buf, 42, sizeof(buf));
+  sput_fail_unless(hncp_io_sendto(l, buf, sizeof(buf), &in6addr_loopback)
+                   == sizeof(buf), "sent");
+  sput_fail_unless(l->ifindex == ifindex, "resolved on send");
+  hncp_link_set_ifindex(l, ifindex + 1000);
+  sput_fail_unless(hncp_io_recvfrom(o, buf, sizeof(buf), &rl,
+                                    &src, &dst) == sizeof(buf), "received");
+  sput_fail_unless(rl == l, "on loopback link");
+  sput_fail_unless(l->ifindex == ifindex, "resolved on receive");
+  sput_fail_unless(!hncp_find_link_by_ifindex(o, ifindex + 1000),
+                   "old one forgotten");
+  /* Link events refresh it too. */
+  hncp_link_set_ifindex(l, ifindex + 1);
+  hncp_if_set_enabled(o, LOOPBACK_IFNAME, true);
+  sput_fail_unless(l->ifindex == ifindex, "resolved on enable");
+  hncp_destroy(o);
+}
+
+/* There is no uloop here; poll the stream sockets by hand, until
+ * nothing happens for a while. */
+static void _stream_poll(hncp o)
+{
+  struct hncp_io_streams_struct *st = o->io_streams;
+  hncp_io_stream s, s2;
+  int i;
+
+  for (i = 0 ; i < 100 ; i++)
+    {
+      _stream_accept_cb(&st->listen_ufd, ULOOP_READ);
+      list_for_each_entry_safe(s, s2, &st->streams, lh)
+        _stream_cb(&s->ufd, ULOOP_READ | ULOOP_WRITE);
+      usleep(1000);
+    }
+}
+
+typedef struct __packed {
+  uint32_t i;
+  unsigned char data[36];
+} stream_tlv_s;
+
+/* TLV lengths are 16 bits, so node data cannot be much larger than
+ * a datagram; but close to the limit, the reply (with LINK_ID and
+ * NODE_STATE) is not. */
+static void _fill_own_node_data(hncp o)
+{
+  stream_tlv_s t;
+  int i, n;
+
+  hncp_self_flush(o->own_node);
+  n = (TLV_ATTR_LEN_MASK - 2 * TLV_SIZE - sizeof(hncp_t_node_data_header_s)
+       - tlv_len(o->own_node->tlv_container)) / (TLV_SIZE + sizeof(t));
+  memset(&t, 42, sizeof(t));
+  for (i = 0 ; i < n ; i++)
+    {
+      t.i = cpu_to_be32(i);
+      hncp_add_tlv_raw(o, HNCP_T_CUSTOM, &t, sizeof(t));
+    }
+  hncp_self_flush(o->own_node);
+  sput_fail_unless(2 * TLV_SIZE + sizeof(hncp_t_link_id_s)
+                   + sizeof(hncp_t_node_state_s)
+                   + sizeof(hncp_t_node_data_header_s)
+                   + tlv_len(o->own_node->tlv_container)
+                   > HNCP_MAXIMUM_DATAGRAM_SIZE, "reply does not fit datagram");
+}
+
+/* Request for our node data, from someone else who accepts streams. */
+static void _req_own_node_data(hncp o, struct tlv_buf *tb)
+{
+  uint32_t v = cpu_to_be32(HNCP_STREAM_SYNC_VERSION);
+  hncp_t_link_id lid;
+
+  memset(tb, 0, sizeof(*tb));
+  tlv_buf_init(tb, 0);
+  lid = tlv_data(tlv_new(tb, HNCP_T_LINK_ID, sizeof(*lid)));
+  memset(&lid->node_identifier_hash, 1, HNCP_HASH_LEN);
+  lid->link_id = cpu_to_be32(1);
+  tlv_put(tb, HNCP_T_REQ_NODE_DATA, &o->own_node->node_identifier_hash,
+          HNCP_HASH_LEN);
+  tlv_put(tb, HNCP_T_STREAM_SYNC, &v, sizeof(v));
+}
+
+/* The reply should get streamed back to (ourselves as) a neighbor
+ * that asks for it, and accepts streams. */
+void hncp_io_stream_node_data(void)
+{
+  hncp o;
+  hncp_link l = _create_loopback(&o);
+  struct hncp_io_streams_struct *st;
+  struct tlv_buf tb;
+  hncp_neighbor ne;
+
+  if (!l)
+    return;
+  sput_fail_unless(hncp_set_stream_sync(o, true), "stream sync enabled");
+  if (!(st = o->io_streams))
+    goto out;
+  _fill_own_node_data(o);
+
+  /* Ask for it, as someone else on ::1. */
+  _req_own_node_data(o, &tb);
+  hncp_handle_stream_message(l, (struct in6_addr *)&in6addr_loopback,
+                             tlv_data(tb.head), tlv_len(tb.head));
+  tlv_buf_free(&tb);
+  vlist_for_each_element(&l->neighbors, ne, in_neighbors)
+    sput_fail_unless(ne->stream_sync_version == HNCP_STREAM_SYNC_VERSION,
+                     "neighbor accepts streams");
+  sput_fail_unless(st->messages_sent == 1, "reply streamed");
+
+  /* The reply comes back to us; we already have it. */
+  _stream_poll(o);
+  sput_fail_unless(st->messages_received == 1, "reply received");
+  sput_fail_unless(st->connections == 2, "both ends");
+  sput_fail_unless(o->node_data_duplicates == 1, "handled as node data");
+  sput_fail_unless(o->node_data_duplicate_bytes
+                   == TLV_SIZE + sizeof(hncp_t_node_data_header_s)
+                   + tlv_len(o->own_node->tlv_container), "all of it");
+  L_NOTICE("streamed %u bytes of node data", o->node_data_duplicate_bytes);
+ out:
+  hncp_destroy(o);
+}
+
+/* Streams are accepted only up to the limit; the length in the
+ * header does not make us allocate it; a peer that does not read gets
+ * closed, either for the backlog or when it has stalled for long. */
+void hncp_io_stream_limits(void)
+{
+  hncp o;
+  hncp_link l = _create_loopback(&o);
+  struct hncp_io_streams_struct *st;
+  static unsigned char big[12 * 1024 * 1024];
+  struct iovec iov = { big, sizeof(big) };
+  struct sockaddr_in6 addr;
+  int fds[HNCP_STREAM_MAX_STREAMS + 1];
+  uint32_t hdr = cpu_to_be32(HNCP_MAXIMUM_STREAM_MESSAGE_SIZE);
+  hncp_io_stream s, s2;
+  int i, n = 0;
+
+  if (!l)
+    return;
+  sput_fail_unless(hncp_set_stream_sync(o, true), "stream sync enabled");
+  if (!(st = o->io_streams))
+    goto out;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin6_family = AF_INET6;
+  addr.sin6_port = htons(HNCP_PORT);
+  addr.sin6_addr = in6addr_loopback;
+  for (i = 0 ; i <= HNCP_STREAM_MAX_STREAMS ; i++)
+    {
+      fds[i] = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
+      if (connect(fds[i], (struct sockaddr *)&addr, sizeof(addr)) == 0)
+        n++;
+      _stream_accept_cb(&st->listen_ufd, ULOOP_READ);
+    }
+  sput_fail_unless(n == HNCP_STREAM_MAX_STREAMS + 1, "connected");
+  sput_fail_unless(st->num_streams == HNCP_STREAM_MAX_STREAMS, "limited");
+  sput_fail_unless(st->refused == 1, "one refused");
+
+  if (write(fds[0], &hdr, sizeof(hdr)) != sizeof(hdr)
+      || write(fds[0], big, 10) != 10)
+    sput_fail_unless(0, "write");
+  usleep(1000);
+  n = 0;
+  list_for_each_entry_safe(s, s2, &st->streams, lh)
+    {
+      _stream_cb(&s->ufd, ULOOP_READ);
+      n += s->recv_len == sizeof(hdr) + 10
+        && s->recv_size <= HNCP_IO_STREAM_CHUNK;
+    }
+  sput_fail_unless(n == 1, "partial message, small buffer");
+
+  /* Nobody reads on the other end. */
+  sput_fail_unless(hncp_io_stream_sendmsg(l, &iov, 1, &in6addr_loopback)
+                   == sizeof(big), "queued");
+  s = _stream_find(o, &addr);
+  sput_fail_unless(s && s->send_done < s->send_len, "backlog");
+  if (s)
+    s->last_active -= HNCP_STREAM_IDLE_TIMEOUT;
+  _stream_idle_cb(&st->idle_timeout);
+  sput_fail_unless(st->num_streams == HNCP_STREAM_MAX_STREAMS - 1,
+                   "stalled writer closed");
+
+  sput_fail_unless(hncp_io_stream_sendmsg(l, &iov, 1, &in6addr_loopback)
+                   == sizeof(big), "queued again");
+  sput_fail_unless(hncp_io_stream_sendmsg(l, &iov, 1, &in6addr_loopback)
+                   < 0, "backlog full");
+  sput_fail_unless(hncp_io_stream_sendmsg(l, &iov, 1, &in6addr_loopback)
+                   < 0, "closing");
+  _stream_idle_cb(&st->idle_timeout);
+  sput_fail_unless(st->num_streams == HNCP_STREAM_MAX_STREAMS - 2,
+                   "closed for backlog");
+  for (i = 0 ; i <= HNCP_STREAM_MAX_STREAMS ; i++)
+    close(fds[i]);
+ out:
+  hncp_destroy(o);
+}
+
+#define UNREAD_REQUESTS 1000
+
+/* A peer that keeps asking over a stream for replies it never reads;
+ * the stream is closed once the backlog is full, but not while the
+ * request at hand is still being handled. */
+void hncp_io_stream_unread(void)
+{
+  hncp o;
+  hncp_link l = _create_loopback(&o);
+  struct hncp_io_streams_struct *st;
+  struct sockaddr_in6 addr;
+  struct tlv_buf tb;
+  hncp_io_stream s, s2;
+  uint32_t hdr;
+  int i, fd, ok = 0;
+
+  if (!l)
+    return;
+  sput_fail_unless(hncp_set_stream_sync(o, true), "stream sync enabled");
+  if (!(st = o->io_streams))
+    goto out;
+  _fill_own_node_data(o);
+  _req_own_node_data(o, &tb);
+  hdr = cpu_to_be32(tlv_len(tb.head));
+  memset(&addr, 0, sizeof(addr));
+  addr.sin6_family = AF_INET6;
+  addr.sin6_port = htons(HNCP_PORT);
+  addr.sin6_addr = in6addr_loopback;
+  fd = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
+  sput_fail_unless(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0,
+                   "connected");
+  _stream_accept_cb(&st->listen_ufd, ULOOP_READ);
+  sput_fail_unless(st->num_streams == 1, "accepted");
+  for (i = 0 ; i < UNREAD_REQUESTS ; i++)
+    if (write(fd, &hdr, sizeof(hdr)) == sizeof(hdr)
+        && write(fd, tlv_data(tb.head), tlv_len(tb.head))
+        == (ssize_t)tlv_len(tb.head))
+      ok++;
+  sput_fail_unless(ok == UNREAD_REQUESTS, "requests written");
+  tlv_buf_free(&tb);
+  usleep(10000);
+  list_for_each_entry_safe(s, s2, &st->streams, lh)
+    _stream_cb(&s->ufd, ULOOP_READ);
+  sput_fail_unless(st->messages_sent > 1, "replies streamed");
+  sput_fail_unless(st->messages_received < UNREAD_REQUESTS,
+                   "stopped reading");
+  sput_fail_unless(st->num_streams == 0, "closed");
+  close(fd);
+ out:
+  hncp_destroy(o);
+}
+
+int main(int argc, char **argv)
+{
+  setbuf(stdout, NULL); /* so that it's in sync with stderr when redirected */
+  openlog("test_hncp_io", LOG_CONS | LOG_PERROR, LOG_DAEMON);
+  sput_start_testing();
+  sput_enter_suite("hncp_io"); /* optional */
+  argc -= 1;
+  argv += 1;
+
+  sput_maybe_run_test(hncp_io_loopback_unbatched, do {} while(0));
+  sput_maybe_run_test(hncp_io_loopback_batched, do {} while(0));
+  sput_maybe_run_test(hncp_io_batch_nesting, do {} while(0));
+  sput_maybe_run_test(hncp_io_zero_length, do {} while(0));
+  sput_maybe_run_test(hncp_io_large_datagram, do {} while(0));
+  sput_maybe_run_test(hncp_io_stale_ifindex, do {} while(0));
+  sput_maybe_run_test(hncp_io_stream_node_data, do {} while(0));
+  sput_maybe_run_test(hncp_io_stream_limits, do {} while(0));
+  sput_maybe_run_test(hncp_io_stream_unread, do {} while(0));
+  sput_leave_suite(); /* optional */
+  sput_finish_testing();
+  return sput_get_return_value();
+}
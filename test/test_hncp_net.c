@@ -125,7 +125,8 @@ void hncp_two(void)
                    "hashes different");
 
   /* Should also have done the necessary purging of nodes due to lack
-   * of reachability.. */
+   * of reachability (once the prune grace period is over).. */
+  SIM_WHILE(&s, 1000, n2->nodes.avl.count != 1);
   sput_fail_unless(n2->nodes.avl.count == 1, "n2 nodes == 1");
 
   sput_fail_unless(hncp_if_has_highest_id(n1, "eth0") &&
@@ -194,6 +195,11 @@ static void raw_bird14(net_sim s)
 
   SIM_WHILE(s, 10000, !net_sim_is_converged(s));
 
+  L_NOTICE("converged in %lld ms, %d unicast and %d multicast sent",
+           (long long)(hnetd_time() - s->start),
+           s->sent_unicast, s->sent_multicast);
+  net_sim_log_requests(s);
+
   sput_fail_unless(net_sim_find_hncp(s, "b10")->nodes.avl.count == 11,
                    "b10 enough nodes");
 
@@ -272,8 +278,52 @@ void hncp_bird14_unique()
   raw_bird14(&s);
 }
 
+void hncp_bird14_bulk()
+{
+  net_sim_s s;
+
+  net_sim_init(&s);
+  s.bulk_sync = true;
+  raw_bird14(&s);
+}
+
+void hncp_bird14_bulk_mixed()
+{
+  net_sim_s s;
+  int i;
+
+  net_sim_init(&s);
+  /* Only every other node has bulk sync enabled; they still have to
+   * converge with the nodes that do not. */
+  for (i = 0 ; nodenames[i] ; i++)
+    hncp_set_bulk_sync(net_sim_find_hncp(&s, nodenames[i]), i % 2);
+  raw_bird14(&s);
+}
+
 bool no_conflicts = false;
 
+/* Connect node0 .. node<n-1> in a chain, each one's "down" link to the
+ * next one's "up" link. */
+static void _connect_chain(net_sim s, int n)
+{
+  int i;
+
+  for (i = 0 ; i < n - 1 ; i++)
+    {
+      char buf[128];
+
+      sprintf(buf, "node%d", i);
+      hncp n1 = net_sim_find_hncp(s, buf);
+      sprintf(buf, "node%d", i+1);
+      hncp n2 = net_sim_find_hncp(s, buf);
+
+      hncp_link l1 = net_sim_hncp_find_link_by_name(n1, "down");
+      hncp_link l2 = net_sim_hncp_find_link_by_name(n2, "up");
+      net_sim_set_connected(l1, l2, true);
+      net_sim_set_connected(l2, l1, true);
+    }
+}
+
 static void raw_hncp_tube(net_sim s, unsigned int num_nodes)
 {
   /* A LOT of routers connected in a tube (R1 R2 R3 .. RN). */
@@ -285,36 +335,29 @@ static void raw_hncp_tube(net_sim s, unsigned int num_nodes)
   memset(&h2, 1, sizeof(h2));
 
   s->disable_sd = true;
-  for (i = 0 ; i < num_nodes-1 ; i++)
+  /* Add intentional router ID collisions at nodes 0, 1,3 and 2 and 4 */
+  for (i = 0 ; i < num_nodes-1 && !no_conflicts ; i++)
     {
       char buf[128];
 
       sprintf(buf, "node%d", i);
       hncp n1 = net_sim_find_hncp(s, buf);
-      /* Add intentional router ID collisions at nodes 0, 1,3 and 2 and 4 */
-      if (!no_conflicts)
-        {
-          if (i == 0 || i == 1 || i == 3)
-            hncp_set_own_hash(n1, &h1);
-          else if (i == 2 || i == 4)
-            hncp_set_own_hash(n1, &h2);
-        }
-
-      sprintf(buf, "node%d", i+1);
-      hncp n2 = net_sim_find_hncp(s, buf);
-
-      hncp_link l1 = net_sim_hncp_find_link_by_name(n1, "down");
-      hncp_link l2 = net_sim_hncp_find_link_by_name(n2, "up");
-      net_sim_set_connected(l1, l2, true);
-      net_sim_set_connected(l2, l1, true);
+      if (i == 0 || i == 1 || i == 3)
+        hncp_set_own_hash(n1, &h1);
+      else if (i == 2 || i == 4)
+        hncp_set_own_hash(n1, &h2);
     }
+  _connect_chain(s, num_nodes);
   SIM_WHILE(s, 100000, !net_sim_is_converged(s));
 
   sput_fail_unless(net_sim_find_hncp(s, "node0")->nodes.avl.count >= num_nodes,
                    "enough nodes");
 
+  net_sim_log_requests(s);
   net_sim_uninit(s);
-  L_NOTICE("finished in %lld ms", (long long)hnetd_time() - s->start);
+  L_NOTICE("finished in %lld ms, %d unicast and %d multicast sent",
+           (long long)hnetd_time() - s->start,
+           s->sent_unicast, s->sent_multicast);
 }
 
 void hncp_tube_small(void)
@@ -346,6 +389,233 @@ void hncp_tube_beyond_multicast_unique(void)
   raw_hncp_tube(&s, 60);
 }
 
+void hncp_tube_beyond_multicast_bulk(void)
+{
+  net_sim_s s;
+
+  net_sim_init(&s);
+  s.bulk_sync = true;
+  raw_hncp_tube(&s, 60);
+}
+
+#define DELTA_NODES 4
+#define DELTA_LEASES 200
+#define DELTA_REFRESHES 20
+
+typedef struct __packed {
+  uint32_t lease;
+  uint32_t refreshed;
+  unsigned char data[32];
+} delta_lease_s;
+
+static void _delta_lease(hncp o, uint32_t lease, uint32_t refreshed, bool add)
+{
+  delta_lease_s dl;
+
+  memset(&dl, 0, sizeof(dl));
+  dl.lease = cpu_to_be32(lease);
+  dl.refreshed = cpu_to_be32(refreshed);
+  hncp_update_tlv_raw(o, HNCP_T_CUSTOM, &dl, sizeof(dl), add);
+}
+
+/* The first node of a chain has a lot of leases, and refreshes them
+ * one at a time. Returns the node data bytes received (by everyone)
+ * for the refreshes. */
+static unsigned int raw_hncp_delta(net_sim s)
+{
+  unsigned int i, bytes = 0, deltas = 0, failures = 0;
+  hncp o;
+  net_node node;
+
+  s->disable_sd = true;
+  o = net_sim_find_hncp(s, "node0");
+  _connect_chain(s, DELTA_NODES);
+  for (i = 0 ; i < DELTA_LEASES ; i++)
+    _delta_lease(o, i, 0, true);
+  hncp_self_flush(o->own_node);
+  SIM_WHILE(s, 10000, !net_sim_is_converged(s));
+  list_for_each_entry(node, &s->nodes, h)
+    {
+      node->n.node_data_received_bytes = 0;
+      node->n.node_data_deltas = 0;
+    }
+  for (i = 0 ; i < DELTA_REFRESHES ; i++)
+    {
+      _delta_lease(o, i, 0, false);
+      _delta_lease(o, i, 1, true);
+      hncp_self_flush(o->own_node);
+      SIM_WHILE(s, 10000, !net_sim_is_converged(s));
+    }
+  list_for_each_entry(node, &s->nodes, h)
+    {
+      bytes += node->n.node_data_received_bytes;
+      deltas += node->n.node_data_deltas;
+      failures += node->n.node_data_delta_failures;
+    }
+  sput_fail_unless(s->delta_sync ? deltas > 0 : !deltas, "deltas");
+  sput_fail_unless(!failures, "no delta failures");
+  net_sim_log_requests(s);
+  net_sim_uninit(s);
+  return bytes;
+}
+
+void hncp_delta_sync(void)
+{
+  net_sim_s s;
+  unsigned int full, delta;
+
+  net_sim_init(&s);
+  full = raw_hncp_delta(&s);
+  net_sim_init(&s);
+  s.delta_sync = true;
+  delta = raw_hncp_delta(&s);
+  L_NOTICE("%d lease refreshes: %u node data bytes, %u with delta sync",
+           DELTA_REFRESHES, full, delta);
+  sput_fail_unless(delta * 4 < full, "delta sync sends less");
+}
+
+#define BUCKET_NODES 60
+#define BUCKET_CHANGES 10
+
+/* A chain too long for network state to fit in multicast, with the
+ * first node changing its node data repeatedly. Returns the network
+ * state reply bytes sent (by everyone) for the changes. */
+static unsigned int raw_hncp_bucket(net_sim s)
+{
+  unsigned int i, bytes = 0, bucket_requests = 0;
+  hncp o;
+  net_node node;
+
+  s->disable_sd = true;
+  o = net_sim_find_hncp(s, "node0");
+  _connect_chain(s, BUCKET_NODES);
+  SIM_WHILE(s, 100000, !net_sim_is_converged(s));
+  sput_fail_unless(o->nodes.avl.count == BUCKET_NODES, "all nodes");
+  list_for_each_entry(node, &s->nodes, h)
+    node->n.network_state_reply_bytes = 0;
+  for (i = 0 ; i < BUCKET_CHANGES ; i++)
+    {
+      uint32_t v = cpu_to_be32(i);
+
+      hncp_add_tlv_raw(o, HNCP_T_CUSTOM, &v, sizeof(v));
+      hncp_self_flush(o->own_node);
+      SIM_WHILE(s, 10000, !net_sim_is_converged(s));
+    }
+  list_for_each_entry(node, &s->nodes, h)
+    {
+      bytes += node->n.network_state_reply_bytes;
+      bucket_requests += node->n.network_state_bucket_requests;
+    }
+  sput_fail_unless(s->bucket_sync ? bucket_requests > 0 : !bucket_requests,
+                   "bucket requests");
+  net_sim_log_requests(s);
+  net_sim_uninit(s);
+  return bytes;
+}
+
+void hncp_bucket_sync(void)
+{
+  net_sim_s s;
+  unsigned int full, bucket;
+
+  net_sim_init(&s);
+  full = raw_hncp_bucket(&s);
+  net_sim_init(&s);
+  s.bucket_sync = true;
+  bucket = raw_hncp_bucket(&s);
+  L_NOTICE("%d node data changes: %u network state bytes, %u with bucket sync",
+           BUCKET_CHANGES, full, bucket);
+  sput_fail_unless(bucket * 4 < full, "bucket sync sends less");
+}
+
+#define DENSE_NODES 20
+
+/* Has every router on the link published all the others as neighbors? */
+static bool _dense_meshed(net_sim s)
+{
+  struct tlv_attr *a;
+  net_node node;
+  int c;
+
+  list_for_each_entry(node, &s->nodes, h)
+    {
+      c = 0;
+      hncp_node_for_each_tlv_with_type(node->n.own_node, a,
+                                       HNCP_T_NODE_DATA_NEIGHBOR)
+        c++;
+      if (c != DENSE_NODES - 1)
+        return false;
+    }
+  return true;
+}
+
+/* Many routers on one shared link, left alone once converged. Returns
+ * the messages (unicast and multicast) sent while idle. */
+static int raw_hncp_dense(net_sim s)
+{
+  hncp_link links[DENSE_NODES];
+  unsigned int pings = 0, keepalives = 0;
+  int i, j, sent;
+  hnetd_time_t t;
+  net_node node;
+
+  s->disable_sd = true;
+  for (i = 0 ; i < DENSE_NODES ; i++)
+    {
+      char buf[128];
+
+      sprintf(buf, "node%d", i);
+      links[i] = net_sim_hncp_find_link_by_name(net_sim_find_hncp(s, buf),
+                                                "eth0");
+    }
+  for (i = 0 ; i < DENSE_NODES ; i++)
+    for (j = 0 ; j < DENSE_NODES ; j++)
+      if (i != j)
+        net_sim_set_connected(links[i], links[j], true);
+  SIM_WHILE(s, 100000, !net_sim_is_converged(s) || !_dense_meshed(s));
+
+  sent = s->sent_unicast + s->sent_multicast;
+  list_for_each_entry(node, &s->nodes, h)
+    node->n.pings_sent = node->n.keepalives_sent = 0;
+  s->should_be_stable_topology = true;
+  t = hnetd_time();
+  SIM_WHILE(s, 100000, !net_sim_is_converged(s) ||
+            (hnetd_time() - t) < (HNCP_INTERVAL_WORRIED * 2 *
+                                  HNCP_INTERVAL_RETRIES));
+  sent = s->sent_unicast + s->sent_multicast - sent;
+  s->should_be_stable_topology = false;
+
+  for (i = 0 ; i < DENSE_NODES ; i++)
+    sput_fail_unless(links[i]->neighbors.avl.count == DENSE_NODES - 1,
+                     "neighbors kept");
+  list_for_each_entry(node, &s->nodes, h)
+    {
+      pings += node->n.pings_sent;
+      keepalives += node->n.keepalives_sent;
+    }
+  sput_fail_unless(s->multicast_keepalive ? keepalives > 0 : !keepalives,
+                   "keepalives");
+  L_NOTICE("%d routers on a link, idle: %d messages, %u pings, %u keepalives",
+           DENSE_NODES, sent, pings, keepalives);
+  net_sim_uninit(s);
+  return sent;
+}
+
+void hncp_dense_keepalive(void)
+{
+  net_sim_s s;
+  int unicast, multicast;
+
+  net_sim_init(&s);
+  unicast = raw_hncp_dense(&s);
+  net_sim_init(&s);
+  s.multicast_keepalive = true;
+  multicast = raw_hncp_dense(&s);
+  L_NOTICE("%d routers on a link: %d idle messages, %d with keepalives",
+           DENSE_NODES, unicast, multicast);
+  sput_fail_unless(multicast * 2 < unicast, "keepalives send less");
+}
+
 /* Note: As we play with bitmasks,
    NUM_MONKEY_ROUTERS * NUM_MONKEY_PORTS^2 <= 31
 */
@@ -535,6 +805,7 @@ void hncp_random_monkey(void)
   net_sim_s s;
   int ma[NUM_MONKEY_ROUTERS];
   int broken[4] = {-1, 0, 0, 0};
+  long rss, peak_rss;
   int i;
 
   memset(ma, 0, sizeof(ma));
@@ -551,6 +822,10 @@ void hncp_random_monkey(void)
         net_sim_hncp_find_link_n(n1, p1);
     }
 
+  /* Allocator churn: counts, and how much RSS grows over the run. */
+  net_sim_log_allocs(&s);
+  rss = peak_rss = net_sim_rss_kb();
+
   /* s.use_global_iids = true; */
   for (i = 0 ; i < NUM_MONKEY_ITERATIONS ; i++)
     {
@@ -590,7 +865,12 @@ void hncp_random_monkey(void)
               break;
             }
         }
+      if (net_sim_rss_kb() > peak_rss)
+        peak_rss = net_sim_rss_kb();
     }
+  sput_fail_unless(net_sim_log_allocs(&s), "node pools match nodes");
+  L_NOTICE("monkey rss %ld -> %ld kB (peak %ld kB)",
+           rss, net_sim_rss_kb(), peak_rss);
   net_sim_uninit(&s);
 
 }
@@ -630,9 +910,15 @@ int main(__unused int argc, __unused char **argv)
   maybe_run_test(hncp_two);
   maybe_run_test(hncp_bird14);
   maybe_run_test(hncp_bird14_unique);
+  maybe_run_test(hncp_bird14_bulk);
+  maybe_run_test(hncp_bird14_bulk_mixed);
   maybe_run_test(hncp_tube_small);
   maybe_run_test(hncp_tube_beyond_multicast);
   maybe_run_test(hncp_tube_beyond_multicast_unique);
+  maybe_run_test(hncp_tube_beyond_multicast_bulk);
+  maybe_run_test(hncp_delta_sync);
+  maybe_run_test(hncp_bucket_sync);
+  maybe_run_test(hncp_dense_keepalive);
   maybe_run_test(hncp_random_monkey);
   sput_leave_suite(); /* optional */
   sput_finish_testing();
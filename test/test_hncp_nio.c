@@ -22,6 +22,7 @@
 #define random random_mock
 static int random_mock(void);
 #include "hncp.c"
+#include "hncp_alloc.c"
 #include "hncp_notify.c"
 #include "hncp_proto.c"
 #include "hncp_timeout.c"
@@ -88,8 +89,13 @@ void hncp_io_schedule(hncp o, int msecs)
     }
 }
 
+int hncp_io_get_ifindex(hncp o __unused, const char *ifname __unused)
+{
+  return 0;
+}
+
 ssize_t hncp_io_recvfrom(hncp o, void *buf, size_t len,
-                         char *ifname,
+                         hncp_link *l,
                          struct in6_addr *src,
                          struct in6_addr *dst)
 {
@@ -97,7 +103,9 @@ ssize_t hncp_io_recvfrom(hncp o, void *buf, size_t len,
   int r_len = smock_pull_int("recvfrom_len");
   struct in6_addr *r_src = smock_pull("recvfrom_src");
   struct in6_addr *r_dst = smock_pull("recvfrom_dst");
-  smock_pull_string_is("recvfrom_ifname", ifname);
+  char *r_ifname = smock_pull("recvfrom_ifname");
+
+  *l = hncp_find_link_by_name(o, r_ifname, false);
 
   sput_fail_unless(o, "hncp");
   sput_fail_unless(o && o->udp_socket == 1, "hncp_io_schedule valid");
@@ -108,15 +116,16 @@ ssize_t hncp_io_recvfrom(hncp o, void *buf, size_t len,
   return r_len;
 }
 
-ssize_t hncp_io_sendto(hncp o, void *buf, size_t len,
-                       const char *ifname,
+ssize_t hncp_io_sendto(hncp_link l, void *buf, size_t len,
                        const struct in6_addr *dst)
 {
+  hncp o = l->hncp;
+
   if (check_send)
     {
       sput_fail_unless(o, "hncp");
       sput_fail_unless(o && o->udp_socket == 1, "hncp_io ready");
-      smock_pull_string_is("sendto_ifname", ifname);
+      smock_pull_string_is("sendto_ifname", l->ifname);
       struct in6_addr *e_dst = smock_pull("sendto_dst");
       sput_fail_unless(e_dst && memcmp(e_dst, dst, sizeof(*dst)) == 0, "dst match");
       /* Two optional verification steps.. */
@@ -139,6 +148,44 @@ ssize_t hncp_io_sendto(hncp o, void *buf, size_t len,
     }
 }
 
+ssize_t hncp_io_sendmsg(hncp_link l, const struct iovec *iov, int iovcnt,
+                        const struct in6_addr *dst)
+{
+  unsigned char buf[HNCP_MAXIMUM_PAYLOAD_SIZE];
+  size_t len = 0;
+  int i;
+
+  for (i = 0 ; i < iovcnt ; i++)
+    {
+      if (len + iov[i].iov_len > sizeof(buf))
+        return -1;
+      memcpy(buf + len, iov[i].iov_base, iov[i].iov_len);
+      len += iov[i].iov_len;
+    }
+  return hncp_io_sendto(l, buf, len, dst);
+}
+
+void hncp_io_batch_begin(hncp o __unused)
+{
+}
+
+void hncp_io_batch_end(hncp o __unused)
+{
+}
+
+bool hncp_io_stream_set_enabled(hncp o __unused, bool enabled)
+{
+  return !enabled;
+}
+
+ssize_t hncp_io_stream_sendmsg(hncp_link l __unused,
+                               const struct iovec *iov __unused,
+                               int iovcnt __unused,
+                               const struct in6_addr *dst __unused)
+{
+  return -1;
+}
+
 hnetd_time_t hncp_io_time(hncp o __unused)
 {
   if (check_timing)
@@ -0,0 +1,1397 @@
+/*
+ * $Id: test_hncp_perf.c $
+ *
+ * Copyright (c) 2014 cisco Systems, Inc.
+ *
+ * Micro-benchmarks for the hncp core data structures. These are not
+ * strict pass/fail tests (timing is only reported); the sput checks
+ * just make sure the optimized code paths produce the same results
+ * as the straightforward ones.
+ *
+ */
+
+#include "hncp_i.h"
+#include "md5_multi.h"
+#include "sput.h"
+
+int log_level = LOG_NOTICE;
+
+/* Time only moves when we say so. */
+static hnetd_time_t fake_time = 1000000;
+
+/* Lots of stubs here, rather not put __unused all over the place. */
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+/************************************************* Mocked interface - hncp_io */
+
+bool hncp_io_init(hncp o)
+{
+  return true;
+}
+
+void hncp_io_uninit(hncp o)
+{
+}
+
+bool hncp_io_set_ifname_enabled(hncp o, const char *ifname, bool enabled)
+{
+  return true;
+}
+
+int hncp_io_get_hwaddrs(unsigned char *buf, int buf_left)
+{
+  memset(buf, 42, buf_left);
+  return buf_left;
+}
+
+bool hncp_io_get_ipv6(struct in6_addr *addr, char *prefer_ifname)
+{
+  memset(addr, 0, sizeof(*addr));
+  return true;
+}
+
+void hncp_io_schedule(hncp o, int msecs)
+{
+}
+
+int hncp_io_get_ifindex(hncp o, const char *ifname)
+{
+  return 0;
+}
+
+/* Next message to be received, if any. */
+static unsigned char *recv_buf;
+static size_t recv_len;
+static hncp_link recv_link;
+
+ssize_t hncp_io_recvfrom(hncp o, void *buf, size_t len,
+                         hncp_link *l,
+                         struct in6_addr *src,
+                         struct in6_addr *dst)
+{
+  if (!recv_buf || recv_len > len)
+    return -1;
+  memcpy(buf, recv_buf, recv_len);
+  recv_buf = NULL;
+  *l = recv_link;
+  memset(src, 0, sizeof(*src));
+  *dst = o->multicast_address;
+  return recv_len;
+}
+
+/* Last message sent. sendmsg flattens it only if asked to, as the
+ * real one does not copy anything in userspace either. */
+static unsigned char sent_buf[HNCP_MAXIMUM_PAYLOAD_SIZE];
+static size_t sent_len;
+static int sent_count;
+static bool sent_flatten;
+
+ssize_t hncp_io_sendto(hncp_link l, void *buf, size_t len,
+                       const struct in6_addr *dst)
+{
+  if (len > sizeof(sent_buf))
+    return -1;
+  memcpy(sent_buf, buf, len);
+  sent_len = len;
+  sent_count++;
+  return len;
+}
+
+ssize_t hncp_io_sendmsg(hncp_link l, const struct iovec *iov, int iovcnt,
+                        const struct in6_addr *dst)
+{
+  size_t len = 0;
+  int i;
+
+  for (i = 0 ; i < iovcnt ; i++)
+    {
+      if (len + iov[i].iov_len > sizeof(sent_buf))
+        return -1;
+      if (sent_flatten)
+        memcpy(sent_buf + len, iov[i].iov_base, iov[i].iov_len);
+      len += iov[i].iov_len;
+    }
+  sent_len = len;
+  sent_count++;
+  return len;
+}
+
+void hncp_io_batch_begin(hncp o)
+{
+}
+
+void hncp_io_batch_end(hncp o)
+{
+}
+
+bool hncp_io_stream_set_enabled(hncp o, bool enabled)
+{
+  return !enabled;
+}
+
+ssize_t hncp_io_stream_sendmsg(hncp_link l, const struct iovec *iov,
+                               int iovcnt, const struct in6_addr *dst)
+{
+  return -1;
+}
+
+hnetd_time_t hncp_io_time(hncp o)
+{
+  return fake_time;
+}
+
+/****************************************************************** Utilities */
+
+static int64_t _usec(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static struct tlv_attr *_node_data(int i)
+{
+  struct tlv_buf tb;
+  struct tlv_attr *a;
+
+  memset(&tb, 0, sizeof(tb));
+  tlv_buf_init(&tb, 0);
+  a = tlv_new(&tb, HNCP_T_DNS_DELEGATED_ZONE, 32);
+  memset(tlv_data(a), i, 32);
+  tlv_fill_pad(tb.head);
+  a = tlv_memdup(tb.head);
+  tlv_buf_free(&tb);
+  return a;
+}
+
+/* Create a hncp instance with n (reachable) nodes, each of which
+ * has a bit of data. */
+static hncp _create_hncp(int n)
+{
+  hncp o = hncp_create();
+  hncp_hash_s h;
+  hncp_node node;
+  int i;
+
+  for (i = 1 ; i < n ; i++)
+    {
+      hncp_calculate_hash(&i, sizeof(i), &h);
+      node = hncp_find_node_by_hash(o, &h, true);
+      hncp_node_set(node, 1, hncp_time(o), _node_data(i));
+      node->last_reachable_prune = o->last_prune;
+    }
+  hncp_invalidate_network_hash(o, NULL);
+  hncp_calculate_network_hash(o);
+  return o;
+}
+
+static hncp_node _random_node(hncp o, int n)
+{
+  hncp_hash_s h;
+  int i = random() % n;
+
+  if (!i)
+    return o->own_node;
+  hncp_calculate_hash(&i, sizeof(i), &h);
+  return hncp_find_node_by_hash(o, &h, false);
+}
+
+/* Tube topology; node i is connected to i-1 (its link 1) and to i+1
+ * (its link 2). Own node is node 0. */
+static hncp_hash _tube_hash(hncp o, int i, hncp_hash_s *h)
+{
+  if (!i)
+    return &o->own_node->node_identifier_hash;
+  hncp_calculate_hash(&i, sizeof(i), h);
+  return h;
+}
+
+static void _tube_put_neighbor(hncp o, struct tlv_buf *tb, int i, int peer)
+{
+  hncp_t_node_data_neighbor_s ne;
+  hncp_hash_s h;
+
+  ne.neighbor_node_identifier_hash = *_tube_hash(o, peer, &h);
+  ne.link_id = htonl(peer < i ? 1 : 2);
+  ne.neighbor_link_id = htonl(peer < i ? 2 : 1);
+  tlv_put(tb, HNCP_T_NODE_DATA_NEIGHBOR, &ne, sizeof(ne));
+}
+
+static void _tube_set(hncp o, int i, int n, bool link_next, int v)
+{
+  struct tlv_buf tb;
+  struct tlv_attr *a;
+  hncp_hash_s h;
+  hncp_node node = hncp_find_node_by_hash(o, _tube_hash(o, i, &h), true);
+  hncp_t_version_s version = { .version = htonl(HNCP_VERSION) };
+
+  memset(&tb, 0, sizeof(tb));
+  tlv_buf_init(&tb, 0);
+  _tube_put_neighbor(o, &tb, i, i - 1);
+  if (link_next && i + 1 < n)
+    _tube_put_neighbor(o, &tb, i, i + 1);
+  tlv_put(&tb, HNCP_T_VERSION, &version, sizeof(version));
+  a = tlv_new(&tb, HNCP_T_DNS_DELEGATED_ZONE, 32);
+  memset(tlv_data(a), v, 32);
+  tlv_fill_pad(tb.head);
+  hncp_node_set(node, node->update_number + 1, hncp_time(o),
+                tlv_memdup(tb.head));
+  tlv_buf_free(&tb);
+}
+
+static void _run(hncp o)
+{
+  fake_time += HNCP_MINIMUM_PRUNE_INTERVAL + 1;
+  hncp_run(o);
+}
+
+static int _num_reachable(hncp o)
+{
+  hncp_node n;
+  int c = 0;
+
+  hncp_for_each_node(o, n)
+    c++;
+  return c;
+}
+
+static hncp _create_tube(int n)
+{
+  hncp o = hncp_create();
+  hncp_t_node_data_neighbor_s ne;
+  hncp_hash_s h;
+  int i;
+
+  for (i = 1 ; i < n ; i++)
+    _tube_set(o, i, n, true, 0);
+  ne.neighbor_node_identifier_hash = *_tube_hash(o, 1, &h);
+  ne.link_id = htonl(2);
+  ne.neighbor_link_id = htonl(1);
+  hncp_add_tlv_raw(o, HNCP_T_NODE_DATA_NEIGHBOR, &ne, sizeof(ne));
+  _run(o);
+  return o;
+}
+
+static int node_changes;
+
+static void _node_change_cb(hncp_subscriber s, hncp_node n, bool add)
+{
+  node_changes += add ? 1 : -1;
+}
+
+/**************************************************************** Test cases */
+
+#define NETWORK_HASH_ITERATIONS 1000
+
+static void _network_hash_n(int n)
+{
+  hncp o = _create_hncp(n);
+  hncp_node node;
+  hncp_hash_s h;
+  int64_t t, t_incremental = 0, t_full = 0;
+  int i;
+
+  sput_fail_unless(o->num_network_hash_checkpoints > 0, "checkpoints");
+  for (i = 0 ; i < NETWORK_HASH_ITERATIONS ; i++)
+    {
+      node = _random_node(o, n);
+      hncp_node_set(node, node->update_number + 1, 0, node->tlv_container);
+      t = _usec();
+      hncp_calculate_network_hash(o);
+      t_incremental += _usec() - t;
+      h = o->network_hash;
+
+      hncp_invalidate_network_hash(o, NULL);
+      t = _usec();
+      hncp_calculate_network_hash(o);
+      t_full += _usec() - t;
+      if (memcmp(&h, &o->network_hash, sizeof(h)))
+        break;
+    }
+  sput_fail_unless(i == NETWORK_HASH_ITERATIONS, "incremental == full");
+  L_NOTICE("network hash, %d nodes: %.2f us incremental, %.2f us full",
+           n,
+           (double)t_incremental / NETWORK_HASH_ITERATIONS,
+           (double)t_full / NETWORK_HASH_ITERATIONS);
+  hncp_destroy(o);
+}
+
+void hncp_perf_network_hash(void)
+{
+  _network_hash_n(100);
+  _network_hash_n(1000);
+  _network_hash_n(5000);
+}
+
+void hncp_perf_network_hash_membership(void)
+{
+  hncp o = _create_hncp(1000);
+  hncp_node node;
+  hncp_hash_s h;
+  int i;
+
+  /* Reachability changes and node removal should also be reflected
+   * correctly. */
+  for (i = 0 ; i < 100 ; i++)
+    {
+      node = _random_node(o, 1000);
+      if (node == o->own_node)
+        continue;
+      if (i % 2)
+        node->last_reachable_prune = o->last_prune - 1;
+      else
+        node->last_reachable_prune = o->last_prune;
+      hncp_invalidate_network_hash(o, node);
+      hncp_calculate_network_hash(o);
+      h = o->network_hash;
+      hncp_invalidate_network_hash(o, NULL);
+      hncp_calculate_network_hash(o);
+      if (memcmp(&h, &o->network_hash, sizeof(h)))
+        break;
+    }
+  sput_fail_unless(i == 100, "incremental == full (reachability)");
+
+  for (i = 0 ; i < 100 ; i++)
+    {
+      node = _random_node(o, 1000);
+      if (!node || node == o->own_node)
+        continue;
+      vlist_delete(&o->nodes, &node->in_nodes);
+      hncp_calculate_network_hash(o);
+      h = o->network_hash;
+      hncp_invalidate_network_hash(o, NULL);
+      hncp_calculate_network_hash(o);
+      if (memcmp(&h, &o->network_hash, sizeof(h)))
+        break;
+    }
+  sput_fail_unless(i == 100, "incremental == full (removal)");
+  hncp_destroy(o);
+}
+
+#define NODE_LOOKUP_ITERATIONS 100000
+
+static void _node_lookup_n(int n)
+{
+  hncp o = _create_hncp(n);
+  hncp_hash_s *hashes = calloc(n, sizeof(*hashes));
+  hncp_node node, ch;
+  int64_t t, t_index, t_tree;
+  int i, found_index = 0, found_tree = 0;
+
+  sput_fail_unless(o->num_node_index == n, "all nodes indexed");
+  for (i = 0 ; i < n ; i++)
+    hashes[i] = _random_node(o, n)->node_identifier_hash;
+
+  t = _usec();
+  for (i = 0 ; i < NODE_LOOKUP_ITERATIONS ; i++)
+    if (hncp_find_node_by_hash(o, &hashes[i % n], false))
+      found_index++;
+  t_index = _usec() - t;
+
+  t = _usec();
+  for (i = 0 ; i < NODE_LOOKUP_ITERATIONS ; i++)
+    {
+      ch = container_of(&hashes[i % n], hncp_node_s, node_identifier_hash);
+      if ((node = vlist_find(&o->nodes, ch, ch, in_nodes)))
+        found_tree++;
+    }
+  t_tree = _usec() - t;
+
+  sput_fail_unless(found_index == NODE_LOOKUP_ITERATIONS, "index lookups");
+  sput_fail_unless(found_tree == NODE_LOOKUP_ITERATIONS, "tree lookups");
+  L_NOTICE("node lookup, %d nodes, %d lookups: %.1f ns index, %.1f ns tree",
+           n, NODE_LOOKUP_ITERATIONS,
+           1000.0 * t_index / NODE_LOOKUP_ITERATIONS,
+           1000.0 * t_tree / NODE_LOOKUP_ITERATIONS);
+  free(hashes);
+  hncp_destroy(o);
+}
+
+void hncp_perf_node_lookup(void)
+{
+  _node_lookup_n(1000);
+  _node_lookup_n(10000);
+}
+
+void hncp_perf_node_index_churn(void)
+{
+  hncp o = _create_hncp(1000);
+  hncp_node node;
+  hncp_hash_s h;
+  int i, j;
+
+  /* Remove and re-add nodes at random; index should match the tree. */
+  for (i = 0 ; i < 5000 ; i++)
+    {
+      j = random() % 2000;
+      hncp_calculate_hash(&j, sizeof(j), &h);
+      if ((node = hncp_find_node_by_hash(o, &h, false)))
+        {
+          if (node != o->own_node)
+            vlist_delete(&o->nodes, &node->in_nodes);
+        }
+      else
+        hncp_find_node_by_hash(o, &h, true);
+    }
+  sput_fail_unless(o->num_node_index == (int)o->nodes.avl.count,
+                   "index size");
+  i = 0;
+  vlist_for_each_element(&o->nodes, node, in_nodes)
+    if (hncp_find_node_by_hash(o, &node->node_identifier_hash, false) == node)
+      i++;
+  sput_fail_unless(i == o->num_node_index, "index consistent");
+  hncp_destroy(o);
+}
+
+#define TLV_RANGES_NODES 1000
+#define TLV_RANGES_TYPES 12
+#define TLV_RANGES_PER_TYPE 3
+#define TLV_RANGES_ROUNDS 100
+
+/* TLV_RANGES_PER_TYPE TLVs of each of the types, in that order. */
+static struct tlv_attr *_typed_node_data(const int *types, int n)
+{
+  struct tlv_buf tb;
+  struct tlv_attr *a;
+  int i, j;
+
+  memset(&tb, 0, sizeof(tb));
+  tlv_buf_init(&tb, 0);
+  for (i = 0 ; i < n ; i++)
+    for (j = 0 ; j < TLV_RANGES_PER_TYPE ; j++)
+      {
+        a = tlv_new(&tb, types[i], 8);
+        memset(tlv_data(a), j, 8);
+      }
+  tlv_fill_pad(tb.head);
+  a = tlv_memdup(tb.head);
+  tlv_buf_free(&tb);
+  return a;
+}
+
+static int _count_linear(hncp_node n, uint16_t type)
+{
+  struct tlv_attr *a;
+  int c = 0;
+
+  hncp_node_for_each_tlv(n, a)
+    if (tlv_id(a) == type)
+      c++;
+  return c;
+}
+
+static int _count_indexed(hncp_node n, uint16_t type)
+{
+  struct tlv_attr *a;
+  int c = 0;
+
+  hncp_node_for_each_tlv_with_type(n, a, type)
+    c++;
+  return c;
+}
+
+void hncp_perf_tlv_ranges(void)
+{
+  hncp o = hncp_create();
+  int types[TLV_RANGES_TYPES], unsorted[] = { 6, 2, 6, 10 };
+  int i, j, k, c_linear = 0, c_indexed = 0, ok = 0;
+  size_t table_bytes = 0;
+  int64_t t, t_linear, t_indexed;
+  hncp_hash_s h;
+  hncp_node n;
+
+  for (i = 0 ; i < TLV_RANGES_TYPES ; i++)
+    types[i] = 2 * (i + 1);
+  for (i = 1 ; i <= TLV_RANGES_NODES ; i++)
+    {
+      hncp_calculate_hash(&i, sizeof(i), &h);
+      n = hncp_find_node_by_hash(o, &h, true);
+      hncp_node_set(n, 1, hncp_time(o),
+                    _typed_node_data(types, TLV_RANGES_TYPES));
+    }
+
+  /* Every (present or not) type, straight after the data arrived. */
+  hncp_for_each_node_including_unreachable(o, n)
+    {
+      table_bytes += n->num_tlv_ranges * sizeof(*n->tlv_ranges);
+      for (k = 1 ; k <= 2 * TLV_RANGES_TYPES + 1 ; k++)
+        if (_count_indexed(n, k) == _count_linear(n, k))
+          ok++;
+    }
+  sput_fail_unless(ok == (TLV_RANGES_NODES + 1) * (2 * TLV_RANGES_TYPES + 1),
+                   "same TLVs found as by scanning");
+
+  t = _usec();
+  for (j = 0 ; j < TLV_RANGES_ROUNDS ; j++)
+    hncp_for_each_node_including_unreachable(o, n)
+      for (k = 0 ; k < TLV_RANGES_TYPES ; k += 3)
+        c_linear += _count_linear(n, types[k]);
+  t_linear = _usec() - t;
+  t = _usec();
+  for (j = 0 ; j < TLV_RANGES_ROUNDS ; j++)
+    hncp_for_each_node_including_unreachable(o, n)
+      for (k = 0 ; k < TLV_RANGES_TYPES ; k += 3)
+        c_indexed += _count_indexed(n, types[k]);
+  t_indexed = _usec() - t;
+  sput_fail_unless(c_linear == c_indexed, "same counts");
+  L_NOTICE("tlv ranges, %d nodes x %d types: %d bytes of tables; "
+           "per lookup scan %.3f us, ranges %.3f us",
+           TLV_RANGES_NODES, TLV_RANGES_TYPES, (int)table_bytes,
+           (double)t_linear / (TLV_RANGES_ROUNDS * TLV_RANGES_NODES * 4),
+           (double)t_indexed / (TLV_RANGES_ROUNDS * TLV_RANGES_NODES * 4));
+
+  /* Unsorted data: only the first run of a type is found. */
+  n = o->own_node;
+  hncp_node_set(n, n->update_number + 1, hncp_time(o),
+                _typed_node_data(unsorted, 4));
+  sput_fail_unless(n->num_tlv_ranges == 3, "one range per type");
+  sput_fail_unless(_count_indexed(n, 2) == TLV_RANGES_PER_TYPE, "2 found");
+  sput_fail_unless(_count_indexed(n, 6) == TLV_RANGES_PER_TYPE, "6 found");
+  sput_fail_unless(_count_indexed(n, 10) == TLV_RANGES_PER_TYPE, "10 found");
+  sput_fail_unless(!_count_indexed(n, 4), "4 not there");
+
+  /* Gone with the data. */
+  hncp_node_set(n, n->update_number + 1, hncp_time(o), NULL);
+  sput_fail_unless(!n->num_tlv_ranges && !n->tlv_ranges, "no ranges");
+  hncp_destroy(o);
+}
+
+#define NODE_DATA_HASHES_NODES 1000
+#define NODE_DATA_HASHES_ROUNDS 20
+
+/* Network hash with every node data hash to (re)calculate, as after a
+ * bulk sync; batched (md5_multi) vs one node at a time. */
+void hncp_perf_node_data_hashes(void)
+{
+  hncp o = _create_hncp(NODE_DATA_HASHES_NODES);
+  static hncp_hash_s hashes[NODE_DATA_HASHES_NODES];
+  int types[TLV_RANGES_TYPES];
+  int64_t t, t_single = 0, t_batch = 0;
+  hncp_hash_s h;
+  hncp_node n;
+  int i, j, ok;
+
+  for (i = 0 ; i < TLV_RANGES_TYPES ; i++)
+    types[i] = 2 * (i + 1);
+  hncp_for_each_node(o, n)
+    if (n != o->own_node)
+      hncp_node_set(n, n->update_number + 1, hncp_time(o),
+                    _typed_node_data(types, 1 + random() % TLV_RANGES_TYPES));
+  for (j = 0 ; j < NODE_DATA_HASHES_ROUNDS ; j++)
+    {
+      hncp_for_each_node(o, n)
+        n->node_data_hash_dirty = true;
+      t = _usec();
+      i = 0;
+      hncp_for_each_node(o, n)
+        {
+          hncp_calculate_node_data_hash(n);
+          hashes[i++] = n->node_data_hash;
+        }
+      t_single += _usec() - t;
+      hncp_invalidate_network_hash(o, NULL);
+      hncp_calculate_network_hash(o);
+      h = o->network_hash;
+
+      hncp_for_each_node(o, n)
+        n->node_data_hash_dirty = true;
+      hncp_invalidate_network_hash(o, NULL);
+      t = _usec();
+      hncp_calculate_network_hash(o);
+      t_batch += _usec() - t;
+      sput_fail_unless(!memcmp(&h, &o->network_hash, sizeof(h)),
+                       "same network hash");
+    }
+  i = ok = 0;
+  hncp_for_each_node(o, n)
+    if (!n->node_data_hash_dirty
+        && !memcmp(&hashes[i++], &n->node_data_hash, HNCP_HASH_LEN))
+      ok++;
+  sput_fail_unless(ok == i, "same node data hashes");
+  L_NOTICE("node data hashes, %d nodes: one at a time %.1f us, "
+           "network hash with md5_multi (%d lanes) %.1f us",
+           i, (double)t_single / NODE_DATA_HASHES_ROUNDS,
+           md5_multi_lanes(), (double)t_batch / NODE_DATA_HASHES_ROUNDS);
+  hncp_destroy(o);
+}
+
+/* Resident set size, in kilobytes. */
+static long _rss_kb(void)
+{
+  FILE *f = fopen("/proc/self/statm", "r");
+  long pages = 0;
+
+  if (!f)
+    return 0;
+  if (fscanf(f, "%*s %ld", &pages) != 1)
+    pages = 0;
+  fclose(f);
+  return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+#define ALLOC_CHURN_NODES 1000
+#define ALLOC_CHURN_ROUNDS 20
+
+void hncp_perf_alloc_churn(void)
+{
+  hncp o = _create_hncp(ALLOC_CHURN_NODES);
+  unsigned int peak_slabs = 0, allocs = 0;
+  long rss = _rss_kb(), peak_rss = rss;
+  hncp_node node, node2;
+  hncp_hash_s h;
+  int i, j;
+  int64_t t = _usec();
+
+  /* Reachability flaps: most of the network goes away (and its data
+   * with it), and comes back with new data. */
+  for (i = 0 ; i < ALLOC_CHURN_ROUNDS ; i++)
+    {
+      avl_for_each_element_safe(&o->nodes.avl, node, in_nodes.avl, node2)
+        if (node != o->own_node && random() % 4)
+          vlist_delete(&o->nodes, &node->in_nodes);
+      for (j = 1 ; j < ALLOC_CHURN_NODES ; j++)
+        {
+          hncp_calculate_hash(&j, sizeof(j), &h);
+          if ((node = hncp_find_node_by_hash(o, &h, false)))
+            continue;
+          node = hncp_find_node_by_hash(o, &h, true);
+          hncp_node_set(node, 1, hncp_time(o), _node_data(i + j));
+        }
+      if (o->node_pool.slabs > peak_slabs)
+        peak_slabs = o->node_pool.slabs;
+      if (_rss_kb() > peak_rss)
+        peak_rss = _rss_kb();
+    }
+  t = _usec() - t;
+  sput_fail_unless(o->node_pool.in_use == o->nodes.avl.count,
+                   "node pool in use");
+  /* 32 bytes of data, in a 40 byte container. */
+  sput_fail_unless(o->arena[1].in_use == ALLOC_CHURN_NODES - 1,
+                   "node data in arena");
+  for (i = 0 ; i < HNCP_ARENA_CLASSES ; i++)
+    allocs += o->arena[i].allocs;
+
+  /* Once the rest of the network is gone, so are (almost) all slabs. */
+  avl_for_each_element_safe(&o->nodes.avl, node, in_nodes.avl, node2)
+    if (node != o->own_node)
+      vlist_delete(&o->nodes, &node->in_nodes);
+  sput_fail_unless(o->node_pool.in_use == 1, "own node in pool");
+  sput_fail_unless(o->node_pool.slabs <= 2, "node slabs released");
+  sput_fail_unless(o->arena[1].slabs <= 1, "node data slabs released");
+  L_NOTICE("alloc churn, %d nodes x %d rounds: %.1f ms,"
+           " %u node allocs (%u slab allocs), %u arena allocs,"
+           " %u node slabs at peak, rss %ld -> %ld kB (peak %ld kB)",
+           ALLOC_CHURN_NODES, ALLOC_CHURN_ROUNDS, (double)t / 1000,
+           o->node_pool.allocs, o->node_pool.slab_allocs, allocs,
+           peak_slabs, rss, _rss_kb(), peak_rss);
+  hncp_destroy(o);
+}
+
+#define SELF_FLUSH_TLVS 2000
+#define SELF_FLUSH_ROUNDS 1000
+
+/* Local TLVs, concatenated in order (as they were published before
+ * the container was kept up to date incrementally). */
+static bool _self_tlvs_ok(hncp o)
+{
+  struct tlv_attr *a = o->own_node->tlv_container;
+  struct tlv_buf tb;
+  hncp_tlv t;
+  bool ok;
+
+  memset(&tb, 0, sizeof(tb));
+  tlv_buf_init(&tb, 0);
+  vlist_for_each_element(&o->tlvs, t, in_tlvs)
+    tlv_fill_pad(tlv_put_raw(&tb, &t->tlv, tlv_pad_len(&t->tlv)));
+  tlv_fill_pad(tb.head);
+  ok = a && tlv_attr_equal(a, tb.head);
+  tlv_buf_free(&tb);
+  return ok;
+}
+
+void hncp_perf_self_flush(void)
+{
+  hncp o = hncp_create();
+  uint32_t v[2];
+  int64_t t;
+  int i, bad = 0;
+
+  for (i = 0 ; i < SELF_FLUSH_TLVS ; i++)
+    {
+      v[0] = htonl(2 * i);
+      v[1] = htonl(i);
+      hncp_add_tlv_raw(o, HNCP_T_DNS_DELEGATED_ZONE, v, sizeof(v));
+    }
+  hncp_self_flush(o->own_node);
+  sput_fail_unless(_self_tlvs_ok(o), "initial node data");
+
+  /* Add and remove one TLV at a time, at random places. */
+  t = _usec();
+  for (i = 0 ; i < SELF_FLUSH_ROUNDS ; i++)
+    {
+      v[0] = htonl(2 * (random() % SELF_FLUSH_TLVS) + 1);
+      v[1] = htonl(i);
+      hncp_add_tlv_raw(o, HNCP_T_DNS_DELEGATED_ZONE, v, sizeof(v));
+      hncp_self_flush(o->own_node);
+      if (i % 100 == 0 && !_self_tlvs_ok(o))
+        bad++;
+      hncp_remove_tlv_raw(o, HNCP_T_DNS_DELEGATED_ZONE, v, sizeof(v));
+      hncp_self_flush(o->own_node);
+    }
+  t = _usec() - t;
+  sput_fail_unless(!bad, "node data matches local TLVs");
+  sput_fail_unless(_self_tlvs_ok(o), "final node data");
+  L_NOTICE("self flush, %d local TLVs: %.1f us per change",
+           SELF_FLUSH_TLVS, (double)t / (2 * SELF_FLUSH_ROUNDS));
+  hncp_destroy(o);
+}
+
+#define PRUNE_ITERATIONS 100
+
+static void _prune_n(int n)
+{
+  hncp o = _create_tube(n);
+  hncp_subscriber_s sub = { .node_change_callback = _node_change_cb };
+  int64_t t, t_data = 0, t_full_data = 0, t_grow = 0, t_full_grow = 0;
+  hnetd_time_t last_prune = o->last_prune;
+  int i, j, data_prunes = 0, bad_grow = 0;
+
+  sput_fail_unless(_num_reachable(o) == n, "tube reachable");
+  hncp_subscribe(o, &sub);
+  node_changes = 0;
+
+  /* Changes of node data that do not affect the topology. */
+  for (i = 0 ; i < PRUNE_ITERATIONS ; i++)
+    {
+      j = 1 + random() % (n - 1);
+      _tube_set(o, j, n, true, i);
+      t = _usec();
+      _run(o);
+      t_data += _usec() - t;
+      if (o->last_prune != last_prune)
+        data_prunes++;
+      last_prune = o->last_prune;
+
+      _tube_set(o, j, n, true, i + 1);
+      o->graph_dirty = true;
+      o->graph_dirty_full = true;
+      t = _usec();
+      _run(o);
+      t_full_data += _usec() - t;
+      last_prune = o->last_prune;
+    }
+  sput_fail_unless(!data_prunes, "no prunes due to data changes");
+
+  /* Cut the tube in the middle, and then glue it back together. */
+  for (i = 0 ; i < PRUNE_ITERATIONS ; i++)
+    {
+      _tube_set(o, n / 2, n, false, 0);
+      _run(o);
+      if (node_changes != -(n - n / 2 - 1))
+        bad_grow++;
+
+      _tube_set(o, n / 2, n, true, 0);
+      t = _usec();
+      _run(o);
+      t_grow += _usec() - t;
+      if (node_changes)
+        bad_grow++;
+
+      _tube_set(o, n / 2, n, false, 0);
+      _run(o);
+      _tube_set(o, n / 2, n, true, 0);
+      o->graph_dirty_full = true;
+      t = _usec();
+      _run(o);
+      t_full_grow += _usec() - t;
+      if (node_changes)
+        bad_grow++;
+    }
+  sput_fail_unless(!bad_grow, "notifications match");
+  sput_fail_unless(_num_reachable(o) == n, "tube reachable at end");
+  L_NOTICE("prune, %d node tube: data change %.1f us (%.1f us full prune),"
+           " half joined %.1f us (%.1f us full prune)",
+           n,
+           (double)t_data / PRUNE_ITERATIONS,
+           (double)t_full_data / PRUNE_ITERATIONS,
+           (double)t_grow / PRUNE_ITERATIONS,
+           (double)t_full_grow / PRUNE_ITERATIONS);
+  hncp_unsubscribe(o, &sub);
+  hncp_destroy(o);
+}
+
+void hncp_perf_prune(void)
+{
+  _prune_n(1000);
+  _prune_n(5000);
+}
+
+#define PRUNE_DEEP_NODES 100000
+
+void hncp_perf_prune_deep(void)
+{
+  hncp o = _create_tube(PRUNE_DEEP_NODES);
+  int64_t t;
+
+  sput_fail_unless(_num_reachable(o) == PRUNE_DEEP_NODES, "tube reachable");
+
+  /* Cut the tube right after own node and glue it back together;
+   * both are traversals of the whole tube. */
+  _tube_set(o, 1, PRUNE_DEEP_NODES, false, 0);
+  t = _usec();
+  _run(o);
+  L_NOTICE("prune, %d node tube: cut %.1f ms",
+           PRUNE_DEEP_NODES, (double)(_usec() - t) / 1000);
+  sput_fail_unless(_num_reachable(o) == 2, "tube cut");
+
+  _tube_set(o, 1, PRUNE_DEEP_NODES, true, 0);
+  t = _usec();
+  _run(o);
+  L_NOTICE("prune, %d node tube: joined %.1f ms",
+           PRUNE_DEEP_NODES, (double)(_usec() - t) / 1000);
+  sput_fail_unless(_num_reachable(o) == PRUNE_DEEP_NODES, "tube joined");
+
+  o->graph_dirty = true;
+  o->graph_dirty_full = true;
+  t = _usec();
+  _run(o);
+  L_NOTICE("prune, %d node tube: full prune %.1f ms",
+           PRUNE_DEEP_NODES, (double)(_usec() - t) / 1000);
+  sput_fail_unless(_num_reachable(o) == PRUNE_DEEP_NODES, "tube reachable");
+  hncp_destroy(o);
+}
+
+#define NODE_DATA_REPLY_TLVS 200
+#define NODE_DATA_REPLY_ITERATIONS 100000
+
+/* Reference implementation of the REQ_NODE_DATA reply. */
+static void _node_data_reply_copy(hncp_link l, hncp_node n)
+{
+  int s = n->tlv_container ? tlv_len(n->tlv_container) : 0;
+  struct tlv_buf tb;
+  struct tlv_attr *a;
+  hncp_t_link_id lid;
+  hncp_t_node_state ns;
+  hncp_t_node_data_header h;
+
+  hncp_calculate_node_data_hash(n);
+  memset(&tb, 0, sizeof(tb));
+  tlv_buf_init(&tb, 0);
+  a = tlv_new(&tb, HNCP_T_LINK_ID, sizeof(*lid));
+  lid = tlv_data(a);
+  lid->node_identifier_hash = l->hncp->own_node->node_identifier_hash;
+  lid->link_id = cpu_to_be32(l->iid);
+  a = tlv_new(&tb, HNCP_T_NODE_STATE, sizeof(*ns));
+  ns = tlv_data(a);
+  ns->node_identifier_hash = n->node_identifier_hash;
+  ns->update_number = cpu_to_be32(n->update_number);
+  ns->ms_since_origination = cpu_to_be32(hncp_time(l->hncp)
+                                         - n->origination_time);
+  ns->node_data_hash = n->node_data_hash;
+  a = tlv_new(&tb, HNCP_T_NODE_DATA, sizeof(*h) + s);
+  h = tlv_data(a);
+  h->node_identifier_hash = n->node_identifier_hash;
+  h->update_number = cpu_to_be32(n->update_number);
+  memcpy((void *)h + sizeof(*h), tlv_data(n->tlv_container), s);
+  hncp_io_sendto(l, tlv_data(tb.head), tlv_len(tb.head), NULL);
+  tlv_buf_free(&tb);
+}
+
+static void _node_data_reply_check(hncp_link l, hncp_node n)
+{
+  static unsigned char buf[HNCP_MAXIMUM_PAYLOAD_SIZE];
+  size_t len;
+
+  _node_data_reply_copy(l, n);
+  memcpy(buf, sent_buf, sent_len);
+  len = sent_len;
+  sent_flatten = true;
+  hncp_link_send_node_data(l, NULL, n);
+  sent_flatten = false;
+  sput_fail_unless(n->node_data_reply_valid, "reply cached");
+  sput_fail_unless(sent_len == len, "same reply length");
+  sput_fail_unless(memcmp(buf, sent_buf, len) == 0, "same reply");
+}
+
+void hncp_perf_node_data_reply(void)
+{
+  hncp o = _create_hncp(2);
+  hncp_link l = hncp_find_link_by_name(o, "eth0", true);
+  hncp_node n = _random_node(o, 2);
+  struct tlv_buf tb;
+  struct tlv_attr *a;
+  int64_t t, t_copy, t_cached;
+  int i;
+
+  while (n == o->own_node)
+    n = _random_node(o, 2);
+  memset(&tb, 0, sizeof(tb));
+  tlv_buf_init(&tb, 0);
+  for (i = 0 ; i < NODE_DATA_REPLY_TLVS ; i++)
+    {
+      a = tlv_new(&tb, HNCP_T_DNS_DELEGATED_ZONE, 32);
+      memset(tlv_data(a), i, 32);
+    }
+  tlv_fill_pad(tb.head);
+  hncp_node_set(n, n->update_number + 1, hncp_time(o), tlv_memdup(tb.head));
+  tlv_buf_free(&tb);
+
+  _node_data_reply_check(l, n);
+  fake_time += 1234;
+  _node_data_reply_check(l, n);
+
+  /* New update number has to invalidate the cached reply. */
+  hncp_node_set(n, n->update_number + 1, hncp_time(o),
+                tlv_memdup(n->tlv_container));
+  sput_fail_unless(!n->node_data_reply_valid, "reply invalidated");
+  _node_data_reply_check(l, n);
+
+  t = _usec();
+  for (i = 0 ; i < NODE_DATA_REPLY_ITERATIONS ; i++)
+    _node_data_reply_copy(l, n);
+  t_copy = _usec() - t;
+  t = _usec();
+  for (i = 0 ; i < NODE_DATA_REPLY_ITERATIONS ; i++)
+    hncp_link_send_node_data(l, NULL, n);
+  t_cached = _usec() - t;
+  L_NOTICE("node data reply, %d bytes: copy %.3f us, cached %.3f us",
+           (int)sent_len,
+           (double)t_copy / NODE_DATA_REPLY_ITERATIONS,
+           (double)t_cached / NODE_DATA_REPLY_ITERATIONS);
+  hncp_destroy(o);
+}
+
+/* Received node data is verified against the hash in its NODE_STATE
+ * once, and that hash is kept (not recalculated) afterwards. */
+void hncp_perf_node_data_receive(void)
+{
+  hncp o = _create_hncp(2);
+  hncp_link l = hncp_find_link_by_name(o, "eth0", true);
+  hncp_node n = _random_node(o, 2);
+  static unsigned char buf[HNCP_MAXIMUM_PAYLOAD_SIZE];
+  struct in6_addr src = IN6ADDR_LOOPBACK_INIT;
+  struct tlv_attr *data = _node_data(42);
+  hncp_pending_request r = calloc(1, sizeof(*r));
+  hncp_hash_s h;
+  uint32_t un;
+  size_t len;
+
+  while (n == o->own_node)
+    n = _random_node(o, 2);
+  un = n->update_number + 2;
+  hncp_node_set(n, un, hncp_time(o), tlv_memdup(data));
+  _node_data_reply_copy(l, n);
+  memcpy(buf, sent_buf, sent_len);
+  len = sent_len;
+  h = n->node_data_hash;
+  hncp_node_set(n, un - 1, hncp_time(o), _node_data(43));
+
+  /* We asked for it. */
+  r->node_identifier_hash = n->node_identifier_hash;
+  r->avl.key = &r->node_identifier_hash;
+  r->update_number = un;
+  r->timeout = hncp_time(o) + HNCP_REQUEST_TIMEOUT;
+  avl_insert(&o->pending_requests, &r->avl);
+
+  /* Corrupt the last byte of the node data; it must not be taken. */
+  buf[len - 1] ^= 1;
+  hncp_handle_stream_message(l, &src, buf, len);
+  sput_fail_unless(o->node_data_hash_mismatches == 1, "mismatch noticed");
+  sput_fail_unless(n->update_number == un - 1, "corrupt data ignored");
+  sput_fail_unless(o->pending_requests.count == 1, "still asking");
+
+  buf[len - 1] ^= 1;
+  hncp_handle_stream_message(l, &src, buf, len);
+  sput_fail_unless(o->node_data_hash_mismatches == 1, "no new mismatch");
+  sput_fail_unless(n->update_number == un, "data taken");
+  sput_fail_unless(!o->pending_requests.count, "request done");
+  sput_fail_unless(tlv_attr_equal(n->tlv_container, data), "right data");
+  sput_fail_unless(!n->node_data_hash_dirty, "hash kept");
+  sput_fail_unless(!memcmp(&n->node_data_hash, &h, HNCP_HASH_LEN),
+                   "right hash");
+
+  /* Same data again, by hash only. */
+  hncp_node_set_hashed(n, un, 0, tlv_memdup(data), &h);
+  sput_fail_unless(!n->node_data_hash_dirty, "still same hash");
+  sput_fail_unless(n->update_number == un, "still same update number");
+  free(data);
+  hncp_destroy(o);
+}
+
+#define NETWORK_STATE_NODES 1000
+#define NETWORK_STATE_LINKS 8
+#define NETWORK_STATE_ROUNDS 100
+
+/* Reference implementation of the network state (rebuilt per link). */
+static void _network_state_copy(hncp_link l, size_t maximum_size)
+{
+  hncp o = l->hncp;
+  struct tlv_buf tb;
+  struct tlv_attr *a;
+  hncp_t_link_id lid;
+  hncp_t_node_state ns;
+  hncp_node n;
+  int nn = 0;
+
+  memset(&tb, 0, sizeof(tb));
+  tlv_buf_init(&tb, 0);
+  a = tlv_new(&tb, HNCP_T_LINK_ID, sizeof(*lid));
+  lid = tlv_data(a);
+  lid->node_identifier_hash = o->own_node->node_identifier_hash;
+  lid->link_id = cpu_to_be32(l->iid);
+  hncp_calculate_network_hash(o);
+  a = tlv_new(&tb, HNCP_T_NETWORK_HASH, HNCP_HASH_LEN);
+  memcpy(tlv_data(a), &o->network_hash, HNCP_HASH_LEN);
+  hncp_for_each_node(o, n)
+    nn++;
+  if (!maximum_size
+      || maximum_size >= (tlv_len(tb.head) + nn * sizeof(hncp_t_node_state_s)))
+    hncp_for_each_node(o, n)
+      {
+        a = tlv_new(&tb, HNCP_T_NODE_STATE, sizeof(*ns));
+        ns = tlv_data(a);
+        ns->node_identifier_hash = n->node_identifier_hash;
+        ns->update_number = cpu_to_be32(n->update_number);
+        ns->ms_since_origination = cpu_to_be32(hncp_time(o)
+                                               - n->origination_time);
+        ns->node_data_hash = n->node_data_hash;
+      }
+  if (!maximum_size || tlv_len(tb.head) <= maximum_size)
+    hncp_io_sendto(l, tlv_data(tb.head), tlv_len(tb.head), NULL);
+  tlv_buf_free(&tb);
+}
+
+static void _network_state_check(hncp_link l, size_t maximum_size)
+{
+  static unsigned char buf[HNCP_MAXIMUM_PAYLOAD_SIZE];
+  size_t len;
+
+  sent_len = 0;
+  _network_state_copy(l, maximum_size);
+  memcpy(buf, sent_buf, sent_len);
+  len = sent_len;
+  sent_len = 0;
+  sent_flatten = true;
+  hncp_link_send_network_state(l, NULL, maximum_size);
+  sent_flatten = false;
+  sput_fail_unless(sent_len == len, "same network state length");
+  sput_fail_unless(memcmp(buf, sent_buf, len) == 0, "same network state");
+}
+
+void hncp_perf_network_state(void)
+{
+  hncp o = _create_hncp(NETWORK_STATE_NODES);
+  hncp_link links[NETWORK_STATE_LINKS];
+  int64_t t, t_copy, t_cached;
+  hncp_node n;
+  char ifname[IFNAMSIZ];
+  int i, j;
+
+  for (i = 0 ; i < NETWORK_STATE_LINKS ; i++)
+    {
+      sprintf(ifname, "eth%d", i);
+      links[i] = hncp_find_link_by_name(o, ifname, true);
+    }
+
+  /* One miss per link set, both with and without the size limit. */
+  for (i = 0 ; i < NETWORK_STATE_LINKS ; i++)
+    _network_state_check(links[i], 0);
+  for (i = 0 ; i < NETWORK_STATE_LINKS ; i++)
+    _network_state_check(links[i], HNCP_MAXIMUM_MULTICAST_SIZE);
+  sput_fail_unless(o->network_state_misses == 1, "one miss");
+  sput_fail_unless(o->network_state_hits == 2 * NETWORK_STATE_LINKS - 1,
+                   "rest hit");
+
+  /* Time passing or update numbers bumped directly are patched. */
+  fake_time += 4321;
+  n = _random_node(o, NETWORK_STATE_NODES);
+  n->update_number++;
+  _network_state_check(links[0], 0);
+  sput_fail_unless(o->network_state_misses == 1, "still one miss");
+
+  /* New node data is not. */
+  hncp_node_set(n, n->update_number + 1, hncp_time(o),
+                tlv_memdup(n->tlv_container));
+  _network_state_check(links[0], 0);
+  sput_fail_unless(o->network_state_misses == 2, "miss after change");
+
+  t = _usec();
+  for (i = 0 ; i < NETWORK_STATE_ROUNDS ; i++)
+    {
+      /* Something changes every round. */
+      n = _random_node(o, NETWORK_STATE_NODES);
+      hncp_node_set(n, n->update_number + 1, hncp_time(o),
+                    tlv_memdup(n->tlv_container));
+      for (j = 0 ; j < NETWORK_STATE_LINKS ; j++)
+        _network_state_copy(links[j], 0);
+    }
+  t_copy = _usec() - t;
+  o->network_state_hits = 0;
+  o->network_state_misses = 0;
+  t = _usec();
+  for (i = 0 ; i < NETWORK_STATE_ROUNDS ; i++)
+    {
+      /* Something changes every round. */
+      n = _random_node(o, NETWORK_STATE_NODES);
+      hncp_node_set(n, n->update_number + 1, hncp_time(o),
+                    tlv_memdup(n->tlv_container));
+      for (j = 0 ; j < NETWORK_STATE_LINKS ; j++)
+        hncp_link_send_network_state(links[j], NULL, 0);
+    }
+  t_cached = _usec() - t;
+  sput_fail_unless(o->network_state_misses == NETWORK_STATE_ROUNDS,
+                   "one miss per round");
+  L_NOTICE("network state, %d nodes, %d links: copy %.1f us, "
+           "cached %.1f us per round (%u hits, %u misses)",
+           NETWORK_STATE_NODES, NETWORK_STATE_LINKS,
+           (double)t_copy / NETWORK_STATE_ROUNDS,
+           (double)t_cached / NETWORK_STATE_ROUNDS,
+           o->network_state_hits, o->network_state_misses);
+  hncp_destroy(o);
+}
+
+#define MESSAGE_DECODE_ROUNDS 1000
+
+/* Reference implementation of the old handle_message parsing; one
+ * pass for the link id, one for the network hash and requests, and
+ * one more for the node states. Returns the number of node states. */
+static int _message_decode_copy(void *data, ssize_t len)
+{
+  struct tlv_attr *a;
+  hncp_t_link_id lid = NULL;
+  unsigned char *nethash = NULL;
+  hncp_t_node_state ns = NULL;
+  int nodestates = 0;
+
+  tlv_for_each_in_buf(a, data, len)
+    if (tlv_id(a) == HNCP_T_LINK_ID)
+      {
+        if (lid || tlv_len(a) != sizeof(*lid))
+          return -1;
+        lid = tlv_data(a);
+      }
+  if (!lid)
+    return -1;
+  tlv_for_each_in_buf(a, data, len)
+    switch (tlv_id(a))
+      {
+      case HNCP_T_NETWORK_HASH:
+        if (tlv_len(a) != HNCP_HASH_LEN || nethash)
+          return -1;
+        nethash = tlv_data(a);
+        break;
+      case HNCP_T_NODE_STATE:
+        nodestates++;
+        break;
+      case HNCP_T_REQ_NET_HASH:
+      case HNCP_T_REQ_NODE_DATA:
+        return 0;
+      }
+  nodestates = 0;
+  tlv_for_each_in_buf(a, data, len)
+    if (tlv_id(a) == HNCP_T_NODE_STATE)
+      {
+        if (tlv_len(a) != sizeof(*ns))
+          return -1;
+        ns = tlv_data(a);
+        nodestates++;
+      }
+  return ns ? nodestates : 0;
+}
+
+void hncp_perf_message_decode(void)
+{
+  hncp o = _create_hncp(NETWORK_STATE_NODES);
+  hncp_link l = hncp_find_link_by_name(o, "eth0", true);
+  static unsigned char buf[HNCP_MAXIMUM_PAYLOAD_SIZE];
+  static hncp_message_s m;
+  static hncp_t_node_state node_states[HNCP_MESSAGE_MAX_NODE_STATES];
+  struct tlv_attr *a;
+  int64_t t, t_copy, t_decode, t_handle;
+  size_t len;
+
+  m.node_states = node_states;
+  m.max_node_states = HNCP_MESSAGE_MAX_NODE_STATES;
+  int i, r = 0;
+
+  sent_flatten = true;
+  hncp_link_send_network_state(l, NULL, 0);
+  sent_flatten = false;
+  memcpy(buf, sent_buf, sent_len);
+  len = sent_len;
+
+  sput_fail_unless(hncp_message_decode(&m, buf, len), "decoded");
+  sput_fail_unless(m.num_node_states == NETWORK_STATE_NODES, "all states");
+  sput_fail_unless(m.num_node_states == _message_decode_copy(buf, len),
+                   "same states");
+  sput_fail_unless(m.link_id && m.network_hash && !m.request
+                   && !m.num_node_data, "rest of the message");
+
+  /* Broken messages are rejected as a whole. */
+  a = (void *)buf + len - sizeof(hncp_t_node_state_s) - sizeof(*a);
+  sput_fail_unless(tlv_id(a) == HNCP_T_NODE_STATE, "last is node state");
+  tlv_init(a, HNCP_T_NODE_STATE, tlv_raw_len(a) - 4);
+  sput_fail_unless(!hncp_message_decode(&m, buf, len), "bad node state");
+  tlv_init(a, HNCP_T_NODE_STATE, tlv_raw_len(a) + 4);
+  sput_fail_unless(!hncp_message_decode(&m, buf + sizeof(hncp_t_link_id_s)
+                                        + sizeof(*a),
+                                        len - sizeof(hncp_t_link_id_s)
+                                        - sizeof(*a)), "no link id");
+
+  t = _usec();
+  for (i = 0 ; i < MESSAGE_DECODE_ROUNDS ; i++)
+    r += _message_decode_copy(buf, len);
+  t_copy = _usec() - t;
+  t = _usec();
+  for (i = 0 ; i < MESSAGE_DECODE_ROUNDS ; i++)
+    r += hncp_message_decode(&m, buf, len) ? m.num_node_states : 0;
+  t_decode = _usec() - t;
+  sput_fail_unless(r == 2 * MESSAGE_DECODE_ROUNDS * NETWORK_STATE_NODES,
+                   "all decoded");
+
+  /* Whole handling of an inconsistent multicast long form network
+   * state; nothing new in it, so nothing is requested. */
+  a = (void *)buf + sizeof(hncp_t_link_id_s) + sizeof(*a);
+  sput_fail_unless(tlv_id(a) == HNCP_T_NETWORK_HASH, "network hash");
+  memset(tlv_data(a), 0, HNCP_HASH_LEN);
+  sent_count = 0;
+  t = _usec();
+  for (i = 0 ; i < MESSAGE_DECODE_ROUNDS ; i++)
+    {
+      recv_buf = buf;
+      recv_len = len;
+      recv_link = l;
+      hncp_poll(o);
+    }
+  t_handle = _usec() - t;
+  sput_fail_unless(!sent_count, "nothing requested");
+  L_NOTICE("long form network state, %d nodes, %d bytes: "
+           "3-pass parse %.1f us, decode %.1f us, handle %.1f us",
+           NETWORK_STATE_NODES, (int)len,
+           (double)t_copy / MESSAGE_DECODE_ROUNDS,
+           (double)t_decode / MESSAGE_DECODE_ROUNDS,
+           (double)t_handle / MESSAGE_DECODE_ROUNDS);
+  hncp_destroy(o);
+}
+
+#define TIMER_NEIGHBORS 200
+#define TIMER_RUNS 10000
+#define TIMER_STEP (HNETD_TIME_PER_SECOND / 100)
+
+/* The earliest link or neighbor deadline, found the way hncp_run
+ * used to: by looking at every one of them. */
+static hnetd_time_t _timer_scan(hncp o)
+{
+  hnetd_time_t next = 0, now = hncp_time(o), t;
+  hncp_link l;
+  hncp_neighbor n;
+
+  vlist_for_each_element(&o->links, l, in_links)
+    {
+      next = TMIN(next, l->trickle_interval_end_time);
+      next = TMIN(next, l->trickle_send_time);
+      vlist_for_each_element(&l->neighbors, n, in_neighbors)
+        {
+          if (n->ping_count)
+            t = n->last_ping + (l->conf->ping_retry_base_t << n->ping_count);
+          else if (!n->last_response)
+            t = now;
+          else if (n->last_heard > n->last_response && n->in_sync)
+            t = n->last_heard + l->conf->ping_worried_t;
+          else
+            t = n->last_response + l->conf->ping_worried_t;
+          next = TMIN(next, t);
+        }
+    }
+  return next;
+}
+
+/* A shared LAN with lots of (in sync) neighbors, which we hear from
+ * one at a time. Only the due timers should be looked at per run. */
+void hncp_perf_timers(void)
+{
+  hncp o = _create_hncp(1);
+  hncp_link l = hncp_find_link_by_name(o, "eth0", true);
+  hncp_neighbor n, ns[TIMER_NEIGHBORS];
+  int64_t t, t_run = 0, t_scan = 0;
+  unsigned int timers_run;
+  bool ok = true;
+  int i;
+
+  for (i = 0 ; i < TIMER_NEIGHBORS ; i++)
+    {
+      n = calloc(1, sizeof(*n));
+      n->link = l;
+      hncp_calculate_hash(&i, sizeof(i), &n->node_identifier_hash);
+      n->iid = i;
+      n->last_heard = n->last_response = hncp_time(o);
+      n->in_sync = true;
+      vlist_add(&l->neighbors, &n->in_neighbors, n);
+      ns[i] = n;
+    }
+  hncp_run(o);
+  timers_run = o->timers_run;
+  sent_count = 0;
+  for (i = 0 ; i < TIMER_RUNS ; i++)
+    {
+      fake_time += TIMER_STEP;
+      ns[i % TIMER_NEIGHBORS]->last_heard = fake_time;
+      t = _usec();
+      hncp_run(o);
+      t_run += _usec() - t;
+      t = _usec();
+      if (o->timers[0]->time > _timer_scan(o))
+        ok = false;
+      t_scan += _usec() - t;
+    }
+  timers_run = o->timers_run - timers_run;
+  sput_fail_unless(ok, "heap has the earliest deadline");
+  sput_fail_unless(l->neighbors.avl.count == TIMER_NEIGHBORS,
+                   "neighbors kept");
+  sput_fail_unless(timers_run < TIMER_RUNS, "only due timers run");
+
+  /* Timers that did not fit in the heap are put back by hncp_run. */
+  hncp_timer_cancel(o, &l->timer);
+  hncp_timer_cancel(o, &ns[0]->timer);
+  o->timers_retry = true;
+  hncp_run(o);
+  sput_fail_unless(l->timer.index && ns[0]->timer.index, "timers retried");
+  sput_fail_unless(!o->timers_retry, "retry done");
+  L_NOTICE("%d neighbors, %d runs: %.2f timers/run, hncp_run %.1f us, "
+           "scanning all deadlines %.1f us",
+           TIMER_NEIGHBORS, TIMER_RUNS, (double)timers_run / TIMER_RUNS,
+           (double)t_run / TIMER_RUNS, (double)t_scan / TIMER_RUNS);
+  hncp_destroy(o);
+}
+
+#define maybe_run_test(fun) sput_maybe_run_test(fun, do {} while(0))
+
+int main(int argc, char **argv)
+{
+  setbuf(stdout, NULL); /* so that it's in sync with stderr when redirected */
+  openlog("test_hncp_perf", LOG_CONS | LOG_PERROR, LOG_DAEMON);
+  sput_start_testing();
+  sput_enter_suite("hncp_perf"); /* optional */
+  argc -= 1;
+  argv += 1;
+
+  maybe_run_test(hncp_perf_network_hash);
+  maybe_run_test(hncp_perf_network_hash_membership);
+  maybe_run_test(hncp_perf_node_lookup);
+  maybe_run_test(hncp_perf_node_index_churn);
+  maybe_run_test(hncp_perf_tlv_ranges);
+  maybe_run_test(hncp_perf_node_data_hashes);
+  maybe_run_test(hncp_perf_alloc_churn);
+  maybe_run_test(hncp_perf_self_flush);
+  maybe_run_test(hncp_perf_prune);
+  maybe_run_test(hncp_perf_prune_deep);
+  maybe_run_test(hncp_perf_node_data_reply);
+  maybe_run_test(hncp_perf_node_data_receive);
+  maybe_run_test(hncp_perf_network_state);
+  maybe_run_test(hncp_perf_message_decode);
+  maybe_run_test(hncp_perf_timers);
+  sput_leave_suite(); /* optional */
+  sput_finish_testing();
+  return sput_get_return_value();
+}
@@ -0,0 +1,150 @@
+/*
+ * $Id: test_md5_multi.c $
+ *
+ * Copyright (c) 2014 cisco Systems, Inc.
+ *
+ * md5_multi unit testing: results have to match libubox md5, for
+ * every length around the block boundaries and any mix of lengths.
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <libubox/md5.h>
+#include <libubox/utils.h>
+
+#include "md5_multi.h"
+#include "sput.h"
+
+static void _md5(const void *prefix, size_t prefix_len,
+                 const void *data, size_t data_len, void *digest)
+{
+  md5_ctx_t ctx;
+
+  md5_begin(&ctx);
+  md5_hash(prefix, prefix_len, &ctx);
+  md5_hash(data, data_len, &ctx);
+  md5_end(digest, &ctx);
+}
+
+static int64_t _usec(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+#define MAX_DATA 300
+#define NUM_JOBS (MAX_DATA + 1)
+
+void md5_multi_known(void)
+{
+  static const unsigned char abc_md5[16] = {
+    0x90, 0x01, 0x50, 0x98, 0x3c, 0xd2, 0x4f, 0xb0,
+    0xd6, 0x96, 0x3f, 0x7d, 0x28, 0xe1, 0x7f, 0x72 };
+  unsigned char digest[16];
+  md5_multi_job_s j = {
+    .prefix = "a", .prefix_len = 1, .data = "bc", .data_len = 2,
+    .digest = digest };
+
+  md5_multi(&j, 1);
+  sput_fail_unless(!memcmp(digest, abc_md5, 16), "md5(abc)");
+}
+
+void md5_multi_lengths(void)
+{
+  static unsigned char data[MAX_DATA + 64];
+  static unsigned char digest[NUM_JOBS][16];
+  md5_multi_job_s jobs[NUM_JOBS];
+  unsigned char expected[16];
+  int i, ok = 0;
+
+  for (i = 0 ; i < (int)sizeof(data) ; i++)
+    data[i] = random();
+  /* Prefix 0-63 bytes, data every length from 0 up, in one go. */
+  for (i = 0 ; i < NUM_JOBS ; i++)
+    {
+      jobs[i].prefix = data + MAX_DATA;
+      jobs[i].prefix_len = i % 64;
+      jobs[i].data = data;
+      jobs[i].data_len = i;
+      jobs[i].digest = digest[i];
+    }
+  md5_multi(jobs, NUM_JOBS);
+  for (i = 0 ; i < NUM_JOBS ; i++)
+    {
+      _md5(jobs[i].prefix, jobs[i].prefix_len, data, i, expected);
+      if (!memcmp(expected, digest[i], 16))
+        ok++;
+    }
+  sput_fail_unless(ok == NUM_JOBS, "same as md5");
+
+  /* Fewer messages than lanes. */
+  md5_multi(&jobs[NUM_JOBS - 1], 1);
+  sput_fail_unless(!memcmp(expected, digest[NUM_JOBS - 1], 16),
+                   "single message");
+}
+
+#define BENCH_JOBS 1000
+#define BENCH_LEN 400
+#define BENCH_ROUNDS 20
+
+/* Roughly what recalculating the node data hashes of a network of
+ * BENCH_JOBS nodes amounts to. */
+void md5_multi_bench(void)
+{
+  static unsigned char data[BENCH_JOBS][BENCH_LEN];
+  static unsigned char digest[BENCH_JOBS][16], expected[16];
+  static md5_multi_job_s jobs[BENCH_JOBS];
+  unsigned char prefix[24];
+  int64_t t, t_md5, t_multi;
+  int i, j, ok = 0;
+
+  memset(prefix, 42, sizeof(prefix));
+  for (i = 0 ; i < BENCH_JOBS ; i++)
+    {
+      memset(data[i], i, BENCH_LEN);
+      jobs[i].prefix = prefix;
+      jobs[i].prefix_len = sizeof(prefix);
+      jobs[i].data = data[i];
+      /* Not all the same size. */
+      jobs[i].data_len = BENCH_LEN - i % 128;
+      jobs[i].digest = digest[i];
+    }
+  t = _usec();
+  for (j = 0 ; j < BENCH_ROUNDS ; j++)
+    for (i = 0 ; i < BENCH_JOBS ; i++)
+      _md5(prefix, sizeof(prefix), data[i], jobs[i].data_len, expected);
+  t_md5 = _usec() - t;
+  t = _usec();
+  for (j = 0 ; j < BENCH_ROUNDS ; j++)
+    md5_multi(jobs, BENCH_JOBS);
+  t_multi = _usec() - t;
+  for (i = 0 ; i < BENCH_JOBS ; i++)
+    {
+      _md5(prefix, sizeof(prefix), data[i], jobs[i].data_len, expected);
+      if (!memcmp(expected, digest[i], 16))
+        ok++;
+    }
+  sput_fail_unless(ok == BENCH_JOBS, "same as md5");
+  printf("%d messages of ~%d bytes: md5 %.3f us, md5_multi (%d lanes) "
+         "%.3f us per message\n", BENCH_JOBS, BENCH_LEN,
+         (double)t_md5 / (BENCH_ROUNDS * BENCH_JOBS), md5_multi_lanes(),
+         (double)t_multi / (BENCH_ROUNDS * BENCH_JOBS));
+}
+
+int main(__unused int argc, __unused char **argv)
+{
+  setbuf(stdout, NULL); /* so that it's in sync with stderr when redirected */
+  sput_start_testing();
+  sput_enter_suite("md5_multi"); /* optional */
+  sput_run_test(md5_multi_known);
+  sput_run_test(md5_multi_lengths);
+  sput_run_test(md5_multi_bench);
+  sput_leave_suite(); /* optional */
+  sput_finish_testing();
+  return sput_get_return_value();
+}
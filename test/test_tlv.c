@@ -220,6 +220,108 @@ void test_tlv_sort()
   sput_fail_unless(c == 4, "should be 4 attrs");
 }
 
+/* Grow the way tlv_buffer_grow used to: in 256 byte steps. */
+static bool _linear_grow(struct tlv_buf *buf, int minlen)
+{
+  int delta = ((minlen / 256) + 1) * 256;
+  void *p = realloc(buf->buf, buf->buflen + delta);
+
+  if (!p)
+    return false;
+  buf->buf = p;
+  memset(buf->buf + buf->buflen, 0, delta);
+  buf->buflen += delta;
+  return true;
+}
+
+static int64_t _usec(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+#define FILL_BYTES 20000
+#define FILL_ROUNDS 500
+
+/* Fill tb with small TLVs (FILL_BYTES worth); returns the number of
+ * times the buffer had to grow. */
+static int _fill(struct tlv_buf *tb, int hint)
+{
+  struct tlv_attr *a;
+  int grows = 0, len, i;
+
+  tlv_buf_init_size(tb, 0, hint);
+  len = tb->buflen;
+  for (i = 0 ; tlv_len(tb->head) < FILL_BYTES ; i++)
+    {
+      if (!(a = tlv_new(tb, 1 + i % 7, i % 13)))
+        return -1;
+      memset(tlv_data(a), i, i % 13);
+      if (tb->buflen != len)
+        {
+          grows++;
+          len = tb->buflen;
+        }
+    }
+  return grows;
+}
+
+void tlv_grow_bench(void)
+{
+  struct tlv_buf lin, geo, hinted;
+  int lin_grows = 0, geo_grows = 0, hinted_grows = 0;
+  int64_t t0, t_lin, t_geo, t_hinted;
+  int i;
+
+  memset(&lin, 0, sizeof(lin));
+  memset(&geo, 0, sizeof(geo));
+  memset(&hinted, 0, sizeof(hinted));
+  lin.grow = _linear_grow;
+
+  t0 = _usec();
+  for (i = 0 ; i < FILL_ROUNDS ; i++)
+    {
+      lin_grows += _fill(&lin, 0);
+      if (i < FILL_ROUNDS - 1)
+        tlv_buf_free(&lin);
+    }
+  t_lin = _usec() - t0;
+
+  t0 = _usec();
+  for (i = 0 ; i < FILL_ROUNDS ; i++)
+    {
+      geo_grows += _fill(&geo, 0);
+      if (i < FILL_ROUNDS - 1)
+        tlv_buf_free(&geo);
+    }
+  t_geo = _usec() - t0;
+
+  /* As hncp_get_send_buf does: sized up front, and reused. */
+  t0 = _usec();
+  for (i = 0 ; i < FILL_ROUNDS ; i++)
+    hinted_grows += _fill(&hinted, FILL_BYTES + 64);
+  t_hinted = _usec() - t0;
+
+  L_NOTICE("filling %d bytes %d times: linear %d grows %lld us, "
+           "geometric %d grows %lld us, hinted+reused %d grows %lld us",
+           FILL_BYTES, FILL_ROUNDS,
+           lin_grows, (long long)t_lin, geo_grows, (long long)t_geo,
+           hinted_grows, (long long)t_hinted);
+  sput_fail_unless(lin_grows / FILL_ROUNDS >= FILL_BYTES / 256,
+                   "linear grows in small steps");
+  sput_fail_unless(geo_grows / FILL_ROUNDS <= 8,
+                   "geometric grows logarithmically");
+  sput_fail_unless(hinted_grows == 0, "hinted buffer does not grow");
+  sput_fail_unless(tlv_attr_equal(lin.head, geo.head)
+                   && tlv_attr_equal(lin.head, hinted.head),
+                   "same content regardless of growth");
+  tlv_buf_free(&lin);
+  tlv_buf_free(&geo);
+  tlv_buf_free(&hinted);
+}
+
 int main(__unused int argc, __unused char **argv)
 {
   setbuf(stdout, NULL); /* so that it's in sync with stderr when redirected */
@@ -230,6 +332,7 @@ int main(__unused int argc, __unused char **argv)
   sput_run_test(tlv_cmp);
   sput_run_test(tlv_nest);
   sput_run_test(test_tlv_sort);
+  sput_run_test(tlv_grow_bench);
   sput_leave_suite(); /* optional */
   sput_finish_testing();
   return sput_get_return_value();